@@ -0,0 +1,92 @@
+/*
+ * journal.h
+ *
+ * Vote journal: an append-only log in a pair of equal flash sectors (JOURNAL region of
+ * STM32F401CCUX_FLASH.ld). One 16-byte record per vote, so a vote costs four word programs
+ * and never an erase; the record carries candidate and voter index, so tally and voted set
+ * commit together.
+ *
+ * Sector: header | snapshot header | snapshot (tallies, voted set) | groups ...
+ * Group:  JOURNAL_CHECKPOINT_EVERY record slots | checkpoint
+ * Every word is written before the one that commits it: record words before the record CRC,
+ * snapshot before its header, snapshot header before the sector header. A reset mid-write
+ * leaves a part that fails its CRC and is skipped, never a half-counted vote.
+ *
+ * A checkpoint closes a full group: tallies after it, which of its slots hold committed
+ * records and a sum of their words. Boot applies a checkpointed group without a CRC per
+ * record, so only the open group at the end is checked record by record and recovery time
+ * stays flat however many votes the sector holds.
+ *
+ * When the active sector fills, the state moves to the other sector as a fresh snapshot and
+ * the old one is erased later from journal_service(), outside the vote path. Both sectors
+ * carry the key of the roll they count; a different roll starts an empty journal.
+ *
+ * journal_seal() appends a seal record after the last vote when the supply is failing. It
+ * never rotates (no snapshot, no erase), so it is a bounded number of programs, and a boot
+ * that finds it last knows the previous run stopped cleanly.
+ *
+ * Host build: Tools/flash_sim runs this file against a file-backed flash model.
+ */
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+
+#define JOURNAL_CANDIDATES      3U
+#define JOURNAL_RECORD_SIZE     16U
+#define JOURNAL_SECTORS         2U
+
+/* Record slots per checkpoint; at most 32, one bit of the checkpoint mask each */
+#define JOURNAL_CHECKPOINT_EVERY    32U
+
+/* Free records left when journal_service() moves to the other sector ahead of time */
+#ifndef JOURNAL_ROTATE_MARGIN
+#define JOURNAL_ROTATE_MARGIN   8U
+#endif
+
+/* Record types */
+#define JREC_VOTE       0x01U
+#define JREC_CHECKPOINT 0x02U
+#define JREC_SEAL       0x03U   /* clean stop: written by the power-fail path after the last vote */
+
+/* Results */
+#define JOURNAL_OK          0
+#define JOURNAL_FORMATTED   1   /* no journal of this roll: started empty */
+#define JOURNAL_ERR         2   /* flash erase or program failed */
+#define JOURNAL_TOO_LARGE   3   /* voted set larger than the RAM bitset or half a sector */
+#define JOURNAL_BAD_ARG     4   /* voter index or candidate out of range */
+#define JOURNAL_FULL        5   /* no room without a rotation (journal_seal) */
+
+typedef struct {
+    const uint8_t *base;        /* sector 0; sector 1 follows */
+    uint32_t sector_size;
+    uint32_t first_sector;      /* HAL sector number of sector 0 */
+    uint32_t roll_key;
+    uint32_t n_slots;
+    uint32_t snap_size;         /* snapshot body bytes */
+    uint8_t active;             /* sector being appended to */
+    uint8_t erase_pending;      /* the other sector still holds old data */
+    uint32_t epoch;             /* of the active sector, +1 per rotation */
+    uint32_t head;              /* offset of the next free record in the active sector */
+    uint32_t group;             /* offset of the group head is in */
+    uint32_t group_mask;        /* its slots holding committed records */
+    uint32_t group_sum;         /* sum of their words */
+    uint32_t seq;               /* sequence number of the next record */
+    uint8_t sealed;             /* the last record is a seal: the last run stopped cleanly */
+    uint32_t tally[JOURNAL_CANDIDATES];
+    /* statistics */
+    uint32_t replayed;          /* records applied by journal_open() */
+    uint32_t checked;           /* record slots it had to check one CRC at a time */
+    uint32_t checkpoints;
+    uint32_t rotations;
+    uint32_t erases;
+} journal_t;
+
+int journal_open(journal_t *j, const uint8_t *base, uint32_t sector_size, uint32_t first_sector,
+                 uint32_t roll_key, uint32_t n_slots);
+int journal_vote(journal_t *j, int32_t voter, uint8_t candidate);
+int journal_seal(journal_t *j);
+uint8_t journal_can_append(const journal_t *j);
+void journal_service(journal_t *j);
+
+#endif /* JOURNAL_H */
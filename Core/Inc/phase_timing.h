@@ -0,0 +1,66 @@
+/*
+ * phase_timing.h
+ *
+ * DWT cycle counter timing of the card read path: how long each phase from REQA to the
+ * verified/invalid screen takes, aggregated into min/avg/max and a log-linear histogram
+ * for percentiles. Boot recovery and vote flushes of the vote journal are recorded the same
+ * way. Recording costs a CYCCNT read and a few adds, so it stays enabled in release builds;
+ * define PHASE_TIMING=0 to compile the hooks out.
+ */
+#ifndef PHASE_TIMING_H
+#define PHASE_TIMING_H
+
+#include <stdint.h>
+#include "stm32f4xx_hal.h"
+
+#ifndef PHASE_TIMING
+#define PHASE_TIMING 1
+#endif
+
+/* Phases of one card read */
+#define PT_REQUEST      0   /* REQA sent .. ATQA received */
+#define PT_ANTICOLL     1   /* anticollision + SELECT over all cascade levels */
+#define PT_LOOKUP       2   /* UID against the authorized list */
+#define PT_DISPLAY      3   /* verified/invalid screen drawn */
+#define PT_TOTAL        4   /* REQA sent .. screen drawn */
+
+/* Boot */
+#define PT_RECOVERY     5   /* vote journal opened: snapshot loaded, records replayed */
+
+/* Vote write-behind queue (vote_queue.h) */
+#define PT_FLUSH        6   /* one queued vote programmed into the journal */
+#define PT_COMMIT       7   /* vote cast .. its record in flash */
+#define PT_EMERGENCY    8   /* PVD warning: queued votes and the seal record programmed */
+#define PT_PHASE_COUNT  9
+
+/* Histogram: 4 buckets per power of two from 256 cycles up, everything below lands in bucket 0 */
+#define PT_HIST_MIN_LOG2    8
+#define PT_HIST_SUB         4
+#define PT_HIST_BUCKETS     ((32 - PT_HIST_MIN_LOG2) * PT_HIST_SUB)
+
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint32_t avg;
+    uint32_t p99;   /* upper edge of the bucket holding the 99th percentile */
+} phase_stats_t;
+
+static inline uint32_t phase_timing_now(void) { return DWT->CYCCNT; }
+
+#if PHASE_TIMING
+void phase_timing_init(void);
+void phase_timing_record(uint8_t phase, uint32_t start);
+uint32_t phase_timing_anchor(void);
+void phase_timing_get(uint8_t phase, phase_stats_t *out);
+void phase_timing_reset(void);
+void phase_timing_dump(void);
+#else
+static inline void phase_timing_init(void) {}
+static inline void phase_timing_record(uint8_t phase, uint32_t start) { (void)phase; (void)start; }
+static inline uint32_t phase_timing_anchor(void) { return 0; }
+static inline void phase_timing_reset(void) {}
+static inline void phase_timing_dump(void) {}
+#endif
+
+#endif /* PHASE_TIMING_H */
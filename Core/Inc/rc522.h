@@ -7,11 +7,74 @@ extern SPI_HandleTypeDef hspi1;
 //Maximum length of the array
 #define MAX_LEN 16
 
+//Size of the MFRC522 FIFO buffer, also the longest burst
+#define MFRC522_FIFO_SIZE 64
+//Most registers read back in one Read_MFRC522_Multi call
+#define MFRC522_MULTI_MAX 8
+
+//Re-read shadowed registers on every bit update and count disagreements (debug aid)
+#ifndef MFRC522_SHADOW_VERIFY
+#define MFRC522_SHADOW_VERIFY 0
+#endif
+
+//Compute CRC_A with the MFRC522 coprocessor instead of the table on the MCU
+#ifndef MFRC522_CRC_ON_CHIP
+#define MFRC522_CRC_ON_CHIP 0
+#endif
+
+//Move bursts over DMA2 (SPI1_RX Stream0, SPI1_TX Stream3) instead of polled HAL calls.
+//Off by default: the driver waits for each transfer, and for reader frames (18 bytes at most)
+//the stream setup costs more than the polled bytes (Tools/rc522_sim, `make bench`)
+#ifndef MFRC522_USE_DMA
+#define MFRC522_USE_DMA 0
+#endif
+//Shorter transfers stay polled: the DMA setup costs more than it saves
+#define MFRC522_DMA_MIN_LEN 8
+//A DMA transfer not completed within this many ms is aborted (lost completion interrupt)
+#define MFRC522_DMA_TIMEOUT_MS 5
+//FIFO level at which an answer longer than the FIFO is drained while it is still arriving
+//(WaterLevelReg = 64 - MFRC522_FIFO_DRAIN raises HiAlertIRq there)
+#define MFRC522_FIFO_DRAIN 32
+
+//Called when an asynchronous transfer finishes, from interrupt context
+typedef void (*RC522_XferCallback)(unsigned char status);
+
+// Default wiring of the first reader, see MFRC522_HandleTypeDef
 #define HSPI_INSTANCE				&hspi1
 #define MFRC522_CS_PORT				GPIOA
 #define MFRC522_CS_PIN				GPIO_PIN_4
 #define MFRC522_RST_PORT			GPIOB
 #define MFRC522_RST_PIN				GPIO_PIN_0
+#define MFRC522_IRQ_PORT			GPIOB
+#define MFRC522_IRQ_PIN				GPIO_PIN_1
+
+//Upper bound on one card exchange, in case an IRQ edge is lost. The chip timer normally ends it first.
+#define MFRC522_TXN_TIMEOUT_MS		50
+
+//Receive timeout per command class, in 0.5ms ticks of the MFRC522 timer (TReload value, max 255).
+//An empty field costs the whole REQA timeout on every scan, so that one is kept short.
+#define MFRC522_TMO_REQA			0		// REQA/WUPA/HLTA: ATQA arrives ~90us after the frame, HLTA is never answered
+#define MFRC522_TMO_SELECT			1		// anticollision and SELECT
+#define MFRC522_TMO_AUTH			2		// MFAuthent three-pass exchange
+#define MFRC522_TMO_RW				3		// READ/WRITE and everything else, WRITE acks take up to ~10ms
+#define MFRC522_TMO_NAK				4		// operand of a value operation: only a NAK answers, silence is success
+#define MFRC522_TMO_COUNT			5
+
+#ifndef MFRC522_TMO_REQA_TICKS
+#define MFRC522_TMO_REQA_TICKS		2		// 1ms
+#endif
+#ifndef MFRC522_TMO_SELECT_TICKS
+#define MFRC522_TMO_SELECT_TICKS	10		// 5ms
+#endif
+#ifndef MFRC522_TMO_AUTH_TICKS
+#define MFRC522_TMO_AUTH_TICKS		20		// 10ms
+#endif
+#ifndef MFRC522_TMO_RW_TICKS
+#define MFRC522_TMO_RW_TICKS		50		// 25ms
+#endif
+#ifndef MFRC522_TMO_NAK_TICKS
+#define MFRC522_TMO_NAK_TICKS		10		// 5ms
+#endif
 
 // MFRC522 commands. Described in chapter 10 of the datasheet.
 #define PCD_IDLE              0x00               // no action, cancels current command execution
@@ -26,7 +89,10 @@ extern SPI_HandleTypeDef hspi1;
 #define PICC_REQIDL           0x26               // REQuest command, Type A. Invites PICCs in state IDLE to go to READY and prepare for anticollision or selection. 7 bit frame.
 #define PICC_REQALL           0x52               // Wake-UP command, Type A. Invites PICCs in state IDLE and HALT to go to READY(*) and prepare for anticollision or selection. 7 bit frame.
 #define PICC_ANTICOLL         0x93               // Anti collision/Select, Cascade Level 1
-#define PICC_SElECTTAG        0x93               // Anti collision/Select, Cascade Level 2
+#define PICC_SElECTTAG        0x93               // Anti collision/Select, Cascade Level 1 (kept for MFRC522_SelectTag)
+#define PICC_ANTICOLL_CL2     0x95               // Anti collision/Select, Cascade Level 2
+#define PICC_ANTICOLL_CL3     0x97               // Anti collision/Select, Cascade Level 3
+#define PICC_CT               0x88               // Cascade Tag, first byte of CL1/CL2 when the UID continues
 #define PICC_AUTHENT1A        0x60               // Perform authentication with Key A
 #define PICC_AUTHENT1B        0x61               // Perform authentication with Key B
 #define PICC_READ             0x30               // Reads one 16 byte block from the authenticated sector of the PICC. Also used for MIFARE Ultralight.
@@ -36,12 +102,135 @@ extern SPI_HandleTypeDef hspi1;
 #define PICC_RESTORE          0xC2               // Reads the contents of a block into the internal data register.
 #define PICC_TRANSFER         0xB0               // Writes the contents of the internal data register to a block.
 #define PICC_HALT             0x50               // HaLT command, Type A. Instructs an ACTIVE PICC to go to state HALT.
+#define PICC_GET_VERSION      0x60               // NTAG/Ultralight EV1: 8 bytes of vendor, type and storage size (same code as AUTHENT1A, sent with Transceive)
+#define PICC_FAST_READ        0x3A               // NTAG/Ultralight EV1: pages start..end in one answer
 
 
 // Success or error code is returned when communication
 #define MI_OK                 0
 #define MI_NOTAGERR           1
 #define MI_ERR                2
+#define MI_BUSY               3                  // asynchronous exchange still in progress
+#define MI_COLLISION          4                  // bit collision between several cards, see CollReg
+
+// Card exchange states (MFRC522_ToCardStart/Poll)
+#define MFRC522_TXN_IDLE      0
+#define MFRC522_TXN_BUSY      1
+
+// Register access policies for SetBitMask/ClearBitMask (see rc522_reg_policy)
+#define RC522_REG_VOLATILE    0
+#define RC522_REG_CACHED      1
+#define RC522_REG_IRQ         2
+#define RC522_REG_STROBE      3
+
+// Background card scan states (MFRC522_ScanStart/Poll)
+#define MFRC522_SCAN_IDLE     0
+#define MFRC522_SCAN_REQUEST  1
+
+// Card presence tracking (MFRC522_PresenceStart/Poll)
+#define MFRC522_PRESENCE_ABSENT   0		// REQA scan for a new card
+#define MFRC522_PRESENCE_PRESENT  1		// tracked card is halted, WUPA probes check it is still there
+
+#define MFRC522_EVT_NONE      0
+#define MFRC522_EVT_ARRIVED   1
+#define MFRC522_EVT_LEFT      2
+
+// Consecutive unanswered WUPA probes before a tracked card counts as gone
+#ifndef MFRC522_PRESENCE_MISSES
+#define MFRC522_PRESENCE_MISSES 2
+#endif
+
+// Longest ISO 14443-3 UID (triple size, cascade level 3)
+#define MFRC522_UID_MAX       10
+
+// Failed selects tolerated by MFRC522_Inventory before it gives up
+#define MFRC522_INVENTORY_RETRIES 3
+
+// MIFARE Classic sector layout (MFRC522_ReadSector): sectors 0-31 have 4 blocks,
+// sectors 32-39 of a 4K card have 16, the last block of each is the trailer
+#define MFRC522_SECTOR_COUNT      40
+#define MFRC522_SECTOR_MAX_BLOCKS 15		// data blocks of the largest sector
+#define MFRC522_SECTOR_MAX_DATA   (MFRC522_SECTOR_MAX_BLOCKS * 16)
+#define MFRC522_AUTH_NONE         0xFF		// authSector when Crypto1 is off
+
+// Card types (MFRC522_CardType, MFRC522_IdentifyCard)
+#define MFRC522_CARD_UNKNOWN        0
+#define MFRC522_CARD_MIFARE_1K      1
+#define MFRC522_CARD_MIFARE_4K      2
+#define MFRC522_CARD_ULTRALIGHT     3		// Ultralight family without GET_VERSION
+#define MFRC522_CARD_ULTRALIGHT_EV1 4
+#define MFRC522_CARD_NTAG213        5
+#define MFRC522_CARD_NTAG215        6
+#define MFRC522_CARD_NTAG216        7
+
+// Largest user area of the Ultralight/NTAG types above (NTAG216, pages 4-225)
+#define MFRC522_USER_AREA_MAX       888
+
+// A selected card: UID of 4, 7 or 10 bytes plus the ATQA and SAK it answered with
+typedef struct
+{
+	uchar size;
+	uchar uidByte[MFRC522_UID_MAX];
+	uchar atqa[2];
+	uchar sak;
+} MFRC522_Uid;
+
+// One card exchange in flight (MFRC522_ToCardStart/Poll)
+typedef struct
+{
+	uchar state;
+	uchar command;
+	uchar irqEn;
+	uchar waitIRq;
+	uchar rxAlign;
+	uint32_t startTick;
+	uint32_t startCycles;		// DWT timestamp for phase_timing
+	uchar buf[MAX_LEN];
+} MFRC522_TxnTypeDef;
+
+// One MFRC522 module. Several readers can share an SPI bus with separate chip selects;
+// fill in the wiring fields and call MFRC522_Init, the driver owns the rest.
+// In IRQ mode every reader needs its own IRQ line, MFRC522_IrqNotify is called for the one that fired.
+typedef struct
+{
+	// Wiring
+	SPI_HandleTypeDef *hspi;
+	GPIO_TypeDef *csPort;
+	uint16_t csPin;
+	GPIO_TypeDef *rstPort;
+	uint16_t rstPin;
+
+	// Write-through shadow of the RC522_REG_CACHED registers, one valid bit per address
+	uchar shadow[64];
+	uint64_t shadowValid;
+	uint32_t shadowMismatches;
+
+	// IRQ pin completion. irqPending is set from the EXTI callback through MFRC522_IrqNotify
+	uchar irqMode;
+	volatile uchar irqPending;
+
+	// The exchange in flight plus the scan and presence state machines built on top of it
+	MFRC522_TxnTypeDef txn;
+	uchar scanState;
+	uchar presenceState;
+	uchar presenceProbing;
+	uchar presenceMisses;
+	MFRC522_Uid presenceUid;
+
+	// Sector, key and card Crypto1 is running for, so MFRC522_AuthCached can skip a repeat
+	uchar authSector;
+	uchar authMode;
+	uchar authKey[6];
+	uchar authUid[4];
+} MFRC522_HandleTypeDef;
+
+// Round-robin scan over several readers (MFRC522_SchedulerPoll)
+typedef struct
+{
+	MFRC522_HandleTypeDef **readers;
+	uchar count;
+	uchar next;			// reader polled first on the next call
+} MFRC522_SchedulerTypeDef;
 
 
 // MFRC522 registers. Described in chapter 9 of the datasheet.
@@ -114,14 +303,78 @@ extern SPI_HandleTypeDef hspi1;
 #define     Reserved33            0x3E
 #define     Reserved34			      0x3F
 
+// Register level access
+void Write_MFRC522(MFRC522_HandleTypeDef *hrc, uchar addr, uchar val);
+uchar Read_MFRC522(MFRC522_HandleTypeDef *hrc, uchar addr);
+void Write_MFRC522_Burst(MFRC522_HandleTypeDef *hrc, uchar addr, uchar *data, uchar len);
+void Read_MFRC522_Burst(MFRC522_HandleTypeDef *hrc, uchar addr, uchar *data, uchar len);
+void Read_MFRC522_Multi(MFRC522_HandleTypeDef *hrc, const uchar *addrs, uchar *vals, uchar count);
+uchar RC522_SPI_WaitIdle(void);
+void SetBitMask(MFRC522_HandleTypeDef *hrc, uchar reg, uchar mask);
+void ClearBitMask(MFRC522_HandleTypeDef *hrc, uchar reg, uchar mask);
+uchar Shadow_MFRC522(MFRC522_HandleTypeDef *hrc, uchar reg);
+uint32_t MFRC522_ShadowMismatches(MFRC522_HandleTypeDef *hrc);
+void CalulateCRC(MFRC522_HandleTypeDef *hrc, uchar *pIndata, uchar len, uchar *pOutData);
+void CalulateCRC_Host(uchar *pIndata, uchar len, uchar *pOutData);
+void CalulateCRC_Chip(MFRC522_HandleTypeDef *hrc, uchar *pIndata, uchar len, uchar *pOutData);
+#if MFRC522_USE_DMA
+uchar Write_MFRC522_BurstAsync(MFRC522_HandleTypeDef *hrc, uchar addr, uchar *data, uchar len, RC522_XferCallback cb);
+uchar Read_MFRC522_BurstAsync(MFRC522_HandleTypeDef *hrc, uchar addr, uchar *data, uchar len, RC522_XferCallback cb);
+uchar Read_MFRC522_MultiAsync(MFRC522_HandleTypeDef *hrc, const uchar *addrs, uchar *vals, uchar count, RC522_XferCallback cb);
+#endif
+
 // Functions for manipulating the MFRC522
-void MFRC522_Init(void);
-uchar MFRC522_Request(uchar reqMode, uchar *TagType);
-uchar MFRC522_Anticoll(uchar *serNum);
-uchar MFRC522_SelectTag(uchar *serNum);
-uchar MFRC522_Auth(uchar authMode, uchar BlockAddr, uchar *Sectorkey, uchar *serNum);
-uchar MFRC522_Write(uchar blockAddr, uchar *writeData);
-uchar MFRC522_Auth(uchar authMode, uchar BlockAddr, uchar *Sectorkey, uchar *serNum);
-uchar MFRC522_Read(uchar blockAddr, uchar *recvData);
-void MFRC522_Halt(void);
+void MFRC522_Init(MFRC522_HandleTypeDef *hrc);
+void MFRC522_SetTimeout(MFRC522_HandleTypeDef *hrc, uchar tmoClass);
+uchar MFRC522_Request(MFRC522_HandleTypeDef *hrc, uchar reqMode, uchar *TagType);
+uchar MFRC522_Anticoll(MFRC522_HandleTypeDef *hrc, uchar *serNum);
+uchar MFRC522_SelectTag(MFRC522_HandleTypeDef *hrc, uchar *serNum);
+uchar MFRC522_Auth(MFRC522_HandleTypeDef *hrc, uchar authMode, uchar BlockAddr, uchar *Sectorkey, uchar *serNum);
+uchar MFRC522_Write(MFRC522_HandleTypeDef *hrc, uchar blockAddr, uchar *writeData);
+uchar MFRC522_Auth(MFRC522_HandleTypeDef *hrc, uchar authMode, uchar BlockAddr, uchar *Sectorkey, uchar *serNum);
+uchar MFRC522_Read(MFRC522_HandleTypeDef *hrc, uchar blockAddr, uchar *recvData);
+uchar MFRC522_AuthCached(MFRC522_HandleTypeDef *hrc, uchar authMode, uchar BlockAddr, uchar *Sectorkey, uchar *serNum);
+uchar MFRC522_ReadSector(MFRC522_HandleTypeDef *hrc, uchar authMode, uchar sector, uchar *Sectorkey, uchar *serNum, uchar *recvData);
+uchar MFRC522_CardType(const MFRC522_Uid *uid);
+uchar MFRC522_GetVersion(MFRC522_HandleTypeDef *hrc, uchar *version);
+uchar MFRC522_IdentifyCard(MFRC522_HandleTypeDef *hrc, MFRC522_Uid *uid, uchar *cardType);
+uchar MFRC522_FastRead(MFRC522_HandleTypeDef *hrc, uchar startPage, uchar endPage, uchar *recvData);
+uchar MFRC522_ReadUserArea(MFRC522_HandleTypeDef *hrc, uchar cardType, uchar *recvData, uint maxLen, uint *len);
+void MFRC522_StopCrypto1(MFRC522_HandleTypeDef *hrc);
+uchar MFRC522_ValueFormat(MFRC522_HandleTypeDef *hrc, uchar blockAddr, int32_t value);
+uchar MFRC522_ValueRead(MFRC522_HandleTypeDef *hrc, uchar blockAddr, int32_t *value);
+uchar MFRC522_Decrement(MFRC522_HandleTypeDef *hrc, uchar blockAddr, int32_t delta);
+uchar MFRC522_Increment(MFRC522_HandleTypeDef *hrc, uchar blockAddr, int32_t delta);
+uchar MFRC522_Restore(MFRC522_HandleTypeDef *hrc, uchar blockAddr);
+uchar MFRC522_Transfer(MFRC522_HandleTypeDef *hrc, uchar blockAddr);
+void MFRC522_Halt(MFRC522_HandleTypeDef *hrc);
+void MFRC522_SetIrqMode(MFRC522_HandleTypeDef *hrc, uchar enable);
+void MFRC522_IrqNotify(MFRC522_HandleTypeDef *hrc);
+
+// Non-blocking variants: Start returns at once, Poll returns MI_BUSY until the card has answered
+uchar MFRC522_ToCardStart(MFRC522_HandleTypeDef *hrc, uchar command, uchar *sendData, uchar sendLen);
+uchar MFRC522_ToCardPoll(MFRC522_HandleTypeDef *hrc, uchar *backData, uint *backLen);
+uchar MFRC522_RequestStart(MFRC522_HandleTypeDef *hrc, uchar reqMode);
+uchar MFRC522_RequestPoll(MFRC522_HandleTypeDef *hrc, uchar *TagType);
+uchar MFRC522_AnticollStart(MFRC522_HandleTypeDef *hrc);
+uchar MFRC522_AnticollPoll(MFRC522_HandleTypeDef *hrc, uchar *serNum);
+uchar MFRC522_SelectTagStart(MFRC522_HandleTypeDef *hrc, uchar *serNum);
+uchar MFRC522_SelectTagPoll(MFRC522_HandleTypeDef *hrc, uchar *size);
+uchar MFRC522_AuthStart(MFRC522_HandleTypeDef *hrc, uchar authMode, uchar BlockAddr, uchar *Sectorkey, uchar *serNum);
+uchar MFRC522_AuthPoll(MFRC522_HandleTypeDef *hrc);
+uchar MFRC522_ReadStart(MFRC522_HandleTypeDef *hrc, uchar blockAddr);
+uchar MFRC522_ReadPoll(MFRC522_HandleTypeDef *hrc, uchar *recvData);
+void MFRC522_ScanStart(MFRC522_HandleTypeDef *hrc);
+uchar MFRC522_ScanPoll(MFRC522_HandleTypeDef *hrc, MFRC522_Uid *uid);
+void MFRC522_PresenceStart(MFRC522_HandleTypeDef *hrc);
+uchar MFRC522_PresencePoll(MFRC522_HandleTypeDef *hrc, MFRC522_Uid *uid);
+uchar MFRC522_PresenceWake(MFRC522_HandleTypeDef *hrc);
+uchar MFRC522_SchedulerPoll(MFRC522_SchedulerTypeDef *sched, uchar *reader, MFRC522_Uid *uid);
+uchar MFRC522_SelectUid(MFRC522_HandleTypeDef *hrc, MFRC522_Uid *uid);
+uchar MFRC522_Inventory(MFRC522_HandleTypeDef *hrc, MFRC522_Uid *uids, uchar maxUids, uchar *count, uint32_t *cycles);
+#ifdef MFRC522_BENCH
+uint32_t MFRC522_BenchScan(MFRC522_HandleTypeDef *hrc);
+uint32_t MFRC522_BenchEmptyScan(MFRC522_HandleTypeDef *hrc);
+uchar MFRC522_BenchCRC(MFRC522_HandleTypeDef *hrc, uint32_t *hostCycles, uint32_t *chipCycles);
+#endif
 
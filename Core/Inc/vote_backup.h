@@ -0,0 +1,34 @@
+/*
+ * vote_backup.h
+ *
+ * Fast-commit tier in the RTC backup registers: they keep their contents through a reset
+ * (and a power cut, with VBAT fitted) and take a plain store, so a vote is mirrored there
+ * the moment it is cast, ahead of its journal record (vote_queue.h).
+ *
+ * Registers: magic | roll key | votes cast | tallies[3] | ring of the last
+ * VOTE_BACKUP_RING votes (voter index, candidate, ordinal). The vote count runs in step with
+ * the journal's total, and the journal holds the votes in cast order, so at boot the votes
+ * it lacks are the last (count - total) mirrored ones. vote_backup_open() writes those from
+ * the ring; any left over are votes older than the ring that never reached flash.
+ *
+ * The ring must cover the write-behind queue, so that a reset between the cast and the
+ * flush never loses a vote.
+ */
+#ifndef VOTE_BACKUP_H
+#define VOTE_BACKUP_H
+
+#include <stdint.h>
+#include "journal.h"
+#include "vote_queue.h"
+
+#define VOTE_BACKUP_REGS    20U     /* RTC_BKP0R .. RTC_BKP19R */
+#define VOTE_BACKUP_RING    (VOTE_BACKUP_REGS - 3U - JOURNAL_CANDIDATES)
+
+#if VOTE_QUEUE_MAX > VOTE_BACKUP_RING
+#error "the backup ring must hold every vote the write-behind queue can have unflushed"
+#endif
+
+uint32_t vote_backup_open(volatile uint32_t *regs, journal_t *j, uint32_t *missing);
+void vote_backup_record(int32_t voter, uint8_t candidate);
+
+#endif /* VOTE_BACKUP_H */
@@ -0,0 +1,60 @@
+/*
+ * vote_queue.h
+ *
+ * Write-behind queue between the cast button and the vote journal (journal.h). A cast vote
+ * counts at once: vote_queue_voted() reports the voter and the vote shows in the tallies,
+ * but its record is programmed later, one per call to vote_queue_flush_one() from the idle
+ * superloop, so the button handler never waits for flash.
+ *
+ * The voted set (voted.h) only takes a voter once the record is written. It is what a
+ * rotation snapshots, so it must never hold a vote that a power cut could still take.
+ *
+ * At most VOTE_QUEUE_MAX votes are unflushed at any time; that is what a power cut can take.
+ * A cast into a full queue flushes the oldest vote first. Strict casts flush the queue and
+ * write their own record before returning, the behaviour without a queue.
+ *
+ * Flush latency is recorded in phase_timing (PT_FLUSH, PT_COMMIT), depth in vote_queue_stats_t.
+ *
+ * vote_queue_emergency() is the power-fail path, run from the PVD interrupt. Every other
+ * call that reaches the journal marks the queue busy, and an interrupt that lands inside
+ * one leaves the journal alone.
+ */
+#ifndef VOTE_QUEUE_H
+#define VOTE_QUEUE_H
+
+#include <stdint.h>
+#include "journal.h"
+
+/* Unflushed votes allowed (power-loss window), at least 1 */
+#ifndef VOTE_QUEUE_MAX
+#define VOTE_QUEUE_MAX      4U
+#endif
+#if VOTE_QUEUE_MAX < 1
+#error "VOTE_QUEUE_MAX must be at least 1; strict casts give a zero window"
+#endif
+
+typedef struct {
+    uint32_t depth;         /* votes waiting now */
+    uint32_t max_depth;
+    uint32_t cast;          /* votes accepted */
+    uint32_t flushed;       /* records written from the queue */
+    uint32_t forced;        /* flushes done inside a cast: queue full or strict */
+    uint32_t failures;      /* journal writes that failed; the vote stays queued */
+    uint32_t power_fails;   /* emergency flushes run from the PVD interrupt */
+    uint32_t power_fail_busy;   /* PVD interrupts that found the journal busy */
+} vote_queue_stats_t;
+
+void vote_queue_reset(void);
+uint8_t vote_queue_voted(int32_t voter);
+int vote_queue_can_cast(const journal_t *j, int32_t voter, uint8_t candidate);
+int vote_queue_cast(journal_t *j, int32_t voter, uint8_t candidate, uint8_t strict);
+int vote_queue_flush_one(journal_t *j);
+int vote_queue_flush(journal_t *j);
+void vote_queue_service(journal_t *j);
+int vote_queue_emergency(journal_t *j);
+uint32_t vote_queue_depth(void);
+void vote_queue_tally(const journal_t *j, uint32_t tally[JOURNAL_CANDIDATES]);
+void vote_queue_get_stats(vote_queue_stats_t *out);
+void vote_queue_dump(void);
+
+#endif /* VOTE_QUEUE_H */
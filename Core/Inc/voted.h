@@ -0,0 +1,28 @@
+/*
+ * voted.h
+ *
+ * Who has voted: one bit per voter index, checked in constant time when a card is verified.
+ * The set lives in RAM; the vote journal (journal.h) persists it: every vote record sets a
+ * bit on replay and each journal sector starts with a snapshot of the whole set.
+ */
+#ifndef VOTED_H
+#define VOTED_H
+
+#include <stdint.h>
+
+/* RAM bitset size */
+#ifndef VOTED_MAX_SLOTS
+#define VOTED_MAX_SLOTS     49152U  /* 6 KB of RAM */
+#endif
+
+#define VOTED_OK            0
+#define VOTED_TOO_LARGE     3   /* more voter slots than the bitset holds */
+
+int voted_reset(uint32_t n_slots);
+void voted_set(int32_t voter);
+uint8_t voted_test(int32_t voter);
+uint32_t voted_count(void);
+uint32_t *voted_bitmap(uint32_t *n_words);
+void voted_recount(void);
+
+#endif /* VOTED_H */
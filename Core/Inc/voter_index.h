@@ -0,0 +1,63 @@
+/*
+ * voter_index.h
+ *
+ * Perfect-hash index of the authorized voter roll. Tools/votergen builds it offline (CHD:
+ * hash into buckets, one 16-bit displacement per bucket places every voter in its own slot);
+ * the firmware finds a card with three fixed-length hashes, one displacement read and one
+ * key compare, whatever the roll size.
+ *
+ * Every slot holds the full key of its voter (UID size and UID) and a 16-bit fingerprint of
+ * it. The fingerprint turns almost every unknown card away after two bytes; the key compare
+ * decides, so only a card on the roll is ever accepted. The slot number doubles as the voter
+ * index (0 .. n_slots-1).
+ *
+ * An optional Bloom filter built with the table turns most unknown cards away before the
+ * lookup: one hash and usually one or two bit probes.
+ *
+ * Capacity: a roll image costs about 16 bytes per voter with the 1 % prefilter (14.8 without),
+ * mostly the 11-byte key. The 128 KB VOTER_ROLL region therefore holds about 8 200 voters
+ * (8 800 without the prefilter); a 50 000 voter roll needs about 780 KB and does not fit.
+ * votergen prints the figure for each roll it builds and refuses an image that is too large.
+ *
+ * The hash is shared with the host tool, which compiles this file: change it on both sides
+ * or not at all.
+ */
+#ifndef VOTER_INDEX_H
+#define VOTER_INDEX_H
+
+#include <stdint.h>
+
+/* Hash key: UID size followed by the UID, zero padded (10 bytes is the longest ISO 14443 UID) */
+#define VOTER_UID_MAX   10
+#define VOTER_KEY_LEN   12
+#define VOTER_SLOT_KEY  (1 + VOTER_UID_MAX)     /* key bytes kept per slot: the last one is always 0 */
+
+#define VOTER_FP_EMPTY  0   /* fingerprint of an unused slot, never produced by the hash */
+#define VOTER_NONE      (-1)
+
+typedef struct {
+    uint32_t seed;
+    uint32_t n_slots;       /* fingerprint and key table size, also the voter index range */
+    uint32_t n_buckets;     /* displacement table size */
+    uint32_t n_voters;
+    const uint16_t *disp;   /* [n_buckets] */
+    const uint16_t *fp;     /* [n_slots] */
+    const uint8_t *keys;    /* [n_slots * VOTER_SLOT_KEY], zero in empty slots */
+    uint32_t bloom_bits;    /* prefilter size, a multiple of 32; 0 = no prefilter */
+    uint32_t bloom_k;       /* probes per key */
+    const uint32_t *bloom;  /* [bloom_bits / 32] */
+} voter_index_t;
+
+/* Generated by Tools/votergen (Core/Src/voter_table.c) */
+extern const voter_index_t voter_table;
+
+void voter_index_key(uint8_t key[VOTER_KEY_LEN], const uint8_t *uid, uint8_t size);
+uint32_t voter_index_hash(const uint8_t key[VOTER_KEY_LEN], uint32_t seed);
+uint32_t voter_index_bucket(const voter_index_t *vi, const uint8_t key[VOTER_KEY_LEN]);
+uint32_t voter_index_slot(const voter_index_t *vi, const uint8_t key[VOTER_KEY_LEN], uint16_t disp);
+uint16_t voter_index_fingerprint(const voter_index_t *vi, const uint8_t key[VOTER_KEY_LEN]);
+int32_t voter_index_lookup(const voter_index_t *vi, const uint8_t *uid, uint8_t size);
+void voter_index_bloom_add(const voter_index_t *vi, uint32_t *bloom, const uint8_t key[VOTER_KEY_LEN]);
+uint8_t voter_index_maybe(const voter_index_t *vi, const uint8_t *uid, uint8_t size);
+
+#endif /* VOTER_INDEX_H */
@@ -0,0 +1,68 @@
+/*
+ * voter_roll.h
+ *
+ * Voter roll image: the perfect-hash index of voter_index.h plus per-voter metadata, built by
+ * Tools/votergen and flashed on its own into the VOTER_ROLL region (STM32F401CCUX_FLASH.ld),
+ * so a new roll needs no firmware rebuild. The firmware uses the image where it lies in
+ * flash; voter_roll_open() checks it once at boot (layout, then one CRC pass).
+ *
+ * Layout, little endian, every table 4-byte aligned:
+ *   voter_roll_header_t | disp[n_buckets] u16 | fp[n_slots] u16 | keys[n_slots][VOTER_SLOT_KEY] u8
+ *   | meta[n_slots] voter_meta_t | bloom[bloom_bits / 32] u32 (only if bloom_bits != 0)
+ *
+ * Shared with the host tool like voter_index.c: the image it writes is checked with this code.
+ */
+#ifndef VOTER_ROLL_H
+#define VOTER_ROLL_H
+
+#include <stdint.h>
+#include "voter_index.h"
+
+#define VOTER_ROLL_MAGIC        0x4C4F5256U     /* "VROL" */
+#define VOTER_ROLL_VERSION      3U      /* 2: Bloom prefilter, 3: full key per slot */
+
+/* voter_roll_open() results */
+#define VOTER_ROLL_OK           0
+#define VOTER_ROLL_BLANK        1   /* erased region, no image flashed */
+#define VOTER_ROLL_BAD_MAGIC    2
+#define VOTER_ROLL_BAD_VERSION  3   /* format version, header or record size this firmware does not know */
+#define VOTER_ROLL_BAD_LAYOUT   4   /* sizes or offsets outside the image or the region */
+#define VOTER_ROLL_BAD_CRC      5
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;   /* sizeof(voter_roll_header_t) when written */
+    uint32_t image_size;    /* header and tables, bytes */
+    uint32_t roll_id;       /* roll revision, chosen when the roll is compiled */
+    uint32_t seed;          /* voter_index_t fields */
+    uint32_t n_slots;
+    uint32_t n_buckets;
+    uint32_t n_voters;
+    uint32_t disp_offset;   /* from the start of the image */
+    uint32_t fp_offset;
+    uint32_t key_offset;
+    uint32_t meta_offset;
+    uint32_t meta_size;     /* bytes per slot, sizeof(voter_meta_t) for this version */
+    uint32_t bloom_offset;
+    uint32_t bloom_bits;    /* 0 = no prefilter */
+    uint32_t bloom_k;
+    uint32_t crc;           /* CRC-32 of the image_size bytes with this field read as 0 */
+} voter_roll_header_t;
+
+/* Per-voter metadata, one record per slot (empty slots are zero) */
+typedef struct {
+    uint8_t precinct;       /* booth group the voter is assigned to, 0 = any */
+} voter_meta_t;
+
+typedef struct {
+    const voter_roll_header_t *hdr;
+    voter_index_t index;    /* points into the image */
+    const voter_meta_t *meta;
+} voter_roll_t;
+
+uint32_t voter_roll_crc32(uint32_t crc, const uint8_t *data, uint32_t len);
+int voter_roll_open(voter_roll_t *roll, const void *image, uint32_t region_size);
+const voter_meta_t *voter_roll_meta(const voter_roll_t *roll, int32_t voter);
+
+#endif /* VOTER_ROLL_H */
@@ -0,0 +1,454 @@
+/*
+ * journal.c
+ *
+ * Vote journal, see journal.h. All words are little endian 32-bit, programmed one at a time;
+ * words that are meant to stay 0xFFFFFFFF are skipped, so the voted set costs nothing to
+ * snapshot until people vote (it is stored inverted: 1 = has not voted).
+ */
+#include <string.h>
+#include "stm32f4xx_hal.h"
+#include "journal.h"
+#include "voted.h"
+#include "voter_roll.h"     /* voter_roll_crc32() */
+
+#define JOURNAL_MAGIC   0x4C4E524AU     /* "JRNL" */
+#define ERASED          0xFFFFFFFFU
+
+/* Offsets in a sector */
+#define SECTOR_HDR      0U
+#define SNAP_HDR        16U
+#define SNAP_BODY       32U
+
+typedef struct {
+    uint32_t magic;
+    uint32_t epoch;
+    uint32_t roll_key;
+    uint32_t crc;       /* of the words above; commits the sector */
+} jsector_t;
+
+typedef struct {
+    uint32_t seq;       /* sequence number of the first record after the snapshot */
+    uint32_t n_slots;
+    uint32_t size;      /* body bytes */
+    uint32_t crc;       /* of the body, then the words above; commits the snapshot */
+} jsnap_t;
+
+typedef struct {
+    uint32_t type;      /* JREC_* | candidate << 8 */
+    uint32_t seq;
+    uint32_t voter;
+    uint32_t crc;       /* of the words above; commits the record */
+} jrec_t;
+
+typedef struct {
+    uint32_t type;      /* JREC_CHECKPOINT */
+    uint32_t seq;       /* sequence number of the next record */
+    uint32_t mask;      /* bit i: slot i of the group holds a committed record */
+    uint32_t sum;       /* of all words of those records */
+    uint32_t tally[JOURNAL_CANDIDATES];     /* after the group */
+    uint32_t crc;       /* of the words above; commits the checkpoint */
+} jckpt_t;
+
+/* Offsets in a group */
+#define CKPT_AT         (JOURNAL_CHECKPOINT_EVERY * JOURNAL_RECORD_SIZE)
+#define CKPT_SIZE       ((uint32_t)sizeof(jckpt_t))
+#define GROUP_SIZE      (CKPT_AT + CKPT_SIZE)
+
+static const uint8_t *sector_at(const journal_t *j, uint8_t s)
+{
+    return j->base + (uint32_t)s * j->sector_size;
+}
+
+/* Caller holds the flash unlocked */
+static int program_word(const uint8_t *addr, uint32_t word)
+{
+    if (word == ERASED) return JOURNAL_OK;
+    return (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, (uint32_t)(uintptr_t)addr, word) == HAL_OK) ? JOURNAL_OK : JOURNAL_ERR;
+}
+
+static int program_words(const uint8_t *addr, const uint32_t *w, uint32_t n)
+{
+    int st = JOURNAL_OK;
+
+    HAL_FLASH_Unlock();
+    for (uint32_t i = 0; i < n && st == JOURNAL_OK; ++i) st = program_word(addr + i * 4U, w[i]);
+    HAL_FLASH_Lock();
+    return st;
+}
+
+static int erase_sector(journal_t *j, uint8_t s)
+{
+    FLASH_EraseInitTypeDef erase = { 0 };
+    uint32_t sector_err = 0;
+    HAL_StatusTypeDef st;
+
+    erase.TypeErase = FLASH_TYPEERASE_SECTORS;
+    erase.Sector = j->first_sector + s;
+    erase.NbSectors = 1;
+    erase.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+
+    HAL_FLASH_Unlock();
+    st = HAL_FLASHEx_Erase(&erase, &sector_err);
+    HAL_FLASH_Lock();
+    j->erases++;
+    return (st == HAL_OK) ? JOURNAL_OK : JOURNAL_ERR;
+}
+
+static uint8_t words_erased(const uint8_t *p, uint32_t size)
+{
+    const uint32_t *w = (const uint32_t *)p;
+    for (uint32_t i = 0; i < size / 4U; ++i) {
+        if (w[i] != ERASED) return 0;
+    }
+    return 1;
+}
+
+static uint8_t sector_blank(const journal_t *j, uint8_t s)
+{
+    return words_erased(sector_at(j, s), j->sector_size);
+}
+
+/* Sector s is committed and belongs to this roll */
+static uint8_t header_valid(const journal_t *j, uint8_t s, uint32_t *epoch)
+{
+    const jsector_t *h = (const jsector_t *)(sector_at(j, s) + SECTOR_HDR);
+
+    if (h->magic != JOURNAL_MAGIC || h->roll_key != j->roll_key) return 0;
+    if (voter_roll_crc32(0U, (const uint8_t *)h, 12U) != h->crc) return 0;
+    *epoch = h->epoch;
+    return 1;
+}
+
+/* The snapshot of sector s is intact; the longest check at boot, done for one sector only */
+static uint8_t snapshot_valid(const journal_t *j, uint8_t s)
+{
+    const uint8_t *sec = sector_at(j, s);
+    const jsnap_t *snap = (const jsnap_t *)(sec + SNAP_HDR);
+    uint32_t crc;
+
+    if (snap->n_slots != j->n_slots || snap->size != j->snap_size) return 0;
+    crc = voter_roll_crc32(0U, sec + SNAP_BODY, j->snap_size);
+    return voter_roll_crc32(crc, (const uint8_t *)snap, 12U) == snap->crc;
+}
+
+/* Tallies and voted set into sector s (erased), then the headers that make it live */
+static int write_snapshot(journal_t *j, uint8_t s, uint32_t epoch)
+{
+    const uint8_t *sec = sector_at(j, s);
+    uint32_t n_words;
+    const uint32_t *bits = voted_bitmap(&n_words);
+    uint32_t w[4];
+    uint32_t crc;
+    int st = JOURNAL_OK;
+
+    HAL_FLASH_Unlock();
+    for (uint32_t i = 0; i < JOURNAL_CANDIDATES && st == JOURNAL_OK; ++i) st = program_word(sec + SNAP_BODY + i * 4U, j->tally[i]);
+    for (uint32_t i = 0; i < n_words && st == JOURNAL_OK; ++i) st = program_word(sec + SNAP_BODY + 16U + i * 4U, ~bits[i]);
+    HAL_FLASH_Lock();
+    if (st != JOURNAL_OK) return st;
+
+    /* CRC over what is in flash, padding included */
+    crc = voter_roll_crc32(0U, sec + SNAP_BODY, j->snap_size);
+    w[0] = j->seq; w[1] = j->n_slots; w[2] = j->snap_size;
+    w[3] = voter_roll_crc32(crc, (const uint8_t *)w, 12U);
+    st = program_words(sec + SNAP_HDR, w, 4U);
+    if (st != JOURNAL_OK) return st;
+
+    w[0] = JOURNAL_MAGIC; w[1] = epoch; w[2] = j->roll_key;
+    w[3] = voter_roll_crc32(0U, (const uint8_t *)w, 12U);
+    return program_words(sec + SECTOR_HDR, w, 4U);
+}
+
+static void load_snapshot(journal_t *j, uint8_t s)
+{
+    const uint8_t *sec = sector_at(j, s);
+    const uint32_t *body = (const uint32_t *)(sec + SNAP_BODY);
+    uint32_t n_words;
+    uint32_t *bits = voted_bitmap(&n_words);
+
+    for (uint32_t i = 0; i < JOURNAL_CANDIDATES; ++i) j->tally[i] = body[i];
+    for (uint32_t i = 0; i < n_words; ++i) bits[i] = ~body[4U + i];
+    voted_recount();
+    j->seq = ((const jsnap_t *)(sec + SNAP_HDR))->seq;
+}
+
+static uint32_t record_sum(const jrec_t *r)
+{
+    return r->type + r->seq + r->voter + r->crc;
+}
+
+static void apply(journal_t *j, const jrec_t *r)
+{
+    if ((r->type & 0xFFU) == JREC_VOTE) {
+        uint32_t cand = (r->type >> 8) & 0xFFU;
+        if (cand < JOURNAL_CANDIDATES) j->tally[cand]++;
+        voted_set((int32_t)r->voter);
+    }
+    j->sealed = ((r->type & 0xFFU) == JREC_SEAL);
+    j->seq = r->seq + 1U;
+    j->replayed++;
+}
+
+/* A full group under a valid checkpoint: its records are taken as listed, no CRC each. Any
+ * disagreement with the checkpoint (sum, tallies) leaves the state alone and returns 0. */
+static uint8_t replay_checkpointed(journal_t *j, const uint8_t *grp)
+{
+    const jckpt_t *ck = (const jckpt_t *)(grp + CKPT_AT);
+    uint32_t tally[JOURNAL_CANDIDATES];
+    uint32_t sum = 0;
+    uint32_t m;
+
+    if (ck->type != JREC_CHECKPOINT) return 0;
+    if (voter_roll_crc32(0U, (const uint8_t *)ck, CKPT_SIZE - 4U) != ck->crc) return 0;
+
+    memcpy(tally, j->tally, sizeof(tally));
+    for (m = ck->mask; m != 0U; m &= m - 1U) {
+        const jrec_t *r = (const jrec_t *)(grp + (uint32_t)__builtin_ctz(m) * JOURNAL_RECORD_SIZE);
+        uint32_t cand = (r->type >> 8) & 0xFFU;
+        sum += record_sum(r);
+        if ((r->type & 0xFFU) == JREC_SEAL) continue;
+        if ((r->type & 0xFFU) != JREC_VOTE || cand >= JOURNAL_CANDIDATES) return 0;
+        tally[cand]++;
+    }
+    if (sum != ck->sum || memcmp(tally, ck->tally, sizeof(tally)) != 0) return 0;
+
+    for (m = ck->mask; m != 0U; m &= m - 1U) {
+        const jrec_t *r = (const jrec_t *)(grp + (uint32_t)__builtin_ctz(m) * JOURNAL_RECORD_SIZE);
+        j->sealed = ((r->type & 0xFFU) == JREC_SEAL);
+        if (!j->sealed) voted_set((int32_t)r->voter);
+        j->replayed++;
+    }
+    memcpy(j->tally, tally, sizeof(tally));
+    j->seq = ck->seq;
+    return 1;
+}
+
+/* Groups of the active sector after its snapshot: checkpointed ones in one step, the rest
+ * record by record up to the first erased slot, which becomes the head */
+static void replay(journal_t *j)
+{
+    const uint8_t *sec = sector_at(j, j->active);
+    uint32_t off = SNAP_BODY + j->snap_size;
+
+    for (;;) {
+        uint32_t i;
+
+        j->group = off;
+        j->group_mask = 0;
+        j->group_sum = 0;
+        if (off + GROUP_SIZE <= j->sector_size && replay_checkpointed(j, sec + off)) {
+            off += GROUP_SIZE;
+            continue;
+        }
+
+        for (i = 0; i < JOURNAL_CHECKPOINT_EVERY && off + JOURNAL_RECORD_SIZE <= j->sector_size; ++i, off += JOURNAL_RECORD_SIZE) {
+            const jrec_t *r = (const jrec_t *)(sec + off);
+            if (words_erased(sec + off, JOURNAL_RECORD_SIZE)) break;
+            j->checked++;
+            if (voter_roll_crc32(0U, (const uint8_t *)r, 12U) != r->crc) continue;    /* cut short by a reset */
+            apply(j, r);
+            j->group_mask |= 1UL << i;
+            j->group_sum += record_sum(r);
+        }
+        /* End of the journal: a free slot, the end of the sector, or a checkpoint still due */
+        if (i < JOURNAL_CHECKPOINT_EVERY || off + CKPT_SIZE > j->sector_size || words_erased(sec + off, CKPT_SIZE)) break;
+        off += CKPT_SIZE;   /* damaged checkpoint: its group is in, go on */
+    }
+    j->head = off;
+}
+
+/* Close the full group at head. A failed checkpoint only costs replay time: the group is
+ * then checked record by record at boot. One that left no word programmed would end the
+ * replay there instead, so head stays on it and JOURNAL_ERR has the next append retry it. */
+static int write_checkpoint(journal_t *j)
+{
+    uint32_t w[CKPT_SIZE / 4U];
+    jckpt_t *ck = (jckpt_t *)w;
+    const uint8_t *at = sector_at(j, j->active) + j->head;
+
+    ck->type = JREC_CHECKPOINT;
+    ck->seq = j->seq;
+    ck->mask = j->group_mask;
+    ck->sum = j->group_sum;
+    memcpy(ck->tally, j->tally, sizeof(ck->tally));
+    ck->crc = voter_roll_crc32(0U, (const uint8_t *)w, CKPT_SIZE - 4U);
+    if (program_words(at, w, CKPT_SIZE / 4U) != JOURNAL_OK && words_erased(at, CKPT_SIZE)) return JOURNAL_ERR;
+
+    j->head += CKPT_SIZE;
+    j->group = j->head;
+    j->group_mask = 0;
+    j->group_sum = 0;
+    j->checkpoints++;
+    return JOURNAL_OK;
+}
+
+static uint8_t checkpoint_due(const journal_t *j)
+{
+    return j->head == j->group + CKPT_AT;
+}
+
+/* Carry the state over to the other sector; the one left behind is erased later */
+static int journal_rotate(journal_t *j)
+{
+    uint8_t next = j->active ^ 1U;
+    int st;
+
+    if (j->erase_pending) {
+        if (erase_sector(j, next) != JOURNAL_OK) return JOURNAL_ERR;
+        j->erase_pending = 0;
+    }
+    st = write_snapshot(j, next, j->epoch + 1U);
+    if (st != JOURNAL_OK) {
+        j->erase_pending = 1;   /* half-written: erase before the next try */
+        return st;
+    }
+    j->active = next;
+    j->epoch++;
+    j->head = SNAP_BODY + j->snap_size;
+    j->group = j->head;
+    j->group_mask = 0;
+    j->group_sum = 0;
+    j->erase_pending = 1;
+    j->rotations++;
+    return JOURNAL_OK;
+}
+
+/* Load the journal of the roll identified by roll_key (tallies into j, voters into the voted
+ * set), or start an empty one. base: two sectors of sector_size bytes, the first of them
+ * HAL sector first_sector. */
+int journal_open(journal_t *j, const uint8_t *base, uint32_t sector_size, uint32_t first_sector,
+                 uint32_t roll_key, uint32_t n_slots)
+{
+    uint32_t epoch[JOURNAL_SECTORS];
+    uint8_t valid[JOURNAL_SECTORS];
+    uint8_t newer;
+    uint32_t n_words = (n_slots + 31U) / 32U;
+
+    memset(j, 0, sizeof(*j));
+    j->sector_size = sector_size;
+    j->first_sector = first_sector;
+    j->roll_key = roll_key;
+    j->n_slots = n_slots;
+    j->snap_size = 16U + ((n_words * 4U + 15U) & ~15U);
+    if (voted_reset(n_slots) != VOTED_OK || SNAP_BODY + j->snap_size > sector_size / 2U) return JOURNAL_TOO_LARGE;
+    j->base = base;
+
+    /* Both live: a rotation was interrupted before the old sector was erased. The newer one
+     * wins unless its snapshot is damaged. */
+    for (uint8_t s = 0; s < JOURNAL_SECTORS; ++s) valid[s] = header_valid(j, s, &epoch[s]);
+    newer = (valid[1] && (!valid[0] || (int32_t)(epoch[1] - epoch[0]) > 0)) ? 1U : 0U;
+    if (valid[newer] && !snapshot_valid(j, newer)) valid[newer] = 0;
+    if (!valid[newer] && valid[newer ^ 1U] && !snapshot_valid(j, newer ^ 1U)) valid[newer ^ 1U] = 0;
+    if (!valid[0] && !valid[1]) {
+        for (uint8_t s = 0; s < JOURNAL_SECTORS; ++s) {
+            if (!sector_blank(j, s) && erase_sector(j, s) != JOURNAL_OK) return JOURNAL_ERR;
+        }
+        j->epoch = 1U;
+        if (write_snapshot(j, 0, j->epoch) != JOURNAL_OK) return JOURNAL_ERR;
+        j->head = SNAP_BODY + j->snap_size;
+        j->group = j->head;
+        return JOURNAL_FORMATTED;
+    }
+
+    j->active = valid[newer] ? newer : (newer ^ 1U);
+    j->epoch = epoch[j->active];
+    load_snapshot(j, j->active);
+    replay(j);
+    j->erase_pending = !sector_blank(j, j->active ^ 1U);
+    return JOURNAL_OK;
+}
+
+/* Program one record at head, closing a full group first. A full sector rotates, or with
+ * may_rotate 0 fails with JOURNAL_FULL before touching flash. */
+static int append(journal_t *j, uint32_t type, uint32_t voter, uint8_t may_rotate)
+{
+    uint32_t rec[4];
+    int st;
+
+    if (!may_rotate && !journal_can_append(j)) return JOURNAL_FULL;
+    if (checkpoint_due(j)) {
+        if (j->head + CKPT_SIZE > j->sector_size) j->head = j->sector_size;    /* no room to close the group: sector full */
+        else if (write_checkpoint(j) != JOURNAL_OK) return JOURNAL_ERR;
+    }
+    if (j->head + JOURNAL_RECORD_SIZE > j->sector_size) {
+        st = journal_rotate(j);
+        if (st != JOURNAL_OK) return st;
+    }
+
+    rec[0] = type;
+    rec[1] = j->seq;
+    rec[2] = voter;
+    rec[3] = voter_roll_crc32(0U, (const uint8_t *)rec, 12U);
+    st = program_words(sector_at(j, j->active) + j->head, rec, 4U);
+    if (st != JOURNAL_OK) {
+        /* A slot with any word programmed fails its CRC at replay and is skipped. One left
+         * erased would end the replay and drop every record after it: the next append
+         * programs it again. */
+        if (!words_erased(sector_at(j, j->active) + j->head, JOURNAL_RECORD_SIZE)) j->head += JOURNAL_RECORD_SIZE;
+        return st;
+    }
+    j->head += JOURNAL_RECORD_SIZE;
+
+    j->group_mask |= 1UL << ((j->head - JOURNAL_RECORD_SIZE - j->group) / JOURNAL_RECORD_SIZE);
+    j->group_sum += record_sum((const jrec_t *)rec);
+    j->seq++;
+    return JOURNAL_OK;
+}
+
+/* 1 if the next record goes in without a rotation: at most a checkpoint and the record
+ * itself to program, no snapshot and no erase */
+uint8_t journal_can_append(const journal_t *j)
+{
+    uint32_t head = j->head;
+
+    if (j->base == NULL) return 0;
+    if (checkpoint_due(j)) head += CKPT_SIZE;
+    return head + JOURNAL_RECORD_SIZE <= j->sector_size;
+}
+
+/* Commit one vote: one record, four word programs. Tally and voted set change only once the
+ * record is in flash. */
+int journal_vote(journal_t *j, int32_t voter, uint8_t candidate)
+{
+    int st;
+
+    if (j->base == NULL) return JOURNAL_ERR;
+    if (voter < 0 || (uint32_t)voter >= j->n_slots || candidate >= JOURNAL_CANDIDATES) return JOURNAL_BAD_ARG;
+    st = append(j, JREC_VOTE | ((uint32_t)candidate << 8), (uint32_t)voter, 1U);
+    if (st != JOURNAL_OK) return st;
+
+    j->tally[candidate]++;
+    voted_set(voter);
+    j->sealed = 0;
+    return JOURNAL_OK;
+}
+
+/* Mark a clean stop after the last vote, for the power-fail path: programs the seal record
+ * (and a due checkpoint) only, JOURNAL_FULL where that would take a rotation. */
+int journal_seal(journal_t *j)
+{
+    int st;
+
+    if (j->base == NULL) return JOURNAL_ERR;
+    st = append(j, JREC_SEAL, 0U, 0U);
+    if (st == JOURNAL_OK) j->sealed = 1;
+    return st;
+}
+
+/* Idle-time upkeep, at most one flash operation per call: erase the sector left behind by
+ * the last rotation, close a full group, or rotate early when the active sector is nearly
+ * full, so that journal_vote() only ever programs its record. An erase stalls the CPU for
+ * a few hundred ms. */
+void journal_service(journal_t *j)
+{
+    if (j->base == NULL) return;
+    if (j->erase_pending) {
+        if (erase_sector(j, j->active ^ 1U) == JOURNAL_OK) j->erase_pending = 0;
+        return;
+    }
+    if (checkpoint_due(j) && j->head + CKPT_SIZE <= j->sector_size) {
+        (void)write_checkpoint(j);
+        return;
+    }
+    if (j->head + JOURNAL_ROTATE_MARGIN * JOURNAL_RECORD_SIZE > j->sector_size) (void)journal_rotate(j);
+}
@@ -25,6 +25,13 @@
 /* project headers */
 #include "main.h"     /* CubeMX-generated project header (pins, prototypes) */
 #include "rc522.h"    /* MFRC522 driver (uses HAL SPI in your project) */
+#include "phase_timing.h" /* DWT cycle statistics of the card read path */
+#include "voter_index.h"  /* perfect-hash index of the authorized voter roll */
+#include "voter_roll.h"   /* voter roll image in the VOTER_ROLL flash region */
+#include "voted.h"        /* who has voted, a RAM bitset restored from the journal */
+#include "journal.h"      /* votes committed to the JOURNAL flash region */
+#include "vote_queue.h"   /* write-behind queue in front of the journal */
+#include "vote_backup.h"  /* votes mirrored in the RTC backup registers */
 
 /* CMSIS / device / HAL headers */
 #include "stm32f4xx.h"    /* CMSIS device registers (GPIOA, ADC1, I2C1, etc.) */
@@ -35,17 +42,63 @@
 #define MIN_LED_ON_MS 200U
 #endif
 
+/* Cards enumerated by the setup inventory (button held at power-up) */
+#ifndef INVENTORY_MAX_CARDS
+#define INVENTORY_MAX_CARDS 16U
+#endif
+
+/* Ballot mode: every card carries its ballot credit in a MIFARE Classic value block. A card with
+ * no credit left is turned away after one card read, and casting a vote spends the credit on the
+ * card (DECREMENT + TRANSFER), so offline booths need no shared table of who has voted.
+ * The card has to stay on the reader until the vote is cast. */
+#ifndef BALLOT_MODE
+#define BALLOT_MODE 0
+#endif
+#ifndef BALLOT_BLOCK
+#define BALLOT_BLOCK 4U     /* sector 1, block 0 */
+#endif
+
+/* Strict commit: a vote is in flash before VOTE CASTED shows. Off, votes go through the write-behind
+ * queue and up to VOTE_QUEUE_MAX of them are lost on a power cut before the idle loop flushes them. */
+#ifndef STRICT_COMMIT
+#define STRICT_COMMIT 0
+#endif
+
+/* Mirror every vote into the RTC backup registers as it is cast, and put back at boot the ones the
+ * journal missed. Covers resets, and power cuts too when VBAT is fitted. */
+#ifndef VOTE_BACKUP
+#define VOTE_BACKUP 1
+#endif
+
+/* Power-fail warning: with the supply below the PVD level the PVD interrupt programs the queued votes
+ * and seals the journal. The PVD and its interrupt are set up in theLast.ioc (HAL_MspInit): level 7,
+ * about 2.9 V, leaves headroom over the 2.7 V that word programming needs. */
+#ifndef PVD_WARNING
+#define PVD_WARNING 1
+#endif
+
+/* Precinct of this booth: voters the roll image assigns to another precinct are turned away (0 = any) */
+#ifndef BOOTH_PRECINCT
+#define BOOTH_PRECINCT 0U
+#endif
+
 #define SSD1306_ADDR_7BIT  0x3CU
 #define SSD1306_WRITE_ADDR (SSD1306_ADDR_7BIT << 1)
 #define I2C_TIMEOUT  100000U
 
 /* -------------------------------------------------------------------------- */
 SPI_HandleTypeDef hspi1; /* used by rc522 HAL driver */
+DMA_HandleTypeDef hdma_spi1_rx; /* SPI1_RX: DMA2 Stream0 Channel3 */
+DMA_HandleTypeDef hdma_spi1_tx; /* SPI1_TX: DMA2 Stream3 Channel3 */
+MFRC522_HandleTypeDef hrc522;   /* reader on SPI1, CS PA4, RST PB0, IRQ PB1 */
+
+/* Readers served by the round-robin scan; more lanes = more handles on SPI1 with their own CS */
+static MFRC522_HandleTypeDef *readers[] = { &hrc522 };
+static MFRC522_SchedulerTypeDef rc522_sched = { readers, sizeof(readers) / sizeof(readers[0]), 0 };
 
 /* Globals */
 uint8_t status;
-uint8_t str[MAX_LEN];
-uint8_t sNum[5];
+MFRC522_Uid sNum;
 static uint32_t led_on_until = 0U;
 
 /* Display states */
@@ -53,15 +106,27 @@ enum { DS_WELCOME = 0, DS_CASTE_VOTE = 2, DS_VOTE_CASTED = 3, DS_VERIFIED = 4, D
 static uint8_t display_state = DS_WELCOME;
 static uint32_t display_until = 0U;
 
-/* Authorized UIDs */
-static const uint8_t auth_uids[][5] = {
-    { 0x73, 0x91, 0xB1, 0x28, 0x7B },
-    { 0x96, 0x7C, 0x41, 0x1E, 0xB5 }
-};
-static const size_t auth_count = sizeof(auth_uids) / sizeof(auth_uids[0]);
-
-/* Vote counters */
-static uint32_t votesA = 0, votesB = 0, votesC = 0;
+/* Authorized UIDs: the roll image in the VOTER_ROLL region if one is flashed, otherwise the roll
+ * built into the firmware (Core/Src/voter_table.c). Both are generated by Tools/votergen. */
+extern const uint8_t __voter_roll_start[];
+extern const uint8_t __voter_roll_size[];   /* linker symbol: its address is the size */
+static voter_roll_t voter_roll;
+static const voter_index_t *voters = &voter_table;
+static int voter_roll_status = VOTER_ROLL_BLANK;
+static int32_t voter_idx = VOTER_NONE;  /* voter index of the verified card */
+
+/* Vote journal: tallies and voted set, in the JOURNAL region (two sectors) */
+extern const uint8_t __journal_start[];
+extern const uint8_t __journal_size[];
+static journal_t journal;
+static volatile uint8_t pvd_armed = 0;   /* the power-fail warning may flush into the journal */
+
+/* Ballot mode: key A of the ballot sector, and the voter whose card is on the reader with the
+ * credit it held when it was verified */
+static uint8_t ballot_key[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+static uint8_t voter_lane = 0;
+static MFRC522_Uid voter_uid;
+static int32_t voter_credit = 0;
 
 /* Selection & arrow animation */
 static uint8_t sel_idx = 0; /* 0=A,1=B,2=C */
@@ -81,7 +146,9 @@ static uint8_t btn_press_origin = DS_WELCOME;
 /* Prototypes */
 void SystemClock_Config(void);
 static void MX_GPIO_Init_register(void);
+static void MX_DMA_Init(void);
 static void MX_SPI1_Init(void);
+static void MX_RC522_Init(void);
 void Error_Handler(void);
 
 /* SSD1306 / I2C (register-level) */
@@ -107,9 +174,24 @@ static uint32_t read_pot_adc_register(void);
 static void show_welcome(void);
 static void show_caste_vote_screen(uint8_t sel, uint8_t anim_visible);
 static void show_vote_casted(uint8_t sel);
-static void show_verified_with_uid(const uint8_t uid[5]);
-static void show_invalid_with_uid(const uint8_t uid[5]);
+static void show_verified_with_uid(const MFRC522_Uid *uid);
+static void show_invalid_with_uid(const MFRC522_Uid *uid);
+static void show_ballot_used_with_uid(const MFRC522_Uid *uid);
+static void show_already_voted_with_uid(const MFRC522_Uid *uid);
+static void show_vote_not_cast(const char *why);
+static void show_ballot_retry(void);
 static void show_vote_counts(uint32_t a, uint32_t b, uint32_t c);
+static void open_voter_roll(void);
+static void open_journal(void);
+static void booth_closed(const char *why);
+static void open_vote_backup(void);
+static int32_t authorized_voter(const MFRC522_Uid *uid);
+static uint8_t uid_is_authorized(const MFRC522_Uid *uid);
+static uint8_t ballot_read_credit(uint8_t lane, const MFRC522_Uid *uid, int32_t *credit);
+static uint8_t ballot_settle(uint8_t lane, const MFRC522_Uid *uid, int32_t credit);
+static uint8_t ballot_consume(uint8_t lane, const MFRC522_Uid *uid, int32_t credit);
+static uint8_t ballot_refund(uint8_t lane, const MFRC522_Uid *uid, int32_t credit);
+static void run_card_inventory(void);
 
 /* busy-wait */
 static void delay_cpu(volatile uint32_t d) { while (d--) { __NOP(); } }
@@ -344,26 +426,71 @@ static void show_vote_casted(uint8_t sel)
     display_until = HAL_GetTick() + 3000U;
 }
 
-static void show_verified_with_uid(const uint8_t uid[5])
+static void format_uid(char *out, size_t len, const MFRC522_Uid *uid)
+{
+    size_t pos = (size_t)snprintf(out, len, "UID:");
+    for (uint8_t i = 0; i < uid->size && pos + 3 < len; ++i)
+        pos += (size_t)snprintf(&out[pos], len - pos, i ? " %02X" : "%02X", uid->uidByte[i]);
+}
+
+static void show_verified_with_uid(const MFRC522_Uid *uid)
 {
     char uidstr[64];
-    snprintf(uidstr, sizeof(uidstr), "UID:%02X %02X %02X %02X %02X", uid[0], uid[1], uid[2], uid[3], uid[4]);
+    format_uid(uidstr, sizeof(uidstr), uid);
     ssd1306_clear();
     ssd1306_print(1, 8, "VOTER ID VERIFIED");
     ssd1306_print(4, 10, uidstr);
     display_state = DS_VERIFIED; display_until = HAL_GetTick() + 3000U;
 }
 
-static void show_invalid_with_uid(const uint8_t uid[5])
+static void show_invalid_with_uid(const MFRC522_Uid *uid)
 {
     char uidstr[64];
-    snprintf(uidstr, sizeof(uidstr), "UID:%02X %02X %02X %02X %02X", uid[0], uid[1], uid[2], uid[3], uid[4]);
+    format_uid(uidstr, sizeof(uidstr), uid);
     ssd1306_clear();
     ssd1306_print(1, 8, "VOTER ID INVALID");
     ssd1306_print(4, 10, uidstr);
     display_state = DS_INVALID; display_until = HAL_GetTick() + 3000U;
 }
 
+static void show_ballot_used_with_uid(const MFRC522_Uid *uid)
+{
+    char uidstr[64];
+    format_uid(uidstr, sizeof(uidstr), uid);
+    ssd1306_clear();
+    ssd1306_print(1, 8, "BALLOT ALREADY USED");
+    ssd1306_print(4, 10, uidstr);
+    display_state = DS_INVALID; display_until = HAL_GetTick() + 3000U;
+}
+
+static void show_already_voted_with_uid(const MFRC522_Uid *uid)
+{
+    char uidstr[64];
+    format_uid(uidstr, sizeof(uidstr), uid);
+    ssd1306_clear();
+    ssd1306_print(1, 12, "ALREADY VOTED");
+    ssd1306_print(4, 10, uidstr);
+    display_state = DS_INVALID; display_until = HAL_GetTick() + 3000U;
+}
+
+static void show_vote_not_cast(const char *why)
+{
+    ssd1306_clear();
+    ssd1306_print(1, 12, "VOTE NOT CAST");
+    ssd1306_print(3, 0, why);
+    display_state = DS_INVALID; display_until = HAL_GetTick() + 3000U;
+}
+
+/* The card did not take the ballot (or could not say): back to the vote screen afterwards */
+static void show_ballot_retry(void)
+{
+    ssd1306_clear();
+    ssd1306_print(1, 12, "VOTE NOT CAST");
+    ssd1306_print(3, 0, "Keep card on reader");
+    ssd1306_print(4, 0, "and press again");
+    display_state = DS_VERIFIED; display_until = HAL_GetTick() + 3000U;
+}
+
 static void show_vote_counts(uint32_t a, uint32_t b, uint32_t c)
 {
     char buf[32];
@@ -377,6 +504,194 @@ static void show_vote_counts(uint32_t a, uint32_t b, uint32_t c)
     ssd1306_print(4, 6, buf);
 }
 
+/* Voter index of a card on the roll (and allowed at this booth), VOTER_NONE otherwise */
+static int32_t authorized_voter(const MFRC522_Uid *uid)
+{
+    int32_t voter;
+    const voter_meta_t *meta;
+
+    /* Stray cards (transit passes, phones) mostly stop at the prefilter */
+    if (!voter_index_maybe(voters, uid->uidByte, uid->size)) return VOTER_NONE;
+    voter = voter_index_lookup(voters, uid->uidByte, uid->size);
+    meta = voter_roll_meta(&voter_roll, voter);
+    if (voter == VOTER_NONE) return VOTER_NONE;
+    if (BOOTH_PRECINCT != 0U && meta != NULL && meta->precinct != 0U && meta->precinct != BOOTH_PRECINCT) return VOTER_NONE;
+    return voter;
+}
+
+static uint8_t uid_is_authorized(const MFRC522_Uid *uid)
+{
+    return authorized_voter(uid) != VOTER_NONE;
+}
+
+/* Ballot credit of the card that just arrived; the presence tracker has halted it, so wake it first */
+static uint8_t ballot_read_credit(uint8_t lane, const MFRC522_Uid *uid, int32_t *credit)
+{
+    MFRC522_HandleTypeDef *hrc = readers[lane];
+    uint8_t st = MFRC522_PresenceWake(hrc);
+    if (st == MI_OK) st = MFRC522_AuthCached(hrc, PICC_AUTHENT1A, BALLOT_BLOCK, ballot_key, (uint8_t *)&uid->uidByte[uid->size - 4]);
+    if (st == MI_OK) st = MFRC522_ValueRead(hrc, BALLOT_BLOCK, credit);
+    MFRC522_Halt(hrc);
+    return st;
+}
+
+/* MI_OK if the card now holds credit. The card stores a value on TRANSFER and only then
+ * answers, so a lost answer leaves the outcome open until it is read back. */
+static uint8_t ballot_settle(uint8_t lane, const MFRC522_Uid *uid, int32_t credit)
+{
+    int32_t now = 0;
+    return (ballot_read_credit(lane, uid, &now) == MI_OK && now == credit) ? MI_OK : MI_ERR;
+}
+
+/* Spend one of the credit ballots the card held when it was verified. MI_OK: spent, also by
+ * an earlier press whose TRANSFER answer was lost. MI_ERR: not spent, or the card is not
+ * there to say; the next press finds out from the card. */
+static uint8_t ballot_consume(uint8_t lane, const MFRC522_Uid *uid, int32_t credit)
+{
+    MFRC522_HandleTypeDef *hrc = readers[lane];
+    int32_t now = 0;
+    uint8_t st = MFRC522_PresenceWake(hrc);
+    if (st == MI_OK) st = MFRC522_AuthCached(hrc, PICC_AUTHENT1A, BALLOT_BLOCK, ballot_key, (uint8_t *)&uid->uidByte[uid->size - 4]);
+    if (st == MI_OK) st = MFRC522_ValueRead(hrc, BALLOT_BLOCK, &now);
+    if (st == MI_OK && credit > 0 && now == credit - 1) {
+        MFRC522_Halt(hrc);
+        return MI_OK;
+    }
+    if (st == MI_OK && (now != credit || credit <= 0)) st = MI_ERR;
+    if (st == MI_OK && (MFRC522_Decrement(hrc, BALLOT_BLOCK, 1) != MI_OK || MFRC522_Transfer(hrc, BALLOT_BLOCK) != MI_OK)) {
+        MFRC522_Halt(hrc);
+        return ballot_settle(lane, uid, credit - 1);
+    }
+    MFRC522_Halt(hrc);
+    return st;
+}
+
+/* Give back the ballot ballot_consume() spent, when the vote could not be stored after all:
+ * MI_OK once the card holds credit again */
+static uint8_t ballot_refund(uint8_t lane, const MFRC522_Uid *uid, int32_t credit)
+{
+    MFRC522_HandleTypeDef *hrc = readers[lane];
+    uint8_t st = MFRC522_PresenceWake(hrc);
+    if (st == MI_OK) st = MFRC522_AuthCached(hrc, PICC_AUTHENT1A, BALLOT_BLOCK, ballot_key, (uint8_t *)&uid->uidByte[uid->size - 4]);
+    if (st == MI_OK) st = MFRC522_Increment(hrc, BALLOT_BLOCK, 1);
+    if (st == MI_OK) st = MFRC522_Transfer(hrc, BALLOT_BLOCK);
+    MFRC522_Halt(hrc);
+    return (st == MI_OK) ? MI_OK : ballot_settle(lane, uid, credit);
+}
+
+/* Map the roll image once at boot: layout checks, then one CRC pass over the image. A blank region
+ * keeps the built-in roll; a damaged image authorizes nobody rather than falling back to it. */
+static void open_voter_roll(void)
+{
+    char buf[24];
+
+    voter_roll_status = voter_roll_open(&voter_roll, __voter_roll_start, (uint32_t)(uintptr_t)__voter_roll_size);
+    if (voter_roll_status == VOTER_ROLL_BLANK) return;
+    voters = &voter_roll.index;
+    if (voter_roll_status == VOTER_ROLL_OK) return;
+
+    ssd1306_clear();
+    ssd1306_print(1, 0, "VOTER ROLL ERROR");
+    snprintf(buf, sizeof(buf), "CODE %d", voter_roll_status);
+    ssd1306_print(3, 0, buf);
+    HAL_Delay(3000U);
+}
+
+/* Journal of the roll in use, keyed by the roll's CRC so a new roll starts from no votes.
+ * Not opened for a damaged roll: that would wipe the votes of the roll it replaced. */
+static void open_journal(void)
+{
+    uint32_t key, t0;
+    int st;
+
+    if (voter_roll_status == VOTER_ROLL_OK) {
+        key = voter_roll.hdr->crc;
+    } else if (voter_roll_status == VOTER_ROLL_BLANK) {
+        key = voter_roll_crc32(voter_table.seed, (const uint8_t *)voter_table.disp, voter_table.n_buckets * 2U);
+        key = voter_roll_crc32(key, (const uint8_t *)voter_table.fp, voter_table.n_slots * 2U);
+        key = voter_roll_crc32(key, voter_table.keys, voter_table.n_slots * VOTER_SLOT_KEY);
+    } else {
+        return;
+    }
+
+    t0 = phase_timing_now();
+    st = journal_open(&journal, __journal_start, (uint32_t)(uintptr_t)__journal_size / JOURNAL_SECTORS,
+                      FLASH_SECTOR_2, key, voters->n_slots);
+    if (st == JOURNAL_OK) {
+        phase_timing_record(PT_RECOVERY, t0);   /* a formatting boot erases: not a recovery */
+        return;
+    }
+    if (st != JOURNAL_FORMATTED) booth_closed((st == JOURNAL_TOO_LARGE) ? "Roll too large" : "Vote store error");
+    ssd1306_clear();
+    ssd1306_print(1, 0, "NEW VOTER ROLL");
+    ssd1306_print(3, 0, "Nobody has voted");
+    HAL_Delay(3000U);
+}
+
+/* No journal, so no record of who has voted: the booth stays closed until it is fixed.
+ * Does not return; the LED blinks like Error_Handler(). */
+static void booth_closed(const char *why)
+{
+    ssd1306_clear();
+    ssd1306_print(1, 0, "BOOTH CLOSED");
+    ssd1306_print(3, 0, why);
+    ssd1306_print(5, 0, "Votes cannot be cast");
+    printf("booth closed: %s\r\n", why);
+    for (;;) {
+        GPIOC->BSRR = (1U << (13 + 16));
+        HAL_Delay(500U);
+        GPIOC->BSRR = (1U << 13);
+        HAL_Delay(500U);
+    }
+}
+
+/* Reconcile the backup-register mirror with the journal just opened. Left closed without VOTE_BACKUP
+ * or a journal, which makes vote_backup_record() a no-op. */
+static void open_vote_backup(void)
+{
+#if VOTE_BACKUP
+    uint32_t recovered, missing;
+    char buf[24];
+
+    if (journal.base == NULL) return;
+    HAL_PWR_EnableBkUpAccess();     /* PWR clock is on since SystemClock_Config() */
+    recovered = vote_backup_open(&RTC->BKP0R, &journal, &missing);
+    if (recovered == 0U && missing == 0U) return;
+
+    ssd1306_clear();
+    ssd1306_print(1, 0, (missing != 0U) ? "VOTES MISSING" : "VOTES RECOVERED");
+    snprintf(buf, sizeof(buf), "Recovered: %lu", (unsigned long)recovered);
+    ssd1306_print(3, 0, buf);
+    if (missing != 0U) {
+        snprintf(buf, sizeof(buf), "Missing: %lu", (unsigned long)missing);
+        ssd1306_print(4, 0, buf);
+    }
+    HAL_Delay(3000U);
+#endif
+}
+
+/* Setup check: enumerate every card on the antenna in one pass and show how many are authorized */
+static void run_card_inventory(void)
+{
+    MFRC522_Uid cards[INVENTORY_MAX_CARDS];
+    uint8_t count = 0, authorized = 0;
+    uint32_t cycles = 0;
+    char buf[32];
+
+    ssd1306_clear();
+    ssd1306_print(0, 6, "CARD INVENTORY");
+    uint8_t st = MFRC522_Inventory(&hrc522, cards, INVENTORY_MAX_CARDS, &count, &cycles);
+    for (uint8_t i = 0; i < count; ++i) authorized += uid_is_authorized(&cards[i]);
+
+    snprintf(buf, sizeof(buf), "CARDS: %u%s", count, (st == MI_OK) ? "" : "+");
+    ssd1306_print(2, 6, buf);
+    snprintf(buf, sizeof(buf), "AUTHORIZED: %u", authorized);
+    ssd1306_print(3, 6, buf);
+    snprintf(buf, sizeof(buf), "TIME: %lu us", (unsigned long)(cycles / (SystemCoreClock / 1000000U)));
+    ssd1306_print(4, 6, buf);
+    HAL_Delay(3000);
+}
+
 static uint8_t adc_to_selection(uint32_t v)
 {
     if (v < adc_thresh_low) return 0;
@@ -389,19 +704,28 @@ int main(void)
 {
     HAL_Init();
     SystemClock_Config();
+    phase_timing_init();
 
     /* Keep using HAL systick implemented in stm32f4xx_it.c */
 
     MX_GPIO_Init_register();
+    MX_DMA_Init(); /* before SPI1: HAL_SPI_MspInit links the DMA streams */
     MX_SPI1_Init();
 
-    MFRC522_Init(); /* uses HAL SPI */
+    MX_RC522_Init();
 
     MX_ADC1_Init_register();
 
     i2c1_init();
     ssd1306_init();
     ssd1306_clear();
+    open_voter_roll();
+    open_journal();
+    open_vote_backup();
+    pvd_armed = PVD_WARNING;   /* after the journal is open: the warning flushes into it */
+
+    /* Button held at power-up: batch-check the cards on the reader before polling opens */
+    if (HAL_GPIO_ReadPin(GPIOA, GPIO_PIN_0) == GPIO_PIN_RESET) run_card_inventory();
 
     show_welcome();
 
@@ -413,23 +737,34 @@ int main(void)
 
     for (;;)
     {
-        status = MFRC522_Request(PICC_REQIDL, str);
-        if (status == MI_OK) {
-            if (MFRC522_Anticoll(str) == MI_OK) {
-                memcpy(sNum, str, 5);
-                uint32_t now = HAL_GetTick();
-                uint32_t cand = now + MIN_LED_ON_MS;
-                if (cand > led_on_until) led_on_until = cand;
-
-                if (display_state == DS_WELCOME) {
-                    uint8_t match = 0;
-                    for (size_t i = 0; i < auth_count; ++i) {
-                        if (memcmp(sNum, auth_uids[i], 5) == 0) { match = 1; break; }
-                    }
-                    if (match) show_verified_with_uid(sNum); else show_invalid_with_uid(sNum);
+        /* Card scan runs in the background; a card resting on the reader is reported once */
+        uint8_t lane;
+        status = MFRC522_SchedulerPoll(&rc522_sched, &lane, &sNum);
+        if (status == MFRC522_EVT_ARRIVED) {
+            uint32_t now = HAL_GetTick();
+            uint32_t cand = now + MIN_LED_ON_MS;
+            if (cand > led_on_until) led_on_until = cand;
+
+            if (display_state == DS_WELCOME) {
+                uint32_t t0 = phase_timing_now();
+                int32_t voter = authorized_voter(&sNum);
+                uint8_t ok = (voter != VOTER_NONE);
+                uint8_t voted = ok && vote_queue_voted(voter);
+                uint8_t used = 0;
+                voter_idx = voter;
+                if (BALLOT_MODE && ok && !voted) {
+                    int32_t credit = 0;
+                    ok = (ballot_read_credit(lane, &sNum, &credit) == MI_OK);
+                    used = ok && credit <= 0;
+                    voter_lane = lane; voter_uid = sNum; voter_credit = credit;
                 }
-
-                HAL_Delay(50);
+                phase_timing_record(PT_LOOKUP, t0);
+                t0 = phase_timing_now();
+                if (voted) show_already_voted_with_uid(&sNum);
+                else if (used) show_ballot_used_with_uid(&sNum);
+                else if (ok) show_verified_with_uid(&sNum); else show_invalid_with_uid(&sNum);
+                phase_timing_record(PT_DISPLAY, t0);
+                phase_timing_record(PT_TOTAL, phase_timing_anchor());
             }
         }
 
@@ -440,11 +775,20 @@ int main(void)
         else if (btn_prev == 0 && btn_now == 1) {
             uint32_t held = tick - btn_press_start;
             if (held >= LONG_PRESS_MS) {
-                if (btn_press_origin == DS_WELCOME) show_welcome();
+                if (btn_press_origin == DS_WELCOME) { show_welcome(); phase_timing_dump(); vote_queue_dump(); }
             } else {
                 if (display_state == DS_CASTE_VOTE) {
-                    if (sel_idx == 0) votesA++; else if (sel_idx == 1) votesB++; else votesC++;
-                    show_vote_casted(sel_idx);
+                    /* Spend the card's ballot only once the vote can be stored, and give it back
+                     * if the journal write fails anyway */
+                    if (vote_queue_can_cast(&journal, voter_idx, sel_idx) != JOURNAL_OK) show_vote_not_cast("Vote store failed");
+                    else if (BALLOT_MODE && ballot_consume(voter_lane, &voter_uid, voter_credit) != MI_OK) show_ballot_retry();
+                    else if (vote_queue_cast(&journal, voter_idx, sel_idx, STRICT_COMMIT) != JOURNAL_OK) {
+                        if (BALLOT_MODE && ballot_refund(voter_lane, &voter_uid, voter_credit) != MI_OK) show_vote_not_cast("Ballot not refunded");
+                        else show_vote_not_cast("Vote store failed");
+                    } else {
+                        vote_backup_record(voter_idx, sel_idx);
+                        show_vote_casted(sel_idx);
+                    }
                 } else show_welcome();
             }
         }
@@ -453,7 +797,9 @@ int main(void)
             uint32_t held = tick - btn_press_start;
             if (held >= LONG_PRESS_MS) {
                 if (btn_press_origin == DS_WELCOME) {
-                    show_vote_counts(votesA, votesB, votesC);
+                    uint32_t tally[JOURNAL_CANDIDATES];
+                    vote_queue_tally(&journal, tally);
+                    show_vote_counts(tally[0], tally[1], tally[2]);
                     btn_prev = btn_now;
                     HAL_Delay(20);
                     continue;
@@ -479,6 +825,12 @@ int main(void)
             show_caste_vote_screen(sel_idx, anim_state);
         }
 
+        /* Idle: queued votes first, one record per pass. With the queue empty and nobody at the booth,
+         * erase the journal sector left by the last rotation (stalls a few hundred ms) or rotate
+         * ahead of time, so a vote never waits for an erase. */
+        if (display_state != DS_CASTE_VOTE && vote_queue_depth() != 0U) (void)vote_queue_flush_one(&journal);
+        else if (display_state == DS_WELCOME) vote_queue_service(&journal);
+
         if (HAL_GetTick() < led_on_until) GPIOC->BSRR = (1U << (13 + 16)); else GPIOC->BSRR = (1U << 13);
 
         HAL_Delay(20);
@@ -486,7 +838,7 @@ int main(void)
 }
 
 /* -------------------------------------------------------------------------- */
-/* GPIO init: register-level for PC13 LED, PA4 CS, PB0 RST, PA0 button, PA1 analog */
+/* GPIO init: register-level for PC13 LED, PA4 CS, PB0 RST, PB1 IRQ, PA0 button, PA1 analog */
 static void MX_GPIO_Init_register(void)
 {
     /* Enable GPIO clocks */
@@ -518,6 +870,20 @@ static void MX_GPIO_Init_register(void)
     GPIOB->PUPDR &= ~(3U << (0 * 2));
     GPIOB->BSRR = (1U << 0); /* RST HIGH */
 
+    /* PB1 MFRC522 IRQ input with pull-up, EXTI1 on the falling edge (IRQ is active-low) */
+    GPIOB->MODER &= ~(3U << (1 * 2));
+    GPIOB->PUPDR &= ~(3U << (1 * 2));
+    GPIOB->PUPDR |=  (1U << (1 * 2)); /* pull-up */
+    RCC->APB2ENR |= RCC_APB2ENR_SYSCFGEN;
+    SYSCFG->EXTICR[0] &= ~SYSCFG_EXTICR1_EXTI1;
+    SYSCFG->EXTICR[0] |=  SYSCFG_EXTICR1_EXTI1_PB;
+    EXTI->RTSR &= ~(1U << 1);
+    EXTI->FTSR |=  (1U << 1);
+    EXTI->PR = (1U << 1);     /* drop any stale edge */
+    EXTI->IMR |= (1U << 1);
+    HAL_NVIC_SetPriority(EXTI1_IRQn, 1, 0);
+    HAL_NVIC_EnableIRQ(EXTI1_IRQn);
+
     /* PA0 button input with pull-up */
     GPIOA->MODER &= ~(3U << (0 * 2));
     GPIOA->PUPDR &= ~(3U << (0 * 2));
@@ -529,6 +895,17 @@ static void MX_GPIO_Init_register(void)
     GPIOA->PUPDR &= ~(3U << (1 * 2)); /* no pull */
 }
 
+/* DMA2 clock + stream IRQs for the SPI1 RX/TX channels used by rc522 bursts */
+static void MX_DMA_Init(void)
+{
+  __HAL_RCC_DMA2_CLK_ENABLE();
+
+  HAL_NVIC_SetPriority(DMA2_Stream0_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA2_Stream0_IRQn);
+  HAL_NVIC_SetPriority(DMA2_Stream3_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA2_Stream3_IRQn);
+}
+
 /* Keep SPI init via HAL for MFRC522 compatibility */
 static void MX_SPI1_Init(void)
 {
@@ -547,6 +924,18 @@ static void MX_SPI1_Init(void)
   if (HAL_SPI_Init(&hspi1) != HAL_OK) { Error_Handler(); }
 }
 
+/* Reader handles: wiring first, then the chip and the driver state */
+static void MX_RC522_Init(void)
+{
+  hrc522.hspi = HSPI_INSTANCE;
+  hrc522.csPort = MFRC522_CS_PORT;
+  hrc522.csPin = MFRC522_CS_PIN;
+  hrc522.rstPort = MFRC522_RST_PORT;
+  hrc522.rstPin = MFRC522_RST_PIN;
+  MFRC522_Init(&hrc522);
+  MFRC522_SetIrqMode(&hrc522, 1); /* wait on the IRQ pin (PB1/EXTI1) instead of polling CommIrqReg */
+}
+
 /* SystemClock_Config (same as CubeMX typical config) */
 void SystemClock_Config(void)
 {
@@ -575,6 +964,31 @@ void SystemClock_Config(void)
   if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_2) != HAL_OK) { Error_Handler(); }
 }
 
+/* printf retarget (_write in syscalls.c): ITM stimulus port 0, read over SWO. No-op without a debugger. */
+int __io_putchar(int ch)
+{
+  ITM_SendChar((uint32_t)ch);
+  return ch;
+}
+
+/* EXTI callback: the MFRC522 IRQ line completes a pending card exchange */
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
+{
+  if (GPIO_Pin == MFRC522_IRQ_PIN) { MFRC522_IrqNotify(&hrc522); }
+}
+
+/* Supply below the PVD level: queued votes and a seal record to flash, timed as PT_EMERGENCY.
+ * The PVD is live from HAL_Init(), so a warning before the journal is open finds nothing to flush. */
+void HAL_PWR_PVDCallback(void)
+{
+  uint32_t t0;
+
+  if (!pvd_armed) return;
+  t0 = phase_timing_now();
+  (void)vote_queue_emergency(&journal);
+  phase_timing_record(PT_EMERGENCY, t0);
+}
+
 void Error_Handler(void)
 {
   __disable_irq();
@@ -0,0 +1,125 @@
+/*
+ * phase_timing.c
+ *
+ * Per-phase cycle statistics of the card read path, see phase_timing.h.
+ * Read them with phase_timing_dump() (printf -> _write -> __io_putchar, SWO on this board)
+ * or from the debugger through phase_timing_get().
+ */
+#include <stdio.h>
+#include <string.h>
+#include "phase_timing.h"
+
+#if PHASE_TIMING
+
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t hist[PT_HIST_BUCKETS];
+} phase_acc_t;
+
+static phase_acc_t pt_acc[PT_PHASE_COUNT];
+static uint32_t pt_anchor;
+
+static const char *const pt_names[PT_PHASE_COUNT] = {
+    "request", "anticoll", "lookup", "display", "total", "recovery", "flush", "commit",
+    "emergency"
+};
+
+static uint32_t bucket_of(uint32_t cycles)
+{
+    uint32_t msb;
+
+    if (cycles < (1UL << PT_HIST_MIN_LOG2)) return 0;
+    msb = 31U - (uint32_t)__builtin_clz(cycles);
+    return (msb - PT_HIST_MIN_LOG2) * PT_HIST_SUB + ((cycles >> (msb - 2U)) & (PT_HIST_SUB - 1U));
+}
+
+/* Bucket 0 also holds everything below 2^PT_HIST_MIN_LOG2, its upper edge is still 319 */
+static uint32_t bucket_upper(uint32_t idx)
+{
+    uint32_t msb = idx / PT_HIST_SUB + PT_HIST_MIN_LOG2;
+    uint32_t sub = idx % PT_HIST_SUB;
+    uint64_t lower = (uint64_t)(PT_HIST_SUB + sub) << (msb - 2U);
+
+    lower += (1ULL << (msb - 2U)) - 1U;
+    return (lower > 0xFFFFFFFFULL) ? 0xFFFFFFFFUL : (uint32_t)lower;
+}
+
+void phase_timing_init(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    phase_timing_reset();
+}
+
+/* Add one sample: the cycles from start to now. PT_REQUEST also starts the PT_TOTAL span. */
+void phase_timing_record(uint8_t phase, uint32_t start)
+{
+    uint32_t cycles = DWT->CYCCNT - start;
+    phase_acc_t *a;
+
+    if (phase >= PT_PHASE_COUNT) return;
+    if (phase == PT_REQUEST) pt_anchor = start;
+
+    a = &pt_acc[phase];
+    if (a->count == 0 || cycles < a->min) a->min = cycles;
+    if (cycles > a->max) a->max = cycles;
+    a->sum += cycles;
+    a->count++;
+    a->hist[bucket_of(cycles)]++;
+}
+
+/* Start of the last successful REQA, for PT_TOTAL */
+uint32_t phase_timing_anchor(void)
+{
+    return pt_anchor;
+}
+
+void phase_timing_get(uint8_t phase, phase_stats_t *out)
+{
+    const phase_acc_t *a;
+    uint32_t rank, seen = 0, i;
+
+    memset(out, 0, sizeof(*out));
+    if (phase >= PT_PHASE_COUNT) return;
+    a = &pt_acc[phase];
+    if (a->count == 0) return;
+
+    out->count = a->count;
+    out->min = a->min;
+    out->max = a->max;
+    out->avg = (uint32_t)(a->sum / a->count);
+
+    rank = a->count - a->count / 100U;  /* ceil(0.99 * count) */
+    for (i = 0; i < PT_HIST_BUCKETS; ++i) {
+        seen += a->hist[i];
+        if (seen >= rank) break;
+    }
+    out->p99 = bucket_upper(i);
+    if (out->p99 > a->max) out->p99 = a->max;
+}
+
+void phase_timing_reset(void)
+{
+    memset(pt_acc, 0, sizeof(pt_acc));
+    pt_anchor = 0;
+}
+
+void phase_timing_dump(void)
+{
+    phase_stats_t s;
+    uint32_t per_us = SystemCoreClock / 1000000U;
+
+    if (per_us == 0) per_us = 1;
+    printf("phase      count   min_us   avg_us   max_us   p99_us\r\n");
+    for (uint8_t p = 0; p < PT_PHASE_COUNT; ++p) {
+        phase_timing_get(p, &s);
+        printf("%-8s %7lu %8lu %8lu %8lu %8lu\r\n", pt_names[p], (unsigned long)s.count,
+               (unsigned long)(s.min / per_us), (unsigned long)(s.avg / per_us),
+               (unsigned long)(s.max / per_us), (unsigned long)(s.p99 / per_us));
+    }
+}
+
+#endif /* PHASE_TIMING */
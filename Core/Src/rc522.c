@@ -1,4 +1,6 @@
+#include <string.h>
 #include "rc522.h"
+#include "phase_timing.h"
 
 /*
  * Function Name: RC522_SPI_Transfer
@@ -6,36 +8,276 @@
  * Input Parameters: data - the value to be written
  * Returns: a byte of data read from the module
  */
-uint8_t RC522_SPI_Transfer(uchar data)
+uint8_t RC522_SPI_Transfer(MFRC522_HandleTypeDef *hrc, uchar data)
 {
 	uchar rx_data;
-	HAL_SPI_TransmitReceive(HSPI_INSTANCE,&data,&rx_data,1,100);
+	HAL_SPI_TransmitReceive(hrc->hspi,&data,&rx_data,1,100);
 
 	return rx_data;
 }
 
+// CRC_A (ISO/IEC 14443-3 Annex B): x^16 + x^12 + x^5 + 1, LSB first (0x8408), preset 0x6363.
+// The table is built by the preprocessor: one entry is the XOR of the per-bit remainders,
+// since the CRC of a single byte is linear in its bits.
+#define CRCA_STEP(c)	(((c) >> 1) ^ (((c) & 1) ? 0x8408 : 0))
+#define CRCA_BYTE(c)	CRCA_STEP(CRCA_STEP(CRCA_STEP(CRCA_STEP(CRCA_STEP(CRCA_STEP(CRCA_STEP(CRCA_STEP(c))))))))
+enum
+{
+	CRCA_B0 = CRCA_BYTE(0x01), CRCA_B1 = CRCA_BYTE(0x02), CRCA_B2 = CRCA_BYTE(0x04), CRCA_B3 = CRCA_BYTE(0x08),
+	CRCA_B4 = CRCA_BYTE(0x10), CRCA_B5 = CRCA_BYTE(0x20), CRCA_B6 = CRCA_BYTE(0x40), CRCA_B7 = CRCA_BYTE(0x80)
+};
+#define CRCA_ENTRY(b)	(uint16_t)((((b)&0x01)?CRCA_B0:0) ^ (((b)&0x02)?CRCA_B1:0) ^ (((b)&0x04)?CRCA_B2:0) ^ (((b)&0x08)?CRCA_B3:0) ^ \
+								   (((b)&0x10)?CRCA_B4:0) ^ (((b)&0x20)?CRCA_B5:0) ^ (((b)&0x40)?CRCA_B6:0) ^ (((b)&0x80)?CRCA_B7:0))
+#define CRCA_ROW4(b)	CRCA_ENTRY(b), CRCA_ENTRY((b)+1), CRCA_ENTRY((b)+2), CRCA_ENTRY((b)+3)
+#define CRCA_ROW16(b)	CRCA_ROW4(b), CRCA_ROW4((b)+4), CRCA_ROW4((b)+8), CRCA_ROW4((b)+12)
+#define CRCA_ROW64(b)	CRCA_ROW16(b), CRCA_ROW16((b)+16), CRCA_ROW16((b)+32), CRCA_ROW16((b)+48)
+
+static const uint16_t crca_table[256] =
+{
+	CRCA_ROW64(0), CRCA_ROW64(64), CRCA_ROW64(128), CRCA_ROW64(192)
+};
+
+// Continue a CRC_A over more bytes. Run over a frame including its CRC_A the result is 0.
+static uint16_t crca_update(uint16_t crc, const uchar *data, uint len)
+{
+	uint i;
+
+	for (i=0; i<len; i++)
+	{
+		crc = (crc >> 8) ^ crca_table[(crc ^ data[i]) & 0xFF];
+	}
+	return crc;
+}
+
+// CRC_A state after the READ command byte: a READ frame's CRC is one table step from here
+#define CRCA_READ_STATE	(uint16_t)((0x6363 >> 8) ^ CRCA_ENTRY((0x6363 ^ PICC_READ) & 0xFF))
+
+// How SetBitMask/ClearBitMask may touch each register:
+//  RC522_REG_CACHED   only the host changes it, bit updates use the write-through shadow
+//  RC522_REG_IRQ      Set1/Set2 interrupt request registers, bits change with a single write
+//  RC522_REG_STROBE   writable bits are self-clearing commands, the rest is read-only
+//  RC522_REG_VOLATILE the chip changes it, read-modify-write
+static const uchar rc522_reg_policy[64] =
+{
+	[CommIEnReg]     = RC522_REG_CACHED,
+	[DivlEnReg]      = RC522_REG_CACHED,
+	[CommIrqReg]     = RC522_REG_IRQ,
+	[DivIrqReg]      = RC522_REG_IRQ,
+	[FIFOLevelReg]   = RC522_REG_STROBE,
+	[WaterLevelReg]  = RC522_REG_CACHED,
+	[ControlReg]     = RC522_REG_STROBE,
+	[BitFramingReg]  = RC522_REG_CACHED,
+	[ModeReg]        = RC522_REG_CACHED,
+	[TxModeReg]      = RC522_REG_CACHED,
+	[RxModeReg]      = RC522_REG_CACHED,
+	[TxControlReg]   = RC522_REG_CACHED,
+	[TxAutoReg]      = RC522_REG_CACHED,
+	[TxSelReg]       = RC522_REG_CACHED,
+	[RxSelReg]       = RC522_REG_CACHED,
+	[RxThresholdReg] = RC522_REG_CACHED,
+	[DemodReg]       = RC522_REG_CACHED,
+	[MifareReg]      = RC522_REG_CACHED,
+	[SerialSpeedReg] = RC522_REG_CACHED,
+	[ModWidthReg]    = RC522_REG_CACHED,
+	[RFCfgReg]       = RC522_REG_CACHED,
+	[GsNReg]         = RC522_REG_CACHED,
+	[CWGsPReg]       = RC522_REG_CACHED,
+	[ModGsPReg]      = RC522_REG_CACHED,
+	[TModeReg]       = RC522_REG_CACHED,
+	[TPrescalerReg]  = RC522_REG_CACHED,
+	[TReloadRegH]    = RC522_REG_CACHED,
+	[TReloadRegL]    = RC522_REG_CACHED,
+};
+
+#if MFRC522_USE_DMA
+// DMA transfer state. It belongs to the bus, not to a reader: one transfer may be in
+// flight on SPI1 at a time and the owner's CS stays low until the completion callback fires.
+static volatile uchar rc522_dma_busy = 0;
+static MFRC522_HandleTypeDef *rc522_dma_owner = NULL;
+static uchar rc522_dma_tx[MFRC522_FIFO_SIZE + 1];
+static uchar rc522_dma_rx[MFRC522_FIFO_SIZE + 1];
+static uchar *rc522_dma_dest = NULL;		// where received bytes are copied on completion
+static uchar rc522_dma_destLen = 0;
+static RC522_XferCallback rc522_dma_cb = NULL;
+#endif
+
+#if MFRC522_USE_DMA
+static void RC522_SPI_DMAComplete(uchar status);
+#endif
+
+/*
+ * Function Name: RC522_SPI_WaitIdle
+ * Description: Block until no DMA transfer is in flight on the reader bus. A transfer still
+ *              running after MFRC522_DMA_TIMEOUT_MS is aborted and completes with MI_ERR.
+ * Input: None
+ * Return value: MI_OK, or MI_ERR if a transfer had to be aborted
+ */
+uchar RC522_SPI_WaitIdle(void)
+{
+#if MFRC522_USE_DMA
+	uint32_t start;
+
+	if (!rc522_dma_busy)
+	{
+		return MI_OK;
+	}
+	start = HAL_GetTick();
+	while (rc522_dma_busy)
+	{
+		if ((HAL_GetTick() - start) > MFRC522_DMA_TIMEOUT_MS)
+		{
+			HAL_SPI_Abort(rc522_dma_owner->hspi);
+			if (rc522_dma_busy)
+			{
+				RC522_SPI_DMAComplete(MI_ERR);
+			}
+			return MI_ERR;
+		}
+	}
+#endif
+	return MI_OK;
+}
+
+/*
+ * Function Name: RC522_SPI_TransferBuf
+ * Description: Clock a whole buffer through SPI in a single HAL call. CS is handled by the caller.
+ * Input Parameters: txData - bytes to send; rxData - received bytes (NULL to discard); len - number of bytes
+ * Return value: None
+ */
+void RC522_SPI_TransferBuf(MFRC522_HandleTypeDef *hrc, uchar *txData, uchar *rxData, uint len)
+{
+	if (rxData)
+	{
+		HAL_SPI_TransmitReceive(hrc->hspi, txData, rxData, len, 100);
+	}
+	else
+	{
+		HAL_SPI_Transmit(hrc->hspi, txData, len, 100);	// HAL clears OVR for us in 2-line mode
+	}
+}
+
+#if MFRC522_USE_DMA
+/*
+ * Function Name: RC522_SPI_StartDMA
+ * Description: Assert CS and start a DMA transfer of rc522_dma_tx. The bytes after the
+ *              first one received are copied to dest when the transfer completes.
+ * Input Parameters: len - bytes to clock; dest - receive buffer (NULL for a write); destLen - bytes to copy;
+ *                   cb - completion callback, called from interrupt context (may be NULL)
+ * Return value: MI_OK if the transfer was started
+ */
+static uchar RC522_SPI_StartDMA(MFRC522_HandleTypeDef *hrc, uint len, uchar *dest, uchar destLen, RC522_XferCallback cb)
+{
+	HAL_StatusTypeDef ret;
+
+	rc522_dma_busy = 1;
+	rc522_dma_owner = hrc;
+	rc522_dma_dest = dest;
+	rc522_dma_destLen = destLen;
+	rc522_dma_cb = cb;
+
+	HAL_GPIO_WritePin(hrc->csPort,hrc->csPin,GPIO_PIN_RESET);
+	if (dest)
+	{
+		ret = HAL_SPI_TransmitReceive_DMA(hrc->hspi, rc522_dma_tx, rc522_dma_rx, len);
+	}
+	else
+	{
+		ret = HAL_SPI_Transmit_DMA(hrc->hspi, rc522_dma_tx, len);
+	}
+
+	if (ret != HAL_OK)
+	{
+		HAL_GPIO_WritePin(hrc->csPort,hrc->csPin,GPIO_PIN_SET);
+		rc522_dma_busy = 0;
+		return MI_ERR;
+	}
+
+	return MI_OK;
+}
+
+/*
+ * Function Name: RC522_SPI_DMAComplete
+ * Description: Release CS, hand received data back and notify the waiting caller
+ * Input Parameters: status - MI_OK or MI_ERR
+ * Return value: None
+ */
+static void RC522_SPI_DMAComplete(uchar status)
+{
+	uchar i;
+	RC522_XferCallback cb = rc522_dma_cb;
+	MFRC522_HandleTypeDef *hrc = rc522_dma_owner;
+
+	HAL_GPIO_WritePin(hrc->csPort,hrc->csPin,GPIO_PIN_SET);
+
+	if ((status == MI_OK) && rc522_dma_dest)
+	{
+		for (i=0; i<rc522_dma_destLen; i++)
+		{
+			rc522_dma_dest[i] = rc522_dma_rx[i+1];
+		}
+	}
+
+	rc522_dma_busy = 0;
+	if (cb)
+	{
+		cb(status);
+	}
+}
+
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+	if (rc522_dma_busy && (hspi == rc522_dma_owner->hspi))
+	{
+		RC522_SPI_DMAComplete(MI_OK);
+	}
+}
+
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+	if (rc522_dma_busy && (hspi == rc522_dma_owner->hspi))
+	{
+		RC522_SPI_DMAComplete(MI_OK);
+	}
+}
+
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
+{
+	if (rc522_dma_busy && (hspi == rc522_dma_owner->hspi))
+	{
+		RC522_SPI_DMAComplete(MI_ERR);
+	}
+}
+#endif
+
 /*
  * Function Name: Write_MFRC522
  * Function Description: To a certain MFRC522 register to write a byte of data
  * Input Parameters: addr - register address; val - the value to be written
  * Return value: None
  */
-void Write_MFRC522(uchar addr, uchar val)
+void Write_MFRC522(MFRC522_HandleTypeDef *hrc, uchar addr, uchar val)
 {
-	/* CS LOW */
-	HAL_GPIO_WritePin(MFRC522_CS_PORT,MFRC522_CS_PIN,GPIO_PIN_RESET);
+	uchar tx[2];
+
+	if (rc522_reg_policy[addr & 0x3F] == RC522_REG_CACHED)
+	{
+		hrc->shadow[addr & 0x3F] = val;
+		hrc->shadowValid |= (1ULL << (addr & 0x3F));
+	}
 
-	  // even though we are calling transfer frame once, we are really sending
-	  // two 8-bit frames smooshed together-- sending two 8 bit frames back to back
-	  // results in a spike in the select line which will jack with transactions
 	  // - top 8 bits are the address. Per the spec, we shift the address left
 	  //   1 bit, clear the LSb, and clear the MSb to indicate a write
-	  // - bottom 8 bits are the data bits being sent for that address, we send them
-	RC522_SPI_Transfer((addr<<1)&0x7E);
-	RC522_SPI_Transfer(val);
+	  // - bottom 8 bits are the data bits being sent for that address
+	  // Both frames go out in one HAL call so there is no gap between them.
+	tx[0] = (addr<<1)&0x7E;
+	tx[1] = val;
 
+	RC522_SPI_WaitIdle();
+	/* CS LOW */
+	HAL_GPIO_WritePin(hrc->csPort,hrc->csPin,GPIO_PIN_RESET);
+	RC522_SPI_TransferBuf(hrc, tx, NULL, 2);
 	/* CS HIGH */
-	HAL_GPIO_WritePin(MFRC522_CS_PORT,MFRC522_CS_PIN,GPIO_PIN_SET);
+	HAL_GPIO_WritePin(hrc->csPort,hrc->csPin,GPIO_PIN_SET);
 }
 
 /*
@@ -44,53 +286,361 @@ void Write_MFRC522(uchar addr, uchar val)
  * Input Parameters: addr - register address
  * Returns: a byte of data read from the module
  */
-uchar Read_MFRC522(uchar addr)
+uchar Read_MFRC522(MFRC522_HandleTypeDef *hrc, uchar addr)
 {
-	uchar val;
-
-	/* CS LOW */
-	HAL_GPIO_WritePin(MFRC522_CS_PORT,MFRC522_CS_PIN,GPIO_PIN_RESET);
+	uchar tx[2];
+	uchar rx[2];
 
-	  // even though we are calling transfer frame once, we are really sending
-	  // two 8-bit frames smooshed together-- sending two 8 bit frames back to back
-	  // results in a spike in the select line which will jack with transactions
 	  // - top 8 bits are the address. Per the spec, we shift the address left
 	  //   1 bit, clear the LSb, and set the MSb to indicate a read
 	  // - bottom 8 bits are all 0s on a read per 8.1.2.1 Table 6
-	RC522_SPI_Transfer(((addr<<1)&0x7E) | 0x80);
-	val = RC522_SPI_Transfer(0x00);
+	tx[0] = ((addr<<1)&0x7E) | 0x80;
+	tx[1] = 0x00;
 
+	RC522_SPI_WaitIdle();
+	/* CS LOW */
+	HAL_GPIO_WritePin(hrc->csPort,hrc->csPin,GPIO_PIN_RESET);
+	RC522_SPI_TransferBuf(hrc, tx, rx, 2);
 	/* CS HIGH */
-	HAL_GPIO_WritePin(MFRC522_CS_PORT,MFRC522_CS_PIN,GPIO_PIN_SET);
+	HAL_GPIO_WritePin(hrc->csPort,hrc->csPin,GPIO_PIN_SET);
+
+	return rx[1];
+}
+
+#if MFRC522_USE_DMA
+/*
+ * Function Name: Write_MFRC522_BurstAsync
+ * Description: Start a DMA write of len bytes to one register and return immediately.
+ *              data may be reused as soon as this returns.
+ * Input Parameters: addr - register address; data - bytes to write; len - number of bytes (<= MFRC522_FIFO_SIZE);
+ *                   cb - completion callback, called from interrupt context (may be NULL)
+ * Return value: MI_OK if the transfer was started
+ */
+uchar Write_MFRC522_BurstAsync(MFRC522_HandleTypeDef *hrc, uchar addr, uchar *data, uchar len, RC522_XferCallback cb)
+{
+	uchar i;
+
+	if (len > MFRC522_FIFO_SIZE)
+	{
+		len = MFRC522_FIFO_SIZE;
+	}
+
+	RC522_SPI_WaitIdle();
+	rc522_dma_tx[0] = (addr<<1)&0x7E;
+	for (i=0; i<len; i++)
+	{
+		rc522_dma_tx[i+1] = data[i];
+	}
+
+	return RC522_SPI_StartDMA(hrc, len + 1, NULL, 0, cb);
+}
+
+/*
+ * Function Name: Read_MFRC522_BurstAsync
+ * Description: Start a DMA read of len bytes from one register and return immediately.
+ *              data is filled in before cb runs.
+ * Input Parameters: addr - register address; data - receives the bytes; len - number of bytes (<= MFRC522_FIFO_SIZE);
+ *                   cb - completion callback, called from interrupt context (may be NULL)
+ * Return value: MI_OK if the transfer was started
+ */
+uchar Read_MFRC522_BurstAsync(MFRC522_HandleTypeDef *hrc, uchar addr, uchar *data, uchar len, RC522_XferCallback cb)
+{
+	uchar i;
+
+	if (len > MFRC522_FIFO_SIZE)
+	{
+		len = MFRC522_FIFO_SIZE;
+	}
+
+	RC522_SPI_WaitIdle();
+	for (i=0; i<len; i++)
+	{
+		rc522_dma_tx[i] = ((addr<<1)&0x7E) | 0x80;
+	}
+	rc522_dma_tx[len] = 0x00;
+
+	return RC522_SPI_StartDMA(hrc, len + 1, data, len, cb);
+}
+
+/*
+ * Function Name: Read_MFRC522_MultiAsync
+ * Description: Start a DMA read of a list of registers and return immediately
+ * Input Parameters: addrs - register addresses; vals - receives one value per address; count - number of registers;
+ *                   cb - completion callback, called from interrupt context (may be NULL)
+ * Return value: MI_OK if the transfer was started
+ */
+uchar Read_MFRC522_MultiAsync(MFRC522_HandleTypeDef *hrc, const uchar *addrs, uchar *vals, uchar count, RC522_XferCallback cb)
+{
+	uchar i;
+
+	if (count > MFRC522_MULTI_MAX)
+	{
+		count = MFRC522_MULTI_MAX;
+	}
+
+	RC522_SPI_WaitIdle();
+	for (i=0; i<count; i++)
+	{
+		rc522_dma_tx[i] = ((addrs[i]<<1)&0x7E) | 0x80;
+	}
+	rc522_dma_tx[count] = 0x00;
+
+	return RC522_SPI_StartDMA(hrc, count + 1, vals, count, cb);
+}
+#endif
+
+/*
+ * Function Name: Write_MFRC522_Burst
+ * Description: Write len bytes to one register (normally FIFODataReg) inside a single CS assertion.
+ *              Per 8.1.2.2 every byte after the address byte goes to the same register.
+ * Input Parameters: addr - register address; data - bytes to write; len - number of bytes (<= MFRC522_FIFO_SIZE)
+ * Return value: None
+ */
+void Write_MFRC522_Burst(MFRC522_HandleTypeDef *hrc, uchar addr, uchar *data, uchar len)
+{
+	uchar tx[MFRC522_FIFO_SIZE + 1];
+	uchar i;
+
+	if (len > MFRC522_FIFO_SIZE)
+	{
+		len = MFRC522_FIFO_SIZE;
+	}
+
+#if MFRC522_USE_DMA
+	if ((len + 1) >= MFRC522_DMA_MIN_LEN)
+	{
+		// A timed out transfer is not repeated: part of it may have reached the FIFO
+		if (Write_MFRC522_BurstAsync(hrc, addr, data, len, NULL) == MI_OK)
+		{
+			RC522_SPI_WaitIdle();
+			return;
+		}
+	}
+#endif
+
+	tx[0] = (addr<<1)&0x7E;
+	for (i=0; i<len; i++)
+	{
+		tx[i+1] = data[i];
+	}
+
+	RC522_SPI_WaitIdle();
+	HAL_GPIO_WritePin(hrc->csPort,hrc->csPin,GPIO_PIN_RESET);
+	RC522_SPI_TransferBuf(hrc, tx, NULL, len + 1);
+	HAL_GPIO_WritePin(hrc->csPort,hrc->csPin,GPIO_PIN_SET);
+}
+
+/*
+ * Function Name: Read_MFRC522_Burst
+ * Description: Read len bytes from one register (normally FIFODataReg) inside a single CS assertion.
+ *              The address byte is repeated and terminated with 0x00 (8.1.2.1); data lags one byte behind.
+ * Input Parameters: addr - register address; data - receives the bytes; len - number of bytes (<= MFRC522_FIFO_SIZE)
+ * Return value: None
+ */
+void Read_MFRC522_Burst(MFRC522_HandleTypeDef *hrc, uchar addr, uchar *data, uchar len)
+{
+	uchar tx[MFRC522_FIFO_SIZE + 1];
+	uchar rx[MFRC522_FIFO_SIZE + 1];
+	uchar i;
+
+	if (len == 0)
+	{
+		return;
+	}
+	if (len > MFRC522_FIFO_SIZE)
+	{
+		len = MFRC522_FIFO_SIZE;
+	}
+
+#if MFRC522_USE_DMA
+	if ((len + 1) >= MFRC522_DMA_MIN_LEN)
+	{
+		// FIFO reads are destructive, so a timed out transfer is not repeated: the caller
+		// gets zeros and the frame fails its length or CRC check
+		if (Read_MFRC522_BurstAsync(hrc, addr, data, len, NULL) == MI_OK)
+		{
+			if (RC522_SPI_WaitIdle() != MI_OK)
+			{
+				memset(data, 0, len);
+			}
+			return;
+		}
+	}
+#endif
+
+	for (i=0; i<len; i++)
+	{
+		tx[i] = ((addr<<1)&0x7E) | 0x80;
+	}
+	tx[len] = 0x00;
+
+	RC522_SPI_WaitIdle();
+	HAL_GPIO_WritePin(hrc->csPort,hrc->csPin,GPIO_PIN_RESET);
+	RC522_SPI_TransferBuf(hrc, tx, rx, len + 1);
+	HAL_GPIO_WritePin(hrc->csPort,hrc->csPin,GPIO_PIN_SET);
+
+	for (i=0; i<len; i++)
+	{
+		data[i] = rx[i+1];
+	}
+}
+
+/*
+ * Function Name: Read_MFRC522_Multi
+ * Description: Read a sequence of different registers inside a single CS assertion
+ * Input Parameters: addrs - register addresses; vals - receives one value per address; count - number of registers
+ * Return value: None
+ */
+void Read_MFRC522_Multi(MFRC522_HandleTypeDef *hrc, const uchar *addrs, uchar *vals, uchar count)
+{
+	uchar tx[MFRC522_MULTI_MAX + 1];
+	uchar rx[MFRC522_MULTI_MAX + 1];
+	uchar i;
+
+	if (count == 0)
+	{
+		return;
+	}
+	if (count > MFRC522_MULTI_MAX)
+	{
+		count = MFRC522_MULTI_MAX;
+	}
+
+#if MFRC522_USE_DMA
+	if ((count + 1) >= MFRC522_DMA_MIN_LEN)
+	{
+		if (Read_MFRC522_MultiAsync(hrc, addrs, vals, count, NULL) == MI_OK)
+		{
+			if (RC522_SPI_WaitIdle() != MI_OK)
+			{
+				memset(vals, 0, count);		// no IRQ bits, no FIFO level: the command times out
+			}
+			return;
+		}
+	}
+#endif
 
-	return val;
+	for (i=0; i<count; i++)
+	{
+		tx[i] = ((addrs[i]<<1)&0x7E) | 0x80;
+	}
+	tx[count] = 0x00;
 
+	RC522_SPI_WaitIdle();
+	HAL_GPIO_WritePin(hrc->csPort,hrc->csPin,GPIO_PIN_RESET);
+	RC522_SPI_TransferBuf(hrc, tx, rx, count + 1);
+	HAL_GPIO_WritePin(hrc->csPort,hrc->csPin,GPIO_PIN_SET);
+
+	for (i=0; i<count; i++)
+	{
+		vals[i] = rx[i+1];
+	}
 }
 
 /*
  * Function Name: SetBitMask
- * Description: Set RC522 register bit
+ * Description: Set RC522 register bit. Depending on rc522_reg_policy this is a single write
+ *              (shadowed, interrupt and strobe registers) or a read-modify-write.
  * Input parameters: reg - register address; mask - set value
  * Return value: None
  */
-void SetBitMask(uchar reg, uchar mask)
+void SetBitMask(MFRC522_HandleTypeDef *hrc, uchar reg, uchar mask)
 {
     uchar tmp;
-    tmp = Read_MFRC522(reg);
-    Write_MFRC522(reg, tmp | mask);  // set bit mask
+
+    switch (rc522_reg_policy[reg & 0x3F])
+    {
+		case RC522_REG_CACHED:
+			tmp = Shadow_MFRC522(hrc, reg);
+			if ((tmp | mask) != tmp)
+			{
+				Write_MFRC522(hrc, reg, tmp | mask);
+			}
+			break;
+		case RC522_REG_IRQ:
+			Write_MFRC522(hrc, reg, 0x80 | mask);		// Set1/Set2=1: marked bits are set
+			break;
+		case RC522_REG_STROBE:
+			Write_MFRC522(hrc, reg, mask);				// the other bits are read-only
+			break;
+		default:
+			tmp = Read_MFRC522(hrc, reg);
+			Write_MFRC522(hrc, reg, tmp | mask);  // set bit mask
+			break;
+    }
 }
 
 /*
  * Function Name: ClearBitMask
- * Description: clear RC522 register bit
+ * Description: clear RC522 register bit, see SetBitMask for the access policy.
+ *              On CommIrqReg/DivIrqReg a mask containing 0x80 clears every request bit.
  * Input parameters: reg - register address; mask - clear bit value
  * Return value: None
 */
-void ClearBitMask(uchar reg, uchar mask)
+void ClearBitMask(MFRC522_HandleTypeDef *hrc, uchar reg, uchar mask)
 {
     uchar tmp;
-    tmp = Read_MFRC522(reg);
-    Write_MFRC522(reg, tmp & (~mask));  // clear bit mask
+
+    switch (rc522_reg_policy[reg & 0x3F])
+    {
+		case RC522_REG_CACHED:
+			tmp = Shadow_MFRC522(hrc, reg);
+			if ((tmp & (~mask)) != tmp)
+			{
+				Write_MFRC522(hrc, reg, tmp & (~mask));
+			}
+			break;
+		case RC522_REG_IRQ:
+			Write_MFRC522(hrc, reg, (mask & 0x80) ? 0x7F : (mask & 0x7F));	// Set1/Set2=0: marked bits are cleared
+			break;
+		case RC522_REG_STROBE:
+			break;									// write-only strobes clear themselves
+		default:
+			tmp = Read_MFRC522(hrc, reg);
+			Write_MFRC522(hrc, reg, tmp & (~mask));  // clear bit mask
+			break;
+    }
+}
+
+/*
+ * Function Name: Shadow_MFRC522
+ * Description: Current value of a host-owned register, from the shadow when it is valid.
+ *              With MFRC522_SHADOW_VERIFY the chip is read anyway and mismatches are counted.
+ * Input parameters: reg - register address, must have the RC522_REG_CACHED policy
+ * Returns: register value
+ */
+uchar Shadow_MFRC522(MFRC522_HandleTypeDef *hrc, uchar reg)
+{
+	reg &= 0x3F;
+	if (!(hrc->shadowValid & (1ULL << reg)))
+	{
+		hrc->shadow[reg] = Read_MFRC522(hrc, reg);
+		hrc->shadowValid |= (1ULL << reg);
+	}
+#if MFRC522_SHADOW_VERIFY
+	else
+	{
+		uchar hw = Read_MFRC522(hrc, reg);
+		if (hw != hrc->shadow[reg])
+		{
+			hrc->shadowMismatches++;
+			hrc->shadow[reg] = hw;
+		}
+	}
+#endif
+
+	return hrc->shadow[reg];
+}
+
+/*
+ * Function Name: MFRC522_ShadowMismatches
+ * Description: Number of times the shadow disagreed with the chip (MFRC522_SHADOW_VERIFY builds only)
+ * Input: None
+ * Return value: mismatch count
+ */
+uint32_t MFRC522_ShadowMismatches(MFRC522_HandleTypeDef *hrc)
+{
+	return hrc->shadowMismatches;
 }
 
 /*
@@ -99,11 +649,9 @@ void ClearBitMask(uchar reg, uchar mask)
  * Input: None
  * Return value: None
  */
-void AntennaOn(void)
+void AntennaOn(MFRC522_HandleTypeDef *hrc)
 {
-
-	Read_MFRC522(TxControlReg);
-	SetBitMask(TxControlReg, 0x03);
+	SetBitMask(hrc, TxControlReg, 0x03);
 }
 
 /*
@@ -112,9 +660,9 @@ void AntennaOn(void)
   * Input: None
   * Return value: None
  */
-void AntennaOff(void)
+void AntennaOff(MFRC522_HandleTypeDef *hrc)
 {
-	ClearBitMask(TxControlReg, 0x03);
+	ClearBitMask(hrc, TxControlReg, 0x03);
 }
 
 /*
@@ -123,53 +671,140 @@ void AntennaOff(void)
  * Input: None
  * Return value: None
  */
-void MFRC522_Reset(void)
+void MFRC522_Reset(MFRC522_HandleTypeDef *hrc)
 {
-    Write_MFRC522(CommandReg, PCD_RESETPHASE);
+    Write_MFRC522(hrc, CommandReg, PCD_RESETPHASE);
+    hrc->shadowValid = 0;		// every register is back at its reset value
 }
 
 /*
  * Function Name: MFRC522_Init
- * Description: Initialize RC522
- * Input: None
+ * Description: Initialize RC522 and the driver state of its handle
+ * Input: hrc - reader handle with the wiring fields filled in
  * Return value: None
 */
-void MFRC522_Init(void)
+void MFRC522_Init(MFRC522_HandleTypeDef *hrc)
 {
-	HAL_GPIO_WritePin(MFRC522_CS_PORT,MFRC522_CS_PIN,GPIO_PIN_SET);
-	HAL_GPIO_WritePin(MFRC522_RST_PORT,MFRC522_RST_PIN,GPIO_PIN_SET);
-	MFRC522_Reset();
-
-	//Timer: TPrescaler*TreloadVal/6.78MHz = 24ms
-	Write_MFRC522(TModeReg, 0x8D);		//Tauto=1; f(Timer) = 6.78MHz/TPreScaler
-	Write_MFRC522(TPrescalerReg, 0x3E);	//TModeReg[3..0] + TPrescalerReg
-	Write_MFRC522(TReloadRegL, 30);
-	Write_MFRC522(TReloadRegH, 0);
-
-	Write_MFRC522(TxAutoReg, 0x40);		// force 100% ASK modulation
-	Write_MFRC522(ModeReg, 0x3D);		// CRC Initial value 0x6363
+	hrc->shadowMismatches = 0;
+	hrc->irqMode = 0;
+	hrc->irqPending = 0;
+	hrc->txn.state = MFRC522_TXN_IDLE;
+	hrc->scanState = MFRC522_SCAN_IDLE;
+	hrc->presenceState = MFRC522_PRESENCE_ABSENT;
+	hrc->presenceProbing = 0;
+	hrc->presenceMisses = 0;
+	hrc->authSector = MFRC522_AUTH_NONE;
+
+	HAL_GPIO_WritePin(hrc->csPort,hrc->csPin,GPIO_PIN_SET);
+	HAL_GPIO_WritePin(hrc->rstPort,hrc->rstPin,GPIO_PIN_SET);
+	MFRC522_Reset(hrc);
+
+	//Timer: f(Timer) = 13.56MHz/(2*TPrescaler+1), TPrescaler 0xD3E gives one tick per 0.5ms
+	Write_MFRC522(hrc, TModeReg, 0x8D);		//Tauto=1; f(Timer) = 6.78MHz/TPreScaler
+	Write_MFRC522(hrc, TPrescalerReg, 0x3E);	//TModeReg[3..0] + TPrescalerReg
+	Write_MFRC522(hrc, TReloadRegH, 0);		//every timeout class fits in TReloadRegL
+	MFRC522_SetTimeout(hrc, MFRC522_TMO_RW);
+
+	Write_MFRC522(hrc, TxAutoReg, 0x40);		// force 100% ASK modulation
+	Write_MFRC522(hrc, ModeReg, 0x3D);		// CRC Initial value 0x6363
+
+	AntennaOn(hrc);
+}
 
-	AntennaOn();
+/*
+ * Function Name: MFRC522_SetIrqMode
+ * Description: Select how MFRC522_ToCard waits for completion. With enable=1 the chip drives
+ *              MFRC522_IRQ_PIN (push-pull, active low) and the CPU sleeps until MFRC522_IrqNotify
+ *              is called; with enable=0 CommIrqReg is polled over SPI.
+ * Input Parameters: enable - 1 for IRQ pin mode, 0 for polling
+ * Return value: None
+ */
+void MFRC522_SetIrqMode(MFRC522_HandleTypeDef *hrc, uchar enable)
+{
+	Write_MFRC522(hrc, DivlEnReg, enable ? 0x80 : 0x00);	// IRQPushPull
+	hrc->irqPending = 0;
+	hrc->irqMode = enable ? 1 : 0;
 }
 
 /*
- * Function Name: MFRC522_ToCard
- * Description: RC522 and ISO14443 card communication
- * Input Parameters: command - MF522 command word,
- *			 sendData--RC522 sent to the card by the data
- *			 sendLen--Length of data sent
- *			 backData--Received the card returns data,
- *			 backLen--Return data bit length
- * Return value: the successful return MI_OK
+ * Function Name: MFRC522_IrqNotify
+ * Description: Signal that the MFRC522 IRQ line was asserted. Call from the EXTI callback.
+ * Input: None
+ * Return value: None
  */
-uchar MFRC522_ToCard(uchar command, uchar *sendData, uchar sendLen, uchar *backData, uint *backLen)
+void MFRC522_IrqNotify(MFRC522_HandleTypeDef *hrc)
 {
-    uchar status = MI_ERR;
-    uchar irqEn = 0x00;
-    uchar waitIRq = 0x00;
-    uchar lastBits;
-    uchar n;
-    uint i;
+	hrc->irqPending = 1;
+}
+
+/*
+ * Function Name: MFRC522_SetTimeout
+ * Description: Select the receive timeout for the next card exchange. TReloadRegL is only
+ *              written when the class differs from the one already programmed (checked
+ *              against the shadow copy, so no SPI read is needed).
+ * Input parameters: tmoClass - MFRC522_TMO_REQA, _SELECT, _AUTH, _RW or _NAK
+ * Return value: none
+ */
+void MFRC522_SetTimeout(MFRC522_HandleTypeDef *hrc, uchar tmoClass)
+{
+	static const uchar reload[MFRC522_TMO_COUNT] = {
+		[MFRC522_TMO_REQA]   = MFRC522_TMO_REQA_TICKS,
+		[MFRC522_TMO_SELECT] = MFRC522_TMO_SELECT_TICKS,
+		[MFRC522_TMO_AUTH]   = MFRC522_TMO_AUTH_TICKS,
+		[MFRC522_TMO_RW]     = MFRC522_TMO_RW_TICKS,
+		[MFRC522_TMO_NAK]    = MFRC522_TMO_NAK_TICKS,
+	};
+
+	if (tmoClass >= MFRC522_TMO_COUNT)
+	{
+		tmoClass = MFRC522_TMO_RW;
+	}
+	if (Shadow_MFRC522(hrc, TReloadRegL) != reload[tmoClass])
+	{
+		Write_MFRC522(hrc, TReloadRegL, reload[tmoClass]);
+	}
+}
+
+/*
+ * Function Name: MFRC522_TimeoutClass
+ * Description: Map an exchange to its timeout class from the MFRC522 command and the PICC command byte
+ * Input parameters: command - PCD_AUTHENT or PCD_TRANSCEIVE; sendData - frame, first byte is the PICC command
+ * Return value: MFRC522_TMO_* class
+ */
+static uchar MFRC522_TimeoutClass(uchar command, uchar *sendData)
+{
+	if (command == PCD_AUTHENT)
+	{
+		return MFRC522_TMO_AUTH;
+	}
+
+	switch (sendData[0])
+	{
+		case PICC_REQIDL:
+		case PICC_REQALL:
+		case PICC_HALT:
+			return MFRC522_TMO_REQA;
+		case PICC_ANTICOLL:
+		case PICC_ANTICOLL_CL2:
+		case PICC_ANTICOLL_CL3:
+		case PICC_GET_VERSION:			// answered at once; an original Ultralight stays silent
+			return MFRC522_TMO_SELECT;
+		default:
+			return MFRC522_TMO_RW;
+	}
+}
+
+/*
+ * Function Name: MFRC522_ToCardStartTmo
+ * Description: MFRC522_ToCardStart with the timeout class given by the caller, for frames
+ *              whose first byte is not a PICC command (the operand of a value operation)
+ * Input Parameters: see MFRC522_ToCardStart; tmoClass - MFRC522_TMO_* class
+ * Return value: the successful return MI_OK
+ */
+static uchar MFRC522_ToCardStartTmo(MFRC522_HandleTypeDef *hrc, uchar command, uchar *sendData, uchar sendLen, uchar tmoClass)
+{
+    uchar irqEn = 0x00;
+    uchar waitIRq = 0x00;
 
     switch (command)
     {
@@ -189,344 +824,1748 @@ uchar MFRC522_ToCard(uchar command, uchar *sendData, uchar sendLen, uchar *backD
 			break;
     }
 
-    Write_MFRC522(CommIEnReg, irqEn|0x80);	// Interrupt request
-    ClearBitMask(CommIrqReg, 0x80);			// Clear all interrupt request bit
-    SetBitMask(FIFOLevelReg, 0x80);			// FlushBuffer=1, FIFO Initialization
-
-	Write_MFRC522(CommandReg, PCD_IDLE);	// NO action; Cancel the current command
+    // Before StartSend: with TAuto the timer starts counting at the end of transmission
+    MFRC522_SetTimeout(hrc, tmoClass);
 
-	// Writing data to the FIFO
-    for (i=0; i<sendLen; i++)
+    if (hrc->irqMode)
     {
-		Write_MFRC522(FIFODataReg, sendData[i]);
+		// Only completion (and the timer) may pull the IRQ line, otherwise TxIRq would wake us early
+		Write_MFRC522(hrc, CommIEnReg, waitIRq|0x01|0x80);
 	}
+    else
+    {
+		Write_MFRC522(hrc, CommIEnReg, irqEn|0x80);	// Interrupt request
+	}
+    ClearBitMask(hrc, CommIrqReg, 0x80);			// Clear all interrupt request bit
+    hrc->irqPending = 0;					// IRQ line is released now, arm for the next edge
+    SetBitMask(hrc, FIFOLevelReg, 0x80);			// FlushBuffer=1, FIFO Initialization
+
+	Write_MFRC522(hrc, CommandReg, PCD_IDLE);	// NO action; Cancel the current command
+
+	// Writing data to the FIFO, one SPI transaction for the whole frame
+	Write_MFRC522_Burst(hrc, FIFODataReg, sendData, sendLen);
 
     // Execute the command
-	Write_MFRC522(CommandReg, command);
+	Write_MFRC522(hrc, CommandReg, command);
     if (command == PCD_TRANSCEIVE)
     {
-		SetBitMask(BitFramingReg, 0x80);		// StartSend=1,transmission of data starts
+		SetBitMask(hrc, BitFramingReg, 0x80);		// StartSend=1,transmission of data starts
+	}
+
+    hrc->txn.command = command;
+    hrc->txn.irqEn = irqEn;
+    hrc->txn.waitIRq = waitIRq;
+    hrc->txn.rxAlign = (Shadow_MFRC522(hrc, BitFramingReg) >> 4) & 0x07;
+    hrc->txn.startTick = HAL_GetTick();
+    hrc->txn.startCycles = phase_timing_now();
+    hrc->txn.state = MFRC522_TXN_BUSY;
+
+    return MI_OK;
+}
+
+/*
+ * Function Name: MFRC522_ToCardStart
+ * Description: Load the FIFO and start an RC522/ISO14443 exchange without waiting for the card.
+ *              Finish it with MFRC522_ToCardPoll. Only one exchange can be in flight.
+ * Input Parameters: command - MF522 command word,
+ *			 sendData--RC522 sent to the card by the data
+ *			 sendLen--Length of data sent
+ * Return value: the successful return MI_OK
+ */
+uchar MFRC522_ToCardStart(MFRC522_HandleTypeDef *hrc, uchar command, uchar *sendData, uchar sendLen)
+{
+	return MFRC522_ToCardStartTmo(hrc, command, sendData, sendLen, MFRC522_TimeoutClass(command, sendData));
+}
+
+/*
+ * Function Name: MFRC522_ToCardRestart
+ * Description: Send the next frame of a Transceive that has just finished. The MFRC522 stays in
+ *              Transceive after the answer, so only the IRQ flags, the FIFO and StartSend are
+ *              touched: 4 SPI transactions instead of the 7 of MFRC522_ToCardStart.
+ *              Falls back to MFRC522_ToCardStart if the last exchange was not a finished Transceive.
+ * Input Parameters: sendData, sendLen - as for MFRC522_ToCardStart
+ * Return value: the successful return MI_OK
+ */
+static uchar MFRC522_ToCardRestart(MFRC522_HandleTypeDef *hrc, uchar *sendData, uchar sendLen)
+{
+    if ((hrc->txn.state != MFRC522_TXN_IDLE) || (hrc->txn.command != PCD_TRANSCEIVE))
+    {
+		return MFRC522_ToCardStart(hrc, PCD_TRANSCEIVE, sendData, sendLen);
+	}
+
+    MFRC522_SetTimeout(hrc, MFRC522_TimeoutClass(PCD_TRANSCEIVE, sendData));
+    ClearBitMask(hrc, CommIrqReg, 0x80);			// CommIEnReg is unchanged since the last Start
+    hrc->irqPending = 0;
+    SetBitMask(hrc, FIFOLevelReg, 0x80);			// drop what was left of the previous answer
+	Write_MFRC522_Burst(hrc, FIFODataReg, sendData, sendLen);
+	SetBitMask(hrc, BitFramingReg, 0x80);			// StartSend=1
+
+    hrc->txn.rxAlign = (Shadow_MFRC522(hrc, BitFramingReg) >> 4) & 0x07;
+    hrc->txn.startTick = HAL_GetTick();
+    hrc->txn.startCycles = phase_timing_now();
+    hrc->txn.state = MFRC522_TXN_BUSY;
+
+    return MI_OK;
+}
+
+/*
+ * Function Name: MFRC522_ToCardPoll
+ * Description: Check the exchange started by MFRC522_ToCardStart. Costs one CommIrqReg read in
+ *              polled mode and no SPI traffic at all in IRQ mode until the IRQ line fires.
+ * Input Parameters: backData--Received the card returns data,
+ *			 backLen--Return data bit length
+ * Return value: MI_BUSY while the card has not answered, otherwise the final status (MI_OK on success).
+ *               MI_COLLISION means a bit collision was the only error; the bits received up to
+ *               it are in backData and CollReg tells where it happened.
+ */
+uchar MFRC522_ToCardPoll(MFRC522_HandleTypeDef *hrc, uchar *backData, uint *backLen)
+{
+    uchar status = MI_ERR;
+    uchar lastBits;
+    uchar n;
+    uchar done;
+    uchar first;
+    uchar mask;
+    static const uchar statusRegs[3] = { ErrorReg, FIFOLevelReg, ControlReg };
+    uchar statusVals[3];
+
+    if (hrc->txn.state != MFRC522_TXN_BUSY)
+    {
+		return MI_ERR;
+	}
+
+    //CommIrqReg[7..0]
+    //Set1 TxIRq RxIRq IdleIRq HiAlerIRq LoAlertIRq ErrIRq TimerIRq
+    if (hrc->irqMode && !hrc->irqPending)
+    {
+		n = 0;
+	}
+    else
+    {
+		n = Read_MFRC522(hrc, CommIrqReg);
+	}
+    done = (n & (hrc->txn.waitIRq|0x01)) ? 1 : 0;
+
+    if (!done && ((HAL_GetTick() - hrc->txn.startTick) < MFRC522_TXN_TIMEOUT_MS))
+    {
+		return MI_BUSY;
+	}
+
+    ClearBitMask(hrc, BitFramingReg, 0x80);			//StartSend=0
+    hrc->txn.state = MFRC522_TXN_IDLE;
+
+    if (done)
+    {
+        // ErrorReg, FIFOLevelReg and ControlReg in one transaction
+        Read_MFRC522_Multi(hrc, statusRegs, statusVals, 3);
+
+        if(!(statusVals[0] & 0x13))	//BufferOvfl CRCErr ProtecolErr
+        {
+            status = (statusVals[0] & 0x08) ? MI_COLLISION : MI_OK;	//CollErr
+            if (n & hrc->txn.irqEn & 0x01)
+            {
+				status = MI_NOTAGERR;
+			}
+
+            if (hrc->txn.command == PCD_TRANSCEIVE)
+            {
+               	n = statusVals[1];
+              	lastBits = statusVals[2] & 0x07;
+                if (lastBits)
+                {
+					*backLen = (n-1)*8 + lastBits;
+				}
+                else
+                {
+					*backLen = n*8;
+				}
+
+                if (n == 0)
+                {
+					n = 1;
+				}
+                if (n > MAX_LEN)
+                {
+					n = MAX_LEN;
+				}
+
+                // Reading the received data in FIFO, one SPI transaction
+                first = backData[0];
+                Read_MFRC522_Burst(hrc, FIFODataReg, backData, n);
+                if (hrc->txn.rxAlign)
+                {
+					// RxAlign: only bits rxAlign..7 of the first byte were received, keep the rest
+					mask = (0xFF << hrc->txn.rxAlign) & 0xFF;
+					backData[0] = (first & ~mask) | (backData[0] & mask);
+				}
+            }
+        }
+        else
+        {
+			status = MI_ERR;
+		}
+
+    }
+
+    //SetBitMask(hrc, ControlReg,0x80);           //timer stops
+    //Write_MFRC522(hrc, CommandReg, PCD_IDLE);
+
+    return status;
+}
+
+/*
+ * Function Name: MFRC522_ToCard
+ * Description: RC522 and ISO14443 card communication, blocking until the card answers or times out
+ * Input Parameters: command - MF522 command word,
+ *			 sendData--RC522 sent to the card by the data
+ *			 sendLen--Length of data sent
+ *			 backData--Received the card returns data,
+ *			 backLen--Return data bit length
+ * Return value: the successful return MI_OK
+ */
+uchar MFRC522_ToCard(MFRC522_HandleTypeDef *hrc, uchar command, uchar *sendData, uchar sendLen, uchar *backData, uint *backLen)
+{
+    uchar status;
+
+    MFRC522_ToCardStart(hrc, command, sendData, sendLen);
+    while ((status = MFRC522_ToCardPoll(hrc, backData, backLen)) == MI_BUSY)
+    {
+		if (hrc->irqMode)
+		{
+			__WFI();	// EXTI (or SysTick for the timeout) wakes us
+		}
+	}
+
+    return status;
+}
+
+/*
+ * Function Name: MFRC522_RequestStart
+ * Description: Start a REQA/WUPA without waiting for the answer
+ * Input parameters: reqMode - find cards way
+ * Return value: the successful return MI_OK
+ */
+uchar MFRC522_RequestStart(MFRC522_HandleTypeDef *hrc, uchar reqMode)
+{
+	MFRC522_StopCrypto1(hrc);				// REQA/WUPA go out in plain text
+	Write_MFRC522(hrc, BitFramingReg, 0x07);		//TxLastBists = BitFramingReg[2..0]
+
+	hrc->txn.buf[0] = reqMode;
+	return MFRC522_ToCardStart(hrc, PCD_TRANSCEIVE, hrc->txn.buf, 1);
+}
+
+/*
+ * Function Name: MFRC522_RequestPoll
+ * Description: Collect the answer to MFRC522_RequestStart
+ * Input parameters: TagType - Return Card Type (see MFRC522_Request)
+ * Return value: MI_BUSY while waiting, the successful return MI_OK
+ */
+uchar MFRC522_RequestPoll(MFRC522_HandleTypeDef *hrc, uchar *TagType)
+{
+	uchar status;
+	uint backBits;			 // The received data bits
+
+	status = MFRC522_ToCardPoll(hrc, TagType, &backBits);
+	if (status == MI_BUSY)
+	{
+		return status;
+	}
+
+	if (status == MI_COLLISION)
+	{
+		phase_timing_record(PT_REQUEST, hrc->txn.startCycles);
+		return status;			// several cards with different ATQAs answered
+	}
+	if ((status != MI_OK) || (backBits != 0x10))
+	{
+		status = MI_ERR;
+	}
+	else
+	{
+		phase_timing_record(PT_REQUEST, hrc->txn.startCycles);
+	}
+
+	return status;
+}
+
+/*
+ * Function Name: MFRC522_Request
+ * Description: Find cards, read the card type number
+ * Input parameters: reqMode - find cards way
+ *   TagType - Return Card Type
+ *    0x4400 = Mifare_UltraLight
+ *    0x0400 = Mifare_One(S50)
+ *    0x0200 = Mifare_One(S70)
+ *    0x0800 = Mifare_Pro(X)
+ *    0x4403 = Mifare_DESFire
+ * Return value: the successful return MI_OK
+ */
+uchar MFRC522_Request(MFRC522_HandleTypeDef *hrc, uchar reqMode, uchar *TagType)
+{
+	uchar status;
+
+	MFRC522_RequestStart(hrc, reqMode);
+	while ((status = MFRC522_RequestPoll(hrc, TagType)) == MI_BUSY)
+	{
+		if (hrc->irqMode)
+		{
+			__WFI();
+		}
+	}
+
+	return status;
+}
+
+/*
+ * Function Name: MFRC522_AnticollStart
+ * Description: Start cascade level 1 anti-collision without waiting for the answer
+ * Input: None
+ * Return value: the successful return MI_OK
+ */
+uchar MFRC522_AnticollStart(MFRC522_HandleTypeDef *hrc)
+{
+	Write_MFRC522(hrc, BitFramingReg, 0x00);		//TxLastBists = BitFramingReg[2..0]
+
+    hrc->txn.buf[0] = PICC_ANTICOLL;
+    hrc->txn.buf[1] = 0x20;
+    return MFRC522_ToCardStart(hrc, PCD_TRANSCEIVE, hrc->txn.buf, 2);
+}
+
+/*
+ * Function Name: MFRC522_AnticollPoll
+ * Description: Collect the serial number requested by MFRC522_AnticollStart
+ * Input parameters: serNum - returns 4 bytes card serial number, the first 5 bytes for the checksum byte
+ * Return value: MI_BUSY while waiting, the successful return MI_OK
+ */
+uchar MFRC522_AnticollPoll(MFRC522_HandleTypeDef *hrc, uchar *serNum)
+{
+    uchar status;
+    uchar i;
+	uchar serNumCheck=0;
+    uint unLen;
+
+    status = MFRC522_ToCardPoll(hrc, serNum, &unLen);
+
+    if (status == MI_OK)
+	{
+    	 //Check card serial number
+		for (i=0; i<4; i++)
+		{
+		 	serNumCheck ^= serNum[i];
+		}
+		if (serNumCheck != serNum[i])
+		{
+			status = MI_ERR;
+		}
+		else
+		{
+			phase_timing_record(PT_ANTICOLL, hrc->txn.startCycles);
+		}
+    }
+
+    return status;
+}
+
+/*
+ * Function Name: MFRC522_Anticoll
+ * Description: Anti-collision detection, reading selected card serial number card
+ * Input parameters: serNum - returns 4 bytes card serial number, the first 5 bytes for the checksum byte
+ * Return value: the successful return MI_OK
+ */
+uchar MFRC522_Anticoll(MFRC522_HandleTypeDef *hrc, uchar *serNum)
+{
+    uchar status;
+
+    MFRC522_AnticollStart(hrc);
+    while ((status = MFRC522_AnticollPoll(hrc, serNum)) == MI_BUSY)
+    {
+		if (hrc->irqMode)
+		{
+			__WFI();
+		}
 	}
 
-    // Waiting to receive data to complete
-	i = 2000;	// i according to the clock frequency adjustment, the operator M1 card maximum waiting time 25ms
-    do
-    {
-		//CommIrqReg[7..0]
-		//Set1 TxIRq RxIRq IdleIRq HiAlerIRq LoAlertIRq ErrIRq TimerIRq
-        n = Read_MFRC522(CommIrqReg);
-        i--;
-    }
-    while ((i!=0) && !(n&0x01) && !(n&waitIRq));
+    return status;
+}
+
+/*
+ * Function Name: CalulateCRC_Chip
+ * Description: CRC calculation with MF522 (coprocessor round trip over SPI)
+ * Input parameters: pIndata - To read the CRC data, len - the data length, pOutData - CRC calculation results
+ * Return value: None
+ */
+void CalulateCRC_Chip(MFRC522_HandleTypeDef *hrc, uchar *pIndata, uchar len, uchar *pOutData)
+{
+    uchar i, n;
+    static const uchar crcRegs[2] = { CRCResultRegL, CRCResultRegH };
+
+    ClearBitMask(hrc, DivIrqReg, 0x04);			//CRCIrq = 0
+    SetBitMask(hrc, FIFOLevelReg, 0x80);			//Clear the FIFO pointer
+
+    //Writing data to the FIFO
+    Write_MFRC522_Burst(hrc, FIFODataReg, pIndata, len);
+    Write_MFRC522(hrc, CommandReg, PCD_CALCCRC);
+
+    //Wait CRC calculation is complete
+    i = 0xFF;
+    do
+    {
+        n = Read_MFRC522(hrc, DivIrqReg);
+        i--;
+    }
+    while ((i!=0) && !(n&0x04));			//CRCIrq = 1
+
+    //Read CRC calculation result
+    Read_MFRC522_Multi(hrc, crcRegs, pOutData, 2);
+}
+
+/*
+ * Function Name: CalulateCRC_Host
+ * Description: CRC_A calculation on the MCU, one table lookup per byte, no SPI traffic
+ * Input parameters: pIndata - To read the CRC data, len - the data length, pOutData - CRC calculation results
+ * Return value: None
+ */
+void CalulateCRC_Host(uchar *pIndata, uchar len, uchar *pOutData)
+{
+    uint16_t crc = crca_update(0x6363, pIndata, len);	// same preset as ModeReg CRCPreset=01
+
+    pOutData[0] = crc & 0xFF;		// CRCResultRegL
+    pOutData[1] = crc >> 8;			// CRCResultRegH
+}
+
+/*
+ * Function Name: CalulateCRC
+ * Description: CRC_A of a frame, on the MCU unless MFRC522_CRC_ON_CHIP selects the coprocessor
+ * Input parameters: pIndata - To read the CRC data, len - the data length, pOutData - CRC calculation results
+ * Return value: None
+ */
+void CalulateCRC(MFRC522_HandleTypeDef *hrc, uchar *pIndata, uchar len, uchar *pOutData)
+{
+#if MFRC522_CRC_ON_CHIP
+	CalulateCRC_Chip(hrc, pIndata, len, pOutData);
+#else
+	CalulateCRC_Host(pIndata, len, pOutData);
+#endif
+}
+
+/*
+ * Function Name: MFRC522_SelectTagStart
+ * Description: Start selecting a card without waiting for the SAK
+ * Input parameters: serNum - Incoming card serial number
+ * Return value: the successful return MI_OK
+ */
+uchar MFRC522_SelectTagStart(MFRC522_HandleTypeDef *hrc, uchar *serNum)
+{
+	uchar i;
+
+	MFRC522_StopCrypto1(hrc);
+
+    hrc->txn.buf[0] = PICC_SElECTTAG;
+    hrc->txn.buf[1] = 0x70;
+    for (i=0; i<5; i++)
+    {
+    	hrc->txn.buf[i+2] = *(serNum+i);
+    }
+	CalulateCRC(hrc, hrc->txn.buf, 7, &hrc->txn.buf[7]);
+    return MFRC522_ToCardStart(hrc, PCD_TRANSCEIVE, hrc->txn.buf, 9);
+}
+
+/*
+ * Function Name: MFRC522_SelectTagPoll
+ * Description: Collect the SAK for MFRC522_SelectTagStart
+ * Input parameters: size - receives the card capacity, 0 on failure
+ * Return value: MI_BUSY while waiting, the successful return MI_OK
+ */
+uchar MFRC522_SelectTagPoll(MFRC522_HandleTypeDef *hrc, uchar *size)
+{
+	uchar status;
+	uint recvBits;
+	uchar buffer[MAX_LEN];
+
+    status = MFRC522_ToCardPoll(hrc, buffer, &recvBits);
+    if (status == MI_BUSY)
+    {
+		return status;
+	}
+
+    if ((status == MI_OK) && (recvBits == 0x18))
+    {
+		*size = buffer[0];
+	}
+    else
+    {
+		*size = 0;
+		status = MI_ERR;
+	}
+
+    return status;
+}
+
+/*
+ * Function Name: MFRC522_SelectTag
+ * Description: election card, read the card memory capacity
+ * Input parameters: serNum - Incoming card serial number
+ * Return value: the successful return of card capacity
+ */
+uchar MFRC522_SelectTag(MFRC522_HandleTypeDef *hrc, uchar *serNum)
+{
+	uchar size;
+
+	MFRC522_SelectTagStart(hrc, serNum);
+	while (MFRC522_SelectTagPoll(hrc, &size) == MI_BUSY)
+	{
+		if (hrc->irqMode)
+		{
+			__WFI();
+		}
+	}
+
+    return size;
+}
+
+/*
+ * Function Name: MFRC522_SectorOf
+ * Description: MIFARE Classic sector holding a block, 4 blocks per sector up to block 127, 16 above
+ * Input parameters: BlockAddr - block address
+ * Return value: sector number
+ */
+static uchar MFRC522_SectorOf(uchar BlockAddr)
+{
+	return (BlockAddr < 128) ? (BlockAddr / 4) : (32 + (BlockAddr - 128) / 16);
+}
+
+/*
+ * Function Name: MFRC522_StopCrypto1
+ * Description: End the MIFARE Classic session: clear MFCrypto1On so the next frames go out in
+ *              plain text and forget the cached authentication. No SPI traffic without a session.
+ * Input: None
+ * Return value: None
+ */
+void MFRC522_StopCrypto1(MFRC522_HandleTypeDef *hrc)
+{
+	if (hrc->authSector != MFRC522_AUTH_NONE)
+	{
+		ClearBitMask(hrc, Status2Reg, 0x08);		//MFCrypto1On=0
+		hrc->authSector = MFRC522_AUTH_NONE;
+	}
+}
+
+/*
+ * Function Name: MFRC522_AuthStart
+ * Description: Start card password verification without waiting for it to finish
+ * Input parameters: see MFRC522_Auth
+ * Return value: the successful return MI_OK
+ */
+uchar MFRC522_AuthStart(MFRC522_HandleTypeDef *hrc, uchar authMode, uchar BlockAddr, uchar *Sectorkey, uchar *serNum)
+{
+    uchar i;
+
+    hrc->authSector = MFRC522_AUTH_NONE;		// the card drops the old session whatever the outcome
+
+	//Verify the command block address + sector + password + card serial number
+    hrc->txn.buf[0] = authMode;
+    hrc->txn.buf[1] = BlockAddr;
+    for (i=0; i<6; i++)
+    {
+		hrc->txn.buf[i+2] = *(Sectorkey+i);
+	}
+    for (i=0; i<4; i++)
+    {
+		hrc->txn.buf[i+8] = *(serNum+i);
+	}
+    return MFRC522_ToCardStart(hrc, PCD_AUTHENT, hrc->txn.buf, 12);
+}
+
+/*
+ * Function Name: MFRC522_AuthPoll
+ * Description: Collect the result of MFRC522_AuthStart
+ * Input: None
+ * Return value: MI_BUSY while waiting, the successful return MI_OK
+ */
+uchar MFRC522_AuthPoll(MFRC522_HandleTypeDef *hrc)
+{
+    uchar status;
+    uint recvBits;
+    uchar buff[MAX_LEN];
+
+    status = MFRC522_ToCardPoll(hrc, buff, &recvBits);
+    if (status == MI_BUSY)
+    {
+		return status;
+	}
+
+    if ((status != MI_OK) || (!(Read_MFRC522(hrc, Status2Reg) & 0x08)))
+    {
+		status = MI_ERR;
+	}
+    else
+    {
+		// Remember the session for MFRC522_AuthCached, the frame is still in txn.buf
+		hrc->authMode = hrc->txn.buf[0];
+		hrc->authSector = MFRC522_SectorOf(hrc->txn.buf[1]);
+		memcpy(hrc->authKey, &hrc->txn.buf[2], 6);
+		memcpy(hrc->authUid, &hrc->txn.buf[8], 4);
+	}
+
+    return status;
+}
+
+/*
+ * Function Name: MFRC522_Auth
+ * Description: Verify card password
+ * Input parameters: authMode - Password Authentication Mode
+                 0x60 = A key authentication
+                 0x61 = Authentication Key B
+             BlockAddr--Block address
+             Sectorkey--Sector password
+             serNum--Card serial number, 4-byte
+ * Return value: the successful return MI_OK
+ */
+uchar MFRC522_Auth(MFRC522_HandleTypeDef *hrc, uchar authMode, uchar BlockAddr, uchar *Sectorkey, uchar *serNum)
+{
+    uchar status;
+
+    MFRC522_AuthStart(hrc, authMode, BlockAddr, Sectorkey, serNum);
+    while ((status = MFRC522_AuthPoll(hrc)) == MI_BUSY)
+    {
+		if (hrc->irqMode)
+		{
+			__WFI();
+		}
+	}
+
+    return status;
+}
+
+/*
+ * Function Name: MFRC522_AuthCached
+ * Description: MFRC522_Auth, skipped when Crypto1 already runs for the same card, sector, key and
+ *              mode. The session ends with MFRC522_StopCrypto1, a REQA/WUPA/SELECT, HALT or a failed exchange.
+ * Input parameters: see MFRC522_Auth
+ * Return value: the successful return MI_OK
+ */
+uchar MFRC522_AuthCached(MFRC522_HandleTypeDef *hrc, uchar authMode, uchar BlockAddr, uchar *Sectorkey, uchar *serNum)
+{
+	if ((hrc->authSector == MFRC522_SectorOf(BlockAddr)) && (hrc->authMode == authMode) &&
+		(memcmp(hrc->authKey, Sectorkey, 6) == 0) && (memcmp(hrc->authUid, serNum, 4) == 0))
+	{
+		return MI_OK;
+	}
+
+	return MFRC522_Auth(hrc, authMode, BlockAddr, Sectorkey, serNum);
+}
+
+/*
+ * Function Name: MFRC522_ReadStart
+ * Description: Start reading a block without waiting for the data
+ * Input parameters: blockAddr - block address
+ * Return value: the successful return MI_OK
+ */
+uchar MFRC522_ReadStart(MFRC522_HandleTypeDef *hrc, uchar blockAddr)
+{
+    hrc->txn.buf[0] = PICC_READ;
+    hrc->txn.buf[1] = blockAddr;
+    CalulateCRC(hrc, hrc->txn.buf, 2, &hrc->txn.buf[2]);
+    return MFRC522_ToCardStart(hrc, PCD_TRANSCEIVE, hrc->txn.buf, 4);
+}
+
+/*
+ * Function Name: MFRC522_ReadPoll
+ * Description: Collect the block requested by MFRC522_ReadStart
+ * Input parameters: recvData - read block data
+ * Return value: MI_BUSY while waiting, the successful return MI_OK
+ */
+uchar MFRC522_ReadPoll(MFRC522_HandleTypeDef *hrc, uchar *recvData)
+{
+    uchar status;
+    uint unLen;
+
+    status = MFRC522_ToCardPoll(hrc, recvData, &unLen);
+    if (status == MI_BUSY)
+    {
+		return status;
+	}
+
+    if ((status != MI_OK) || (unLen != 0x90))
+    {
+        status = MI_ERR;
+    }
+
+    return status;
+}
+
+/*
+ * Function Name: MFRC522_Read
+ * Description: Read block data
+ * Input parameters: blockAddr - block address; recvData - read block data
+ * Return value: the successful return MI_OK
+ */
+uchar MFRC522_Read(MFRC522_HandleTypeDef *hrc, uchar blockAddr, uchar *recvData)
+{
+    uchar status;
+
+    MFRC522_ReadStart(hrc, blockAddr);
+    while ((status = MFRC522_ReadPoll(hrc, recvData)) == MI_BUSY)
+    {
+		if (hrc->irqMode)
+		{
+			__WFI();
+		}
+	}
+
+    return status;
+}
+
+/*
+ * Function Name: MFRC522_ReadSector
+ * Description: Read every data block of a MIFARE Classic sector in one call. Authenticates once
+ *              (or not at all, see MFRC522_AuthCached), builds all READ frames up front from a
+ *              precomputed CRC state, then sends them back to back keeping the Transceive running,
+ *              each 16-byte answer drained from the FIFO in one burst. The trailer is not read.
+ * Input parameters: authMode - PICC_AUTHENT1A or PICC_AUTHENT1B
+ *             sector - 0-15 (1K), 0-39 (4K)
+ *             Sectorkey - 6-byte key; serNum - last 4 UID bytes (what MFRC522_Auth takes)
+ *             recvData - 48 bytes for sectors 0-31, MFRC522_SECTOR_MAX_DATA (240) above
+ * Return value: the successful return MI_OK. On error the session is dropped and the card
+ *               has to be selected again.
+ */
+uchar MFRC522_ReadSector(MFRC522_HandleTypeDef *hrc, uchar authMode, uchar sector, uchar *Sectorkey, uchar *serNum, uchar *recvData)
+{
+	uchar frames[MFRC522_SECTOR_MAX_BLOCKS][4];
+	uchar first;
+	uchar count;
+	uchar status;
+	uchar i;
+	uint16_t crc;
+
+	if (sector >= MFRC522_SECTOR_COUNT)
+	{
+		return MI_ERR;
+	}
+	first = (sector < 32) ? (sector * 4) : (128 + (sector - 32) * 16);
+	count = (sector < 32) ? 3 : 15;
+
+	for (i=0; i<count; i++)
+	{
+		crc = (CRCA_READ_STATE >> 8) ^ crca_table[(CRCA_READ_STATE ^ (first + i)) & 0xFF];
+		frames[i][0] = PICC_READ;
+		frames[i][1] = first + i;
+		frames[i][2] = crc & 0xFF;
+		frames[i][3] = crc >> 8;
+	}
+
+	status = MFRC522_AuthCached(hrc, authMode, first, Sectorkey, serNum);
+	if (status != MI_OK)
+	{
+		return status;
+	}
+
+	if (Shadow_MFRC522(hrc, BitFramingReg) != 0x00)
+	{
+		Write_MFRC522(hrc, BitFramingReg, 0x00);	// whole bytes, no RxAlign
+	}
+
+	for (i=0; i<count; i++)
+	{
+		if (i == 0)
+		{
+			MFRC522_ToCardStart(hrc, PCD_TRANSCEIVE, frames[0], 4);
+		}
+		else
+		{
+			MFRC522_ToCardRestart(hrc, frames[i], 4);
+		}
+		while ((status = MFRC522_ReadPoll(hrc, &recvData[i * 16])) == MI_BUSY)
+		{
+			if (hrc->irqMode)
+			{
+				__WFI();
+			}
+		}
+		if (status != MI_OK)
+		{
+			MFRC522_StopCrypto1(hrc);				// a NAK drops the card out of the session
+			return status;
+		}
+	}
+
+	return MI_OK;
+}
+
+/*
+ * Function Name: MFRC522_CardType
+ * Description: Card type from the ATQA (the TagType of MFRC522_Request) and the SAK. The
+ *              Ultralight family cannot be told apart this way, see MFRC522_IdentifyCard.
+ * Input parameters: uid - selected card
+ * Return value: MFRC522_CARD_MIFARE_1K, _MIFARE_4K, _ULTRALIGHT or _UNKNOWN
+ */
+uchar MFRC522_CardType(const MFRC522_Uid *uid)
+{
+	if (uid->sak & 0x08)
+	{
+		return (uid->sak & 0x10) ? MFRC522_CARD_MIFARE_4K : MFRC522_CARD_MIFARE_1K;
+	}
+	if ((uid->sak == 0x00) && (uid->atqa[0] == 0x44) && (uid->atqa[1] == 0x00))
+	{
+		return MFRC522_CARD_ULTRALIGHT;
+	}
+	return MFRC522_CARD_UNKNOWN;
+}
+
+/*
+ * Function Name: MFRC522_GetVersion
+ * Description: GET_VERSION of an NTAG/Ultralight EV1. A card without the command stays silent
+ *              and falls back to IDLE.
+ * Input parameters: version - receives 8 bytes: header, vendor, type, subtype, major, minor, size, protocol
+ * Return value: the successful return MI_OK
+ */
+uchar MFRC522_GetVersion(MFRC522_HandleTypeDef *hrc, uchar *version)
+{
+	uchar status;
+	uint recvBits;
+	uchar buff[MAX_LEN];
+
+	buff[0] = PICC_GET_VERSION;
+	CalulateCRC(hrc, buff, 1, &buff[1]);
+	status = MFRC522_ToCard(hrc, PCD_TRANSCEIVE, buff, 3, buff, &recvBits);
+	if ((status != MI_OK) || (recvBits != 80) || (crca_update(0x6363, buff, 10) != 0))
+	{
+		return MI_ERR;
+	}
+
+	memcpy(version, buff, 8);
+	return MI_OK;
+}
+
+/*
+ * Function Name: MFRC522_IdentifyCard
+ * Description: MFRC522_CardType, refined with GET_VERSION for the Ultralight family. An original
+ *              Ultralight does not know GET_VERSION; it is woken and selected again, so the card
+ *              is ACTIVE on return either way.
+ * Input parameters: uid - selected card; cardType - receives MFRC522_CARD_*
+ * Return value: the successful return MI_OK, MI_ERR if the card could not be selected again
+ */
+uchar MFRC522_IdentifyCard(MFRC522_HandleTypeDef *hrc, MFRC522_Uid *uid, uchar *cardType)
+{
+	uchar version[8];
+	uchar tagType[MAX_LEN];
+	MFRC522_Uid again;
+
+	*cardType = MFRC522_CardType(uid);
+	if (*cardType != MFRC522_CARD_ULTRALIGHT)
+	{
+		return MI_OK;
+	}
+
+	if (MFRC522_GetVersion(hrc, version) != MI_OK)
+	{
+		if ((MFRC522_Request(hrc, PICC_REQALL, tagType) != MI_OK) || (MFRC522_SelectUid(hrc, &again) != MI_OK) ||
+			(again.size != uid->size) || (memcmp(again.uidByte, uid->uidByte, uid->size) != 0))
+		{
+			return MI_ERR;
+		}
+		return MI_OK;
+	}
+
+	if (version[2] == 0x03)					// product type Ultralight
+	{
+		*cardType = MFRC522_CARD_ULTRALIGHT_EV1;
+	}
+	else if (version[2] == 0x04)			// product type NTAG, size byte tells the model
+	{
+		switch (version[6])
+		{
+			case 0x0F: *cardType = MFRC522_CARD_NTAG213; break;
+			case 0x11: *cardType = MFRC522_CARD_NTAG215; break;
+			case 0x13: *cardType = MFRC522_CARD_NTAG216; break;
+			default: *cardType = MFRC522_CARD_ULTRALIGHT_EV1; break;	// unknown size: the EV1 common subset
+		}
+	}
+
+	return MI_OK;
+}
+
+/*
+ * Function Name: MFRC522_FastRead
+ * Description: FAST_READ pages startPage..endPage of an NTAG/Ultralight EV1 in one exchange.
+ *              The answer may be longer than the FIFO: it is drained in bursts of
+ *              MFRC522_FIFO_DRAIN bytes while still arriving (one byte takes ~85us on air),
+ *              and the CRC_A is checked on the fly. WaterLevelReg raises HiAlertIRq at the
+ *              drain level; between drains the CPU sleeps until the IRQ pin fires, or until the
+ *              next SysTick in polled mode, instead of reading the FIFO level back to back.
+ * Input parameters: startPage, endPage - page range; recvData - (endPage-startPage+1)*4 bytes
+ * Return value: the successful return MI_OK
+ */
+uchar MFRC522_FastRead(MFRC522_HandleTypeDef *hrc, uchar startPage, uchar endPage, uchar *recvData)
+{
+	static const uchar pollRegs[2] = { CommIrqReg, FIFOLevelReg };
+	uchar vals[2];
+	uchar chunk[MFRC522_FIFO_SIZE];
+	uchar frame[5];
+	uchar irq = 0;
+	uchar n;
+	uchar i;
+	uint want;
+	uint got = 0;
+	uint16_t crc = 0x6363;
+	uint32_t budget;
+	uchar overrun = 0;
+
+	if (endPage < startPage)
+	{
+		return MI_ERR;
+	}
+	want = (endPage - startPage + 1) * 4 + 2;	// data + CRC_A
+
+	frame[0] = PICC_FAST_READ;
+	frame[1] = startPage;
+	frame[2] = endPage;
+	CalulateCRC(hrc, frame, 3, &frame[3]);
+	if (Shadow_MFRC522(hrc, BitFramingReg) != 0x00)
+	{
+		Write_MFRC522(hrc, BitFramingReg, 0x00);
+	}
+	// HiAlert when (64 - FIFO level) <= WaterLevel, i.e. once MFRC522_FIFO_DRAIN bytes wait
+	if (Shadow_MFRC522(hrc, WaterLevelReg) != (MFRC522_FIFO_SIZE - MFRC522_FIFO_DRAIN))
+	{
+		Write_MFRC522(hrc, WaterLevelReg, MFRC522_FIFO_SIZE - MFRC522_FIFO_DRAIN);
+	}
+	MFRC522_ToCardStart(hrc, PCD_TRANSCEIVE, frame, 5);
+	if (hrc->irqMode)
+	{
+		SetBitMask(hrc, CommIEnReg, 0x08);		// HiAlertIEn: the drain level pulls the IRQ line too
+	}
+	budget = MFRC522_TXN_TIMEOUT_MS + want / 8;
+
+	while (1)
+	{
+		// The FIFO room left above the drain level outlasts a SysTick, so a polled wait is safe.
+		// An edge missed while the line stayed low only delays the next drain to that tick.
+		if (!hrc->irqPending)
+		{
+			__WFI();
+		}
+		hrc->irqPending = 0;
+
+		// CommIrqReg first: once RxIRq is seen, the level read after it covers the whole answer
+		Read_MFRC522_Multi(hrc, pollRegs, vals, 2);
+		irq = vals[0];
+		n = vals[1] & 0x7F;
+
+		if ((irq & 0x08) || (n && (irq & 0x23)))	// HiAlertIRq, or the tail of the answer
+		{
+			Read_MFRC522_Burst(hrc, FIFODataReg, chunk, n);
+			crc = crca_update(crc, chunk, n);
+			for (i=0; i<n; i++, got++)
+			{
+				if (got < want - 2)
+				{
+					recvData[got] = chunk[i];
+				}
+			}
+			overrun |= (got > want);
+		}
+		if (irq & 0x23)						// RxIRq, ErrIRq or TimerIRq: the answer is over
+		{
+			break;
+		}
+		if (irq & 0x08)
+		{
+			ClearBitMask(hrc, CommIrqReg, 0x08);	// drained below the water level, so it stays clear
+		}
+		if ((HAL_GetTick() - hrc->txn.startTick) >= budget)
+		{
+			irq = 0x02;
+			break;
+		}
+	}
+
+	ClearBitMask(hrc, BitFramingReg, 0x80);			//StartSend=0
+	if (hrc->irqMode)
+	{
+		ClearBitMask(hrc, CommIEnReg, 0x08);		// MFRC522_ToCardRestart keeps CommIEnReg as it is
+	}
+	hrc->txn.state = MFRC522_TXN_IDLE;
+
+	if ((irq & 0x01) && (got == 0))
+	{
+		return MI_NOTAGERR;
+	}
+	if ((irq & 0x02) || overrun || (got != want) || (crc != 0))
+	{
+		return MI_ERR;					// NAK, BufferOvfl, short answer or CRC error
+	}
+	return MI_OK;
+}
+
+/*
+ * Function Name: MFRC522_ReadUserArea
+ * Description: Read the whole user memory of an Ultralight/NTAG card, dispatched on its type:
+ *              one FAST_READ for NTAG and Ultralight EV1, READ of 4 pages at a time for the
+ *              original Ultralight. MIFARE Classic needs a key, use MFRC522_ReadSector.
+ * Input parameters: cardType - from MFRC522_IdentifyCard; recvData, maxLen - destination buffer;
+ *                   len - receives the number of bytes read
+ * Return value: the successful return MI_OK, MI_ERR for other types or a buffer too small
+ */
+uchar MFRC522_ReadUserArea(MFRC522_HandleTypeDef *hrc, uchar cardType, uchar *recvData, uint maxLen, uint *len)
+{
+	uchar lastPage;
+	uchar page;
+	uchar status;
+
+	*len = 0;
+	switch (cardType)
+	{
+		case MFRC522_CARD_ULTRALIGHT:
+		case MFRC522_CARD_ULTRALIGHT_EV1: lastPage = 15; break;
+		case MFRC522_CARD_NTAG213: lastPage = 39; break;
+		case MFRC522_CARD_NTAG215: lastPage = 129; break;
+		case MFRC522_CARD_NTAG216: lastPage = 225; break;
+		default: return MI_ERR;
+	}
+	if (maxLen < (uint)(lastPage - 3) * 4)
+	{
+		return MI_ERR;
+	}
+
+	if (cardType != MFRC522_CARD_ULTRALIGHT)
+	{
+		status = MFRC522_FastRead(hrc, 4, lastPage, recvData);
+	}
+	else
+	{
+		status = MI_OK;
+		for (page=4; (page<=lastPage) && (status == MI_OK); page+=4)
+		{
+			status = MFRC522_Read(hrc, page, &recvData[(page - 4) * 4]);
+		}
+	}
+
+	if (status == MI_OK)
+	{
+		*len = (lastPage - 3) * 4;
+	}
+	return status;
+}
+
+/*
+ * Function Name: MFRC522_Write
+ * Description: Write block data
+ * Input parameters: blockAddr - block address; writeData - to 16-byte data block write
+ * Return value: the successful return MI_OK
+ */
+uchar MFRC522_Write(MFRC522_HandleTypeDef *hrc, uchar blockAddr, uchar *writeData)
+{
+    uchar status;
+    uint recvBits;
+    uchar i;
+	uchar buff[18];
+
+    buff[0] = PICC_WRITE;
+    buff[1] = blockAddr;
+    CalulateCRC(hrc, buff, 2, &buff[2]);
+    status = MFRC522_ToCard(hrc, PCD_TRANSCEIVE, buff, 4, buff, &recvBits);
+
+    if ((status != MI_OK) || (recvBits != 4) || ((buff[0] & 0x0F) != 0x0A))
+    {
+		status = MI_ERR;
+	}
+
+    if (status == MI_OK)
+    {
+        for (i=0; i<16; i++)		//Data to the FIFO write 16Byte
+        {
+        	buff[i] = *(writeData+i);
+        }
+        CalulateCRC(hrc, buff, 16, &buff[16]);
+        status = MFRC522_ToCard(hrc, PCD_TRANSCEIVE, buff, 18, buff, &recvBits);
+
+		if ((status != MI_OK) || (recvBits != 4) || ((buff[0] & 0x0F) != 0x0A))
+        {
+			status = MI_ERR;
+		}
+    }
+
+    return status;
+}
+
+/*
+ * Function Name: MFRC522_ValueFormat
+ * Description: Turn a block into a MIFARE value block: value, ~value, value, then the address
+ *              byte as adr, ~adr, adr, ~adr. The address byte is set to the block itself.
+ * Input parameters: blockAddr - block address, not a sector trailer; value - initial value
+ * Return value: the successful return MI_OK
+ */
+uchar MFRC522_ValueFormat(MFRC522_HandleTypeDef *hrc, uchar blockAddr, int32_t value)
+{
+	uchar block[16];
+	uchar i;
+
+	for (i=0; i<4; i++)
+	{
+		block[i] = ((uint32_t)value >> (8 * i)) & 0xFF;
+		block[i + 4] = ~block[i];
+		block[i + 8] = block[i];
+	}
+	block[12] = blockAddr;
+	block[13] = ~blockAddr;
+	block[14] = blockAddr;
+	block[15] = ~blockAddr;
+
+	return MFRC522_Write(hrc, blockAddr, block);
+}
+
+/*
+ * Function Name: MFRC522_ValueRead
+ * Description: Read a value block and check its redundant layout (see MFRC522_ValueFormat)
+ * Input parameters: blockAddr - block address; value - receives the value
+ * Return value: the successful return MI_OK, MI_ERR if the block is not a valid value block
+ */
+uchar MFRC522_ValueRead(MFRC522_HandleTypeDef *hrc, uchar blockAddr, int32_t *value)
+{
+	uchar block[MAX_LEN];
+	uchar status;
+	uchar i;
+
+	status = MFRC522_Read(hrc, blockAddr, block);
+	if (status != MI_OK)
+	{
+		return status;
+	}
+
+	for (i=0; i<4; i++)
+	{
+		if ((block[i] != (uchar)~block[i + 4]) || (block[i] != block[i + 8]))
+		{
+			return MI_ERR;
+		}
+	}
+	if ((block[12] != (uchar)~block[13]) || (block[12] != block[14]) || (block[13] != block[15]))
+	{
+		return MI_ERR;
+	}
+
+	*value = (int32_t)((uint32_t)block[0] | ((uint32_t)block[1] << 8) | ((uint32_t)block[2] << 16) | ((uint32_t)block[3] << 24));
+	return MI_OK;
+}
+
+/*
+ * Function Name: MFRC522_ValueOp
+ * Description: DECREMENT, INCREMENT or RESTORE into the card's transfer buffer. Part one
+ *              (command + block) is ACKed; part two (the operand) is only answered with a NAK,
+ *              so the short MFRC522_TMO_NAK timeout running out means success. Nothing is
+ *              stored until MFRC522_Transfer.
+ * Input parameters: command - PICC_DECREMENT, PICC_INCREMENT or PICC_RESTORE
+ *             blockAddr - value block; operand - amount, 0 for RESTORE
+ * Return value: the successful return MI_OK
+ */
+static uchar MFRC522_ValueOp(MFRC522_HandleTypeDef *hrc, uchar command, uchar blockAddr, int32_t operand)
+{
+	uchar status;
+	uint recvBits;
+	uchar buff[MAX_LEN];
+	uchar i;
+
+	buff[0] = command;
+	buff[1] = blockAddr;
+	CalulateCRC(hrc, buff, 2, &buff[2]);
+	status = MFRC522_ToCard(hrc, PCD_TRANSCEIVE, buff, 4, buff, &recvBits);
+	if ((status != MI_OK) || (recvBits != 4) || ((buff[0] & 0x0F) != 0x0A))
+	{
+		MFRC522_StopCrypto1(hrc);				// a NAK drops the card out of the session
+		return MI_ERR;
+	}
+
+	for (i=0; i<4; i++)
+	{
+		buff[i] = ((uint32_t)operand >> (8 * i)) & 0xFF;
+	}
+	CalulateCRC(hrc, buff, 4, &buff[4]);
+	MFRC522_ToCardStartTmo(hrc, PCD_TRANSCEIVE, buff, 6, MFRC522_TMO_NAK);
+	while ((status = MFRC522_ToCardPoll(hrc, buff, &recvBits)) == MI_BUSY)
+	{
+		if (hrc->irqMode)
+		{
+			__WFI();
+		}
+	}
+
+	if (status != MI_NOTAGERR)
+	{
+		MFRC522_StopCrypto1(hrc);
+		return MI_ERR;
+	}
+
+	return MI_OK;
+}
+
+/*
+ * Function Name: MFRC522_Decrement
+ * Description: Value block minus delta into the transfer buffer, commit with MFRC522_Transfer.
+ *              The card does not check for underflow, read the value first.
+ * Input parameters: blockAddr - value block; delta - amount to subtract
+ * Return value: the successful return MI_OK
+ */
+uchar MFRC522_Decrement(MFRC522_HandleTypeDef *hrc, uchar blockAddr, int32_t delta)
+{
+	return MFRC522_ValueOp(hrc, PICC_DECREMENT, blockAddr, delta);
+}
+
+/*
+ * Function Name: MFRC522_Increment
+ * Description: Value block plus delta into the transfer buffer, commit with MFRC522_Transfer
+ * Input parameters: blockAddr - value block; delta - amount to add
+ * Return value: the successful return MI_OK
+ */
+uchar MFRC522_Increment(MFRC522_HandleTypeDef *hrc, uchar blockAddr, int32_t delta)
+{
+	return MFRC522_ValueOp(hrc, PICC_INCREMENT, blockAddr, delta);
+}
+
+/*
+ * Function Name: MFRC522_Restore
+ * Description: Copy a value block into the transfer buffer, e.g. to back it up into another block
+ * Input parameters: blockAddr - value block
+ * Return value: the successful return MI_OK
+ */
+uchar MFRC522_Restore(MFRC522_HandleTypeDef *hrc, uchar blockAddr)
+{
+	return MFRC522_ValueOp(hrc, PICC_RESTORE, blockAddr, 0);
+}
+
+/*
+ * Function Name: MFRC522_Transfer
+ * Description: Write the transfer buffer to a block of the authenticated sector. This is the
+ *              single EEPROM write of a value operation: either the whole new value lands or
+ *              the block keeps the old one.
+ * Input parameters: blockAddr - destination block
+ * Return value: the successful return MI_OK
+ */
+uchar MFRC522_Transfer(MFRC522_HandleTypeDef *hrc, uchar blockAddr)
+{
+	uchar status;
+	uint recvBits;
+	uchar buff[MAX_LEN];
+
+	buff[0] = PICC_TRANSFER;
+	buff[1] = blockAddr;
+	CalulateCRC(hrc, buff, 2, &buff[2]);
+	status = MFRC522_ToCard(hrc, PCD_TRANSCEIVE, buff, 4, buff, &recvBits);
+	if ((status != MI_OK) || (recvBits != 4) || ((buff[0] & 0x0F) != 0x0A))
+	{
+		MFRC522_StopCrypto1(hrc);
+		return MI_ERR;
+	}
+
+	return MI_OK;
+}
+
+/*
+ * Function Name: MFRC522_Halt
+ * Description: Command card into hibernation
+ * Input: None
+ * Return value: None
+ */
+void MFRC522_Halt(MFRC522_HandleTypeDef *hrc)
+{
+	uint unLen;
+	uchar buff[4];
+
+	buff[0] = PICC_HALT;
+	buff[1] = 0;
+	CalulateCRC(hrc, buff, 2, &buff[2]);
+
+	MFRC522_ToCard(hrc, PCD_TRANSCEIVE, buff, 4, buff,&unLen);
+	MFRC522_StopCrypto1(hrc);				// HLTA itself still went out encrypted
+}
 
-    ClearBitMask(BitFramingReg, 0x80);			//StartSend=0
+/*
+ * Function Name: MFRC522_SelectUid
+ * Description: ISO 14443-3 anti-collision and SELECT over cascade levels 1 to 3.
+ *              Collisions are resolved bit by bit through CollReg, always taking the 1 branch,
+ *              so one pass selects exactly one card. The card must be in READY state (after REQA/WUPA).
+ * Input parameters: uid - receives the 4, 7 or 10 byte UID and the final SAK
+ * Return value: the successful return MI_OK
+ */
+uchar MFRC522_SelectUid(MFRC522_HandleTypeDef *hrc, MFRC522_Uid *uid)
+{
+	static const uchar selCmd[3] = { PICC_ANTICOLL, PICC_ANTICOLL_CL2, PICC_ANTICOLL_CL3 };
+	uchar buffer[MAX_LEN];	// SEL, NVB, 4 UID/CT bytes, BCC, CRC_A (room for a full FIFO read)
+	uchar cl[4];			// UID/CT bytes of the current cascade level
+	uchar level;
+	uchar knownBits;
+	uchar txBytes;
+	uchar txLastBits;
+	uchar index;
+	uchar collPos;
+	uchar status;
+	uchar i;
+	uchar crc[2];
+	uint backBits;
+	uchar guard;
+	uint32_t start = phase_timing_now();
 
-    if (i != 0)
-    {
-        if(!(Read_MFRC522(ErrorReg) & 0x1B))	//BufferOvfl Collerr CRCErr ProtecolErr
-        {
-            status = MI_OK;
-            if (n & irqEn & 0x01)
-            {
-				status = MI_NOTAGERR;
-			}
+	uid->size = 0;
+	uid->sak = 0;
+	ClearBitMask(hrc, CollReg, 0x80);			// ValuesAfterColl=0: bits after a collision read as 0
 
-            if (command == PCD_TRANSCEIVE)
-            {
-               	n = Read_MFRC522(FIFOLevelReg);
-              	lastBits = Read_MFRC522(ControlReg) & 0x07;
-                if (lastBits)
-                {
-					*backLen = (n-1)*8 + lastBits;
+	for (level=0; level<3; level++)
+	{
+		buffer[0] = selCmd[level];
+		knownBits = 0;
+		memset(&buffer[2], 0, 5);
+
+		// At most one extra round per UID bit, plus the final SELECT
+		for (guard=0; guard<34; guard++)
+		{
+			if (knownBits >= 32)
+			{
+				// Whole CLn known: check BCC, then SELECT it. NVB=0x70, 4 bytes + BCC + CRC_A
+				if (buffer[6] != (buffer[2] ^ buffer[3] ^ buffer[4] ^ buffer[5]))
+				{
+					return MI_ERR;
 				}
-                else
-                {
-					*backLen = n*8;
+				memcpy(cl, &buffer[2], 4);
+				buffer[1] = 0x70;
+				CalulateCRC(hrc, buffer, 7, &buffer[7]);
+				Write_MFRC522(hrc, BitFramingReg, 0x00);
+				status = MFRC522_ToCard(hrc, PCD_TRANSCEIVE, buffer, 9, buffer, &backBits);
+				if ((status != MI_OK) || (backBits != 24))
+				{
+					return MI_ERR;
+				}
+				CalulateCRC(hrc, buffer, 1, crc);
+				if ((crc[0] != buffer[1]) || (crc[1] != buffer[2]))
+				{
+					return MI_ERR;
 				}
+				break;
+			}
 
-                if (n == 0)
-                {
-					n = 1;
+			// ANTICOLLISION with the bits known so far
+			txLastBits = knownBits % 8;
+			index = 2 + knownBits / 8;
+			txBytes = index + (txLastBits ? 1 : 0);
+			buffer[1] = (index << 4) | txLastBits;	// NVB: whole bytes in the high nibble, bits in the low
+			Write_MFRC522(hrc, BitFramingReg, (txLastBits << 4) | txLastBits);	// RxAlign = TxLastBits
+
+			// The answer starts at the first unknown bit, so it lands on buffer[index]
+			status = MFRC522_ToCard(hrc, PCD_TRANSCEIVE, buffer, txBytes, &buffer[index], &backBits);
+			if (status == MI_COLLISION)
+			{
+				collPos = Read_MFRC522(hrc, CollReg);
+				if (collPos & 0x20)			// CollPosNotValid
+				{
+					return MI_ERR;
 				}
-                if (n > MAX_LEN)
-                {
-					n = MAX_LEN;
+				collPos &= 0x1F;
+				if (collPos == 0)
+				{
+					collPos = 32;
 				}
-
-                // Reading the received data in FIFO
-                for (i=0; i<n; i++)
-                {
-					backData[i] = Read_MFRC522(FIFODataReg);
+				if (collPos <= knownBits)
+				{
+					return MI_ERR;
 				}
-            }
-        }
-        else
-        {
-			status = MI_ERR;
+				// Keep everything before the collision and choose 1 for the colliding bit
+				knownBits = collPos;
+				buffer[1 + (knownBits + 7) / 8] |= 1 << ((knownBits - 1) % 8);
+			}
+			else if (status == MI_OK)
+			{
+				knownBits = 32;
+			}
+			else
+			{
+				return status;
+			}
+		}
+		if (guard >= 34)
+		{
+			return MI_ERR;
 		}
 
-    }
+		// buffer[0] is the SAK now. Cascade bit set: CLn is CT + 3 UID bytes and the next level follows
+		uid->sak = buffer[0];
+		if (uid->sak & 0x04)
+		{
+			if ((cl[0] != PICC_CT) || (level == 2))
+			{
+				return MI_ERR;
+			}
+			for (i=1; i<4; i++)
+			{
+				uid->uidByte[uid->size++] = cl[i];
+			}
+		}
+		else
+		{
+			for (i=0; i<4; i++)
+			{
+				uid->uidByte[uid->size++] = cl[i];
+			}
+			phase_timing_record(PT_ANTICOLL, start);
+			return MI_OK;
+		}
+	}
 
-    //SetBitMask(ControlReg,0x80);           //timer stops
-    //Write_MFRC522(CommandReg, PCD_IDLE);
+	return MI_ERR;
+}
 
-    return status;
+/*
+ * Function Name: MFRC522_ScanStart
+ * Description: Start looking for a card (REQA, then anti-collision) in the background
+ * Input: None
+ * Return value: None
+ */
+void MFRC522_ScanStart(MFRC522_HandleTypeDef *hrc)
+{
+	MFRC522_RequestStart(hrc, PICC_REQIDL);
+	hrc->scanState = MFRC522_SCAN_REQUEST;
 }
 
 /*
- * Function Name: MFRC522_Request
- * Description: Find cards, read the card type number
- * Input parameters: reqMode - find cards way
- *   TagType - Return Card Type
- *    0x4400 = Mifare_UltraLight
- *    0x0400 = Mifare_One(S50)
- *    0x0200 = Mifare_One(S70)
- *    0x0800 = Mifare_Pro(X)
- *    0x4403 = Mifare_DESFire
- * Return value: the successful return MI_OK
+ * Function Name: MFRC522_ScanPoll
+ * Description: Advance the scan started by MFRC522_ScanStart. Call once per main loop pass.
+ *              Waiting for an ATQA is non-blocking; once a card has answered, the cascade
+ *              select runs to completion in this call (a present card answers within a few ms).
+ * Input parameters: uid - receives the UID, ATQA and SAK when a card is found
+ * Return value: MI_BUSY while in progress, MI_OK with uid filled, otherwise the scan is over
+ *               without a card and MFRC522_ScanStart may be called again
  */
-uchar MFRC522_Request(uchar reqMode, uchar *TagType)
+uchar MFRC522_ScanPoll(MFRC522_HandleTypeDef *hrc, MFRC522_Uid *uid)
 {
 	uchar status;
-	uint backBits;			 // The received data bits
+	uchar tagType[MAX_LEN];
 
-	Write_MFRC522(BitFramingReg, 0x07);		//TxLastBists = BitFramingReg[2..0]
+	if (hrc->scanState != MFRC522_SCAN_REQUEST)
+	{
+		return MI_NOTAGERR;
+	}
 
-	TagType[0] = reqMode;
-	status = MFRC522_ToCard(PCD_TRANSCEIVE, TagType, 1, TagType, &backBits);
+	status = MFRC522_RequestPoll(hrc, tagType);
+	if (status == MI_BUSY)
+	{
+		return status;
+	}
 
-	if ((status != MI_OK) || (backBits != 0x10))
+	hrc->scanState = MFRC522_SCAN_IDLE;
+	if ((status == MI_OK) || (status == MI_COLLISION))
 	{
-		status = MI_ERR;
+		status = MFRC522_SelectUid(hrc, uid);
+		uid->atqa[0] = tagType[0];
+		uid->atqa[1] = tagType[1];
 	}
 
 	return status;
 }
 
 /*
- * Function Name: MFRC522_Anticoll
- * Description: Anti-collision detection, reading selected card serial number card
- * Input parameters: serNum - returns 4 bytes card serial number, the first 5 bytes for the checksum byte
- * Return value: the successful return MI_OK
+ * Function Name: MFRC522_PresenceStart
+ * Description: Forget any tracked card and start scanning for a new one
+ * Input parameters: none
+ * Return value: none
  */
-uchar MFRC522_Anticoll(uchar *serNum)
+void MFRC522_PresenceStart(MFRC522_HandleTypeDef *hrc)
 {
-    uchar status;
-    uchar i;
-	uchar serNumCheck=0;
-    uint unLen;
-
-	Write_MFRC522(BitFramingReg, 0x00);		//TxLastBists = BitFramingReg[2..0]
+	hrc->presenceState = MFRC522_PRESENCE_ABSENT;
+	hrc->presenceProbing = 0;
+	hrc->presenceMisses = 0;
+	MFRC522_ScanStart(hrc);
+}
 
-    serNum[0] = PICC_ANTICOLL;
-    serNum[1] = 0x20;
-    status = MFRC522_ToCard(PCD_TRANSCEIVE, serNum, 2, serNum, &unLen);
+/*
+ * Function Name: MFRC522_PresencePoll
+ * Description: Advance the presence tracker. Call once per main loop pass.
+ *              While no card is tracked this runs the background REQA scan; a selected card is
+ *              reported once as MFRC522_EVT_ARRIVED and then HALTed, so later REQAs ignore it and
+ *              it never pays another anticollision. While it is tracked a bare WUPA probe is sent
+ *              instead and the card, woken to READY*, is sent back to HALT by HLTA. After
+ *              MFRC522_PRESENCE_MISSES silent probes MFRC522_EVT_LEFT is reported.
+ *              A second card placed next to the tracked one answers the WUPA too, so it is only
+ *              picked up once the tracked card has left.
+ * Input parameters: uid - receives the card on MFRC522_EVT_ARRIVED and MFRC522_EVT_LEFT
+ * Return value: MFRC522_EVT_NONE, MFRC522_EVT_ARRIVED or MFRC522_EVT_LEFT
+ */
+uchar MFRC522_PresencePoll(MFRC522_HandleTypeDef *hrc, MFRC522_Uid *uid)
+{
+	uchar status;
+	uchar tagType[MAX_LEN];
 
-    if (status == MI_OK)
+	if (hrc->presenceState == MFRC522_PRESENCE_ABSENT)
 	{
-    	 //Check card serial number
-		for (i=0; i<4; i++)
+		if (hrc->scanState == MFRC522_SCAN_IDLE)
 		{
-		 	serNumCheck ^= serNum[i];
+			MFRC522_ScanStart(hrc);
 		}
-		if (serNumCheck != serNum[i])
+		status = MFRC522_ScanPoll(hrc, &hrc->presenceUid);
+		if (status != MI_OK)
 		{
-			status = MI_ERR;
+			return MFRC522_EVT_NONE;		// still busy, empty field or a failed select
 		}
-    }
 
-    return status;
+		MFRC522_Halt(hrc);
+		hrc->presenceState = MFRC522_PRESENCE_PRESENT;
+		hrc->presenceMisses = 0;
+		*uid = hrc->presenceUid;
+		return MFRC522_EVT_ARRIVED;
+	}
+
+	if (!hrc->presenceProbing)
+	{
+		MFRC522_RequestStart(hrc, PICC_REQALL);
+		hrc->presenceProbing = 1;
+	}
+	status = MFRC522_RequestPoll(hrc, tagType);
+	if (status == MI_BUSY)
+	{
+		return MFRC522_EVT_NONE;
+	}
+	hrc->presenceProbing = 0;
+
+	if ((status == MI_OK) || (status == MI_COLLISION))
+	{
+		hrc->presenceMisses = 0;
+		MFRC522_Halt(hrc);				// READY* -> HALT, ready for the next probe
+		return MFRC522_EVT_NONE;
+	}
+
+	if (++hrc->presenceMisses < MFRC522_PRESENCE_MISSES)
+	{
+		return MFRC522_EVT_NONE;
+	}
+
+	hrc->presenceState = MFRC522_PRESENCE_ABSENT;
+	*uid = hrc->presenceUid;
+	return MFRC522_EVT_LEFT;
 }
 
 /*
- * Function Name: CalulateCRC
- * Description: CRC calculation with MF522
- * Input parameters: pIndata - To read the CRC data, len - the data length, pOutData - CRC calculation results
- * Return value: None
+ * Function Name: MFRC522_PresenceWake
+ * Description: Bring the tracked (halted) card back to ACTIVE for block access: WUPA, or the
+ *              answer of a probe already in flight, then select. Blocks until done. The caller
+ *              must MFRC522_Halt the card afterwards so the presence tracker can go on probing.
+ * Input parameters: none
+ * Return value: MI_OK with the tracked card selected, MI_NOTAGERR if no card is tracked or it
+ *               did not answer, MI_ERR if another card got selected (it is halted again)
  */
-void CalulateCRC(uchar *pIndata, uchar len, uchar *pOutData)
+uchar MFRC522_PresenceWake(MFRC522_HandleTypeDef *hrc)
 {
-    uchar i, n;
+	uchar status;
+	uchar tagType[MAX_LEN];
+	MFRC522_Uid uid;
 
-    ClearBitMask(DivIrqReg, 0x04);			//CRCIrq = 0
-    SetBitMask(FIFOLevelReg, 0x80);			//Clear the FIFO pointer
+	if (hrc->presenceState != MFRC522_PRESENCE_PRESENT)
+	{
+		return MI_NOTAGERR;
+	}
 
-    //Writing data to the FIFO
-    for (i=0; i<len; i++)
-    {
-		Write_MFRC522(FIFODataReg, *(pIndata+i));
+	if (hrc->presenceProbing)
+	{
+		while ((status = MFRC522_RequestPoll(hrc, tagType)) == MI_BUSY)
+		{
+			if (hrc->irqMode)
+			{
+				__WFI();
+			}
+		}
+		hrc->presenceProbing = 0;
+	}
+	else
+	{
+		status = MFRC522_Request(hrc, PICC_REQALL, tagType);
+	}
+	if ((status != MI_OK) && (status != MI_COLLISION))
+	{
+		return MI_NOTAGERR;				// a missed probe is counted by the tracker, not here
 	}
-    Write_MFRC522(CommandReg, PCD_CALCCRC);
 
-    //Wait CRC calculation is complete
-    i = 0xFF;
-    do
-    {
-        n = Read_MFRC522(DivIrqReg);
-        i--;
-    }
-    while ((i!=0) && !(n&0x04));			//CRCIrq = 1
+	status = MFRC522_SelectUid(hrc, &uid);
+	if ((status != MI_OK) || (uid.size != hrc->presenceUid.size) ||
+		(memcmp(uid.uidByte, hrc->presenceUid.uidByte, uid.size) != 0))
+	{
+		MFRC522_Halt(hrc);
+		return MI_ERR;
+	}
 
-    //Read CRC calculation result
-    pOutData[0] = Read_MFRC522(CRCResultRegL);
-    pOutData[1] = Read_MFRC522(CRCResultRegH);
+	return MI_OK;
 }
 
 /*
- * Function Name: MFRC522_SelectTag
- * Description: election card, read the card memory capacity
- * Input parameters: serNum - Incoming card serial number
- * Return value: the successful return of card capacity
+ * Function Name: MFRC522_SchedulerPoll
+ * Description: Round-robin presence tracking over several readers. Every reader keeps its own
+ *              exchange in flight, so while one waits out its RF timeout the others are being
+ *              started and polled; SPI is only held for the register accesses. The first reader
+ *              with an event ends the pass and the next call starts after it, so a busy lane
+ *              cannot starve the others.
+ * Input parameters: sched - readers to serve; reader - index of the reader with the event;
+ *                   uid - the card that arrived or left
+ * Return value: MFRC522_EVT_NONE after a full pass without events, otherwise the event
  */
-uchar MFRC522_SelectTag(uchar *serNum)
+uchar MFRC522_SchedulerPoll(MFRC522_SchedulerTypeDef *sched, uchar *reader, MFRC522_Uid *uid)
 {
 	uchar i;
-	uchar status;
-	uchar size;
-	uint recvBits;
-	uchar buffer[9];
-
-	//ClearBitMask(Status2Reg, 0x08);			//MFCrypto1On=0
+	uchar idx;
+	uchar evt;
 
-    buffer[0] = PICC_SElECTTAG;
-    buffer[1] = 0x70;
-    for (i=0; i<5; i++)
-    {
-    	buffer[i+2] = *(serNum+i);
-    }
-	CalulateCRC(buffer, 7, &buffer[7]);
-    status = MFRC522_ToCard(PCD_TRANSCEIVE, buffer, 9, buffer, &recvBits);
+	for (i=0; i<sched->count; i++)
+	{
+		idx = sched->next;
+		sched->next = (sched->next + 1 < sched->count) ? (sched->next + 1) : 0;
 
-    if ((status == MI_OK) && (recvBits == 0x18))
-    {
-		size = buffer[0];
-	}
-    else
-    {
-		size = 0;
+		evt = MFRC522_PresencePoll(sched->readers[idx], uid);
+		if (evt != MFRC522_EVT_NONE)
+		{
+			*reader = idx;
+			return evt;
+		}
 	}
 
-    return size;
+	return MFRC522_EVT_NONE;
 }
 
 /*
- * Function Name: MFRC522_Auth
- * Description: Verify card password
- * Input parameters: authMode - Password Authentication Mode
-                 0x60 = A key authentication
-                 0x61 = Authentication Key B
-             BlockAddr--Block address
-             Sectorkey--Sector password
-             serNum--Card serial number, 4-byte
- * Return value: the successful return MI_OK
+ * Function Name: MFRC522_Inventory
+ * Description: Enumerate every card in the field: REQA, select one card through the
+ *              collision walk of MFRC522_SelectUid, HALT it so it stays quiet, repeat until
+ *              no card answers REQA any more. Halted cards only come back after leaving the
+ *              field or on a WUPA (PICC_REQALL).
+ * Input parameters: uids - receives the selected cards; maxUids - size of uids;
+ *                   count - number of cards found; cycles - DWT cycles the whole enumeration took
+ * Return value: MI_OK if the field was emptied, MI_ERR if maxUids was reached or a select kept failing
  */
-uchar MFRC522_Auth(uchar authMode, uchar BlockAddr, uchar *Sectorkey, uchar *serNum)
+uchar MFRC522_Inventory(MFRC522_HandleTypeDef *hrc, MFRC522_Uid *uids, uchar maxUids, uchar *count, uint32_t *cycles)
 {
-    uchar status;
-    uint recvBits;
-    uchar i;
-	uchar buff[12];
+	uchar status;
+	uchar atqa[MAX_LEN];
+	uchar failures = 0;
+	uint32_t start;
 
-	//Verify the command block address + sector + password + card serial number
-    buff[0] = authMode;
-    buff[1] = BlockAddr;
-    for (i=0; i<6; i++)
-    {
-		buff[i+2] = *(Sectorkey+i);
-	}
-    for (i=0; i<4; i++)
-    {
-		buff[i+8] = *(serNum+i);
-	}
-    status = MFRC522_ToCard(PCD_AUTHENT, buff, 12, buff, &recvBits);
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	start = DWT->CYCCNT;
 
-    if ((status != MI_OK) || (!(Read_MFRC522(Status2Reg) & 0x08)))
-    {
-		status = MI_ERR;
+	*count = 0;
+	status = MI_OK;
+	while (1)
+	{
+		status = MFRC522_Request(hrc, PICC_REQIDL, atqa);
+		if ((status != MI_OK) && (status != MI_COLLISION))
+		{
+			status = MI_OK;			// nobody left in IDLE
+			break;
+		}
+		if (*count >= maxUids)
+		{
+			status = MI_ERR;
+			break;
+		}
+
+		if (MFRC522_SelectUid(hrc, &uids[*count]) != MI_OK)
+		{
+			// A card that dropped out mid-select falls back to IDLE; give up if it keeps happening
+			if (++failures > MFRC522_INVENTORY_RETRIES)
+			{
+				status = MI_ERR;
+				break;
+			}
+			continue;
+		}
+
+		uids[*count].atqa[0] = atqa[0];
+		uids[*count].atqa[1] = atqa[1];
+		(*count)++;
+		MFRC522_Halt(hrc);
 	}
 
-    return status;
+	*cycles = DWT->CYCCNT - start;
+	return status;
 }
 
+#ifdef MFRC522_BENCH
 /*
- * Function Name: MFRC522_Read
- * Description: Read block data
- * Input parameters: blockAddr - block address; recvData - read block data
- * Return value: the successful return MI_OK
+ * Function Name: MFRC522_BenchScan
+ * Description: Time one REQA + anticollision + select sequence with the DWT cycle counter.
+ *              Build with and without MFRC522_USE_DMA to compare transports (Tools/rc522_sim
+ *              does both in `make bench`).
+ * Input: None
+ * Return value: elapsed core cycles, 0 if no card answered
  */
-uchar MFRC522_Read(uchar blockAddr, uchar *recvData)
+uint32_t MFRC522_BenchScan(MFRC522_HandleTypeDef *hrc)
 {
-    uchar status;
-    uint unLen;
+	uchar buf[MAX_LEN];
+	MFRC522_Uid uid;
+	uint32_t start;
+	uint32_t cycles = 0;
 
-    recvData[0] = PICC_READ;
-    recvData[1] = blockAddr;
-    CalulateCRC(recvData,2, &recvData[2]);
-    status = MFRC522_ToCard(PCD_TRANSCEIVE, recvData, 4, recvData, &unLen);
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 
-    if ((status != MI_OK) || (unLen != 0x90))
-    {
-        status = MI_ERR;
-    }
+	start = DWT->CYCCNT;
+	if ((MFRC522_Request(hrc, PICC_REQIDL, buf) == MI_OK) && (MFRC522_SelectUid(hrc, &uid) == MI_OK))
+	{
+		cycles = DWT->CYCCNT - start;
+	}
 
-    return status;
+	return cycles;
 }
 
 /*
- * Function Name: MFRC522_Write
- * Description: Write block data
- * Input parameters: blockAddr - block address; writeData - to 16-byte data block write
- * Return value: the successful return MI_OK
+ * Function Name: MFRC522_BenchEmptyScan
+ * Description: Time one REQA that nobody answers, i.e. the cost of a scan pass with an empty field.
+ *              Dominated by the MFRC522_TMO_REQA timeout.
+ * Input: None
+ * Return value: elapsed core cycles, 0 if a card answered
  */
-uchar MFRC522_Write(uchar blockAddr, uchar *writeData)
+uint32_t MFRC522_BenchEmptyScan(MFRC522_HandleTypeDef *hrc)
 {
-    uchar status;
-    uint recvBits;
-    uchar i;
-	uchar buff[18];
+	uchar buf[MAX_LEN];
+	uint32_t start;
+	uint32_t cycles;
 
-    buff[0] = PICC_WRITE;
-    buff[1] = blockAddr;
-    CalulateCRC(buff, 2, &buff[2]);
-    status = MFRC522_ToCard(PCD_TRANSCEIVE, buff, 4, buff, &recvBits);
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 
-    if ((status != MI_OK) || (recvBits != 4) || ((buff[0] & 0x0F) != 0x0A))
-    {
-		status = MI_ERR;
+	start = DWT->CYCCNT;
+	if (MFRC522_Request(hrc, PICC_REQIDL, buf) != MI_ERR)
+	{
+		return 0;
 	}
+	cycles = DWT->CYCCNT - start;
 
-    if (status == MI_OK)
-    {
-        for (i=0; i<16; i++)		//Data to the FIFO write 16Byte
-        {
-        	buff[i] = *(writeData+i);
-        }
-        CalulateCRC(buff, 16, &buff[16]);
-        status = MFRC522_ToCard(PCD_TRANSCEIVE, buff, 18, buff, &recvBits);
-
-		if ((status != MI_OK) || (recvBits != 4) || ((buff[0] & 0x0F) != 0x0A))
-        {
-			status = MI_ERR;
-		}
-    }
-
-    return status;
+	return cycles;
 }
 
 /*
- * Function Name: MFRC522_Halt
- * Description: Command card into hibernation
- * Input: None
- * Return value: None
+ * Function Name: MFRC522_BenchCRC
+ * Description: Time the host CRC_A against the coprocessor round trip on an 18 byte WRITE payload
+ * Input parameters: hostCycles, chipCycles - receive the DWT cycle counts
+ * Return value: MI_OK if both paths produced the same CRC
  */
-void MFRC522_Halt(void)
+uchar MFRC522_BenchCRC(MFRC522_HandleTypeDef *hrc, uint32_t *hostCycles, uint32_t *chipCycles)
 {
-	uint unLen;
-	uchar buff[4];
+	uchar data[16];
+	uchar crcHost[2];
+	uchar crcChip[2];
+	uchar i;
+	uint32_t start;
 
-	buff[0] = PICC_HALT;
-	buff[1] = 0;
-	CalulateCRC(buff, 2, &buff[2]);
+	for (i=0; i<16; i++)
+	{
+		data[i] = i * 37;
+	}
+
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	start = DWT->CYCCNT;
+	CalulateCRC_Host(data, 16, crcHost);
+	*hostCycles = DWT->CYCCNT - start;
+
+	start = DWT->CYCCNT;
+	CalulateCRC_Chip(hrc, data, 16, crcChip);
+	*chipCycles = DWT->CYCCNT - start;
 
-	MFRC522_ToCard(PCD_TRANSCEIVE, buff, 4, buff,&unLen);
+	return ((crcHost[0] == crcChip[0]) && (crcHost[1] == crcChip[1])) ? MI_OK : MI_ERR;
 }
+#endif
@@ -0,0 +1,99 @@
+/*
+ * vote_backup.c
+ *
+ * Backup-register vote mirror, see vote_backup.h. Every register is written with a single
+ * store, ring entry first: a reset between two stores leaves a vote in the ring whose
+ * counters lag. Its ordinal tag tells it from the entry it replaced, and the next boot
+ * recovers it like any other.
+ */
+#include "vote_backup.h"
+
+#define BKP_MAGIC       0x564F5443U     /* "VOTC": vote count in step with the journal */
+
+/* Register indices */
+#define BKP_MAGIC_REG   0U
+#define BKP_KEY         1U
+#define BKP_COUNT       2U      /* votes cast, journal and queue; the next ring slot is count % VOTE_BACKUP_RING */
+#define BKP_TALLY       3U
+#define BKP_RING        (BKP_TALLY + JOURNAL_CANDIDATES)
+
+/* Ring entry: valid bit | ordinal (low 7 bits of the vote count) << 24 | candidate << 16 | voter index */
+#define ENTRY_VALID     0x80000000UL
+#define ENTRY_TAG(n)    (((uint32_t)(n) & 0x7FU) << 24)
+#define ENTRY_TAG_MASK  ENTRY_TAG(0x7FU)
+#if VOTED_MAX_SLOTS > 0x10000U
+#error "ring entries hold 16-bit voter indices"
+#endif
+#if JOURNAL_CANDIDATES > 0x100U || VOTE_BACKUP_RING > 0x40U
+#error "ring entries hold 8-bit candidates and a 7-bit ordinal"
+#endif
+
+static volatile uint32_t *bkp = 0;
+
+/* Vote count and tallies to the journal's, queued votes included, then an empty ring: no
+ * entry left from before can carry the ordinal of a vote still to come */
+static void restart(const journal_t *j)
+{
+    uint32_t tally[JOURNAL_CANDIDATES];
+    uint32_t total = 0;
+
+    vote_queue_tally(j, tally);
+    for (uint32_t i = 0; i < JOURNAL_CANDIDATES; ++i) {
+        bkp[BKP_TALLY + i] = tally[i];
+        total += tally[i];
+    }
+    bkp[BKP_COUNT] = total;
+    for (uint32_t i = 0; i < VOTE_BACKUP_RING; ++i) bkp[BKP_RING + i] = 0;
+}
+
+/* Reconcile the mirror with the journal just opened; returns the votes it put back into the
+ * journal. *missing: votes the mirror counts that the journal still lacks. A mirror of
+ * another roll (or none) is cleared instead. Backup-domain write access must be on. */
+uint32_t vote_backup_open(volatile uint32_t *regs, journal_t *j, uint32_t *missing)
+{
+    uint32_t count, first, total = 0, recovered = 0;
+
+    bkp = regs;
+    *missing = 0;
+    if (bkp[BKP_MAGIC_REG] != BKP_MAGIC || bkp[BKP_KEY] != j->roll_key) {
+        for (uint32_t i = 0; i < VOTE_BACKUP_REGS; ++i) bkp[i] = 0;
+        bkp[BKP_KEY] = j->roll_key;
+        bkp[BKP_MAGIC_REG] = BKP_MAGIC;
+        restart(j);
+        return 0;
+    }
+
+    /* A reset after the ring store and before the count: that vote counts too */
+    count = bkp[BKP_COUNT];
+    if ((bkp[BKP_RING + count % VOTE_BACKUP_RING] & (ENTRY_VALID | ENTRY_TAG_MASK)) == (ENTRY_VALID | ENTRY_TAG(count))) count++;
+
+    /* Votes total .. count-1 never reached flash; the ring has the newest of them. Oldest
+     * first, so the journal gets them in cast order. */
+    for (uint32_t i = 0; i < JOURNAL_CANDIDATES; ++i) total += j->tally[i];
+    first = (count > total + VOTE_BACKUP_RING) ? count - VOTE_BACKUP_RING : total;
+    for (uint32_t n = first; n < count; ++n) {
+        uint32_t e = bkp[BKP_RING + n % VOTE_BACKUP_RING];
+        int32_t voter = (int32_t)(e & 0xFFFFU);
+        uint8_t cand = (uint8_t)((e >> 16) & 0xFFU);
+
+        if ((e & (ENTRY_VALID | ENTRY_TAG_MASK)) != (ENTRY_VALID | ENTRY_TAG(n))) continue;
+        if ((uint32_t)voter >= j->n_slots || cand >= JOURNAL_CANDIDATES) continue;
+        if (journal_vote(j, voter, cand) == JOURNAL_OK) recovered++;
+    }
+
+    if (count > total + recovered) *missing = count - total - recovered;
+    restart(j);
+    return recovered;
+}
+
+/* Mirror one vote accepted by vote_queue_cast(): three stores and an increment */
+void vote_backup_record(int32_t voter, uint8_t candidate)
+{
+    uint32_t count;
+
+    if (bkp == 0 || voter < 0 || candidate >= JOURNAL_CANDIDATES) return;
+    count = bkp[BKP_COUNT];
+    bkp[BKP_RING + count % VOTE_BACKUP_RING] = ENTRY_VALID | ENTRY_TAG(count) | ((uint32_t)candidate << 16) | (uint32_t)voter;
+    bkp[BKP_COUNT] = count + 1U;
+    bkp[BKP_TALLY + candidate]++;
+}
@@ -0,0 +1,199 @@
+/*
+ * vote_queue.c
+ *
+ * Vote write-behind queue, see vote_queue.h. A ring of VOTE_QUEUE_MAX entries; the journal
+ * sees the votes in the order they were cast.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "vote_queue.h"
+#include "voted.h"
+#include "phase_timing.h"
+
+typedef struct {
+    int32_t voter;
+    uint8_t candidate;
+    uint32_t cast_at;       /* CYCCNT at the cast */
+} queued_vote_t;
+
+static queued_vote_t vq_ring[VOTE_QUEUE_MAX];
+static uint32_t vq_head = 0;        /* oldest entry */
+static uint32_t vq_pending[JOURNAL_CANDIDATES];
+static vote_queue_stats_t vq_stats;
+static volatile uint8_t vq_busy = 0;   /* in the journal from thread mode: the PVD path keeps out */
+
+/* Empty queue and statistics, as after a reset: the queued votes are dropped */
+void vote_queue_reset(void)
+{
+    vq_head = 0;
+    vq_busy = 0;
+    memset(vq_pending, 0, sizeof(vq_pending));
+    memset(&vq_stats, 0, sizeof(vq_stats));
+}
+
+/* Program one vote; the journal moves it into its own tallies and voted set */
+static int write_vote(journal_t *j, int32_t voter, uint8_t candidate, uint32_t cast_at)
+{
+    uint32_t t0 = phase_timing_now();
+    int st = journal_vote(j, voter, candidate);
+
+    if (st != JOURNAL_OK) {
+        vq_stats.failures++;
+        return st;
+    }
+    phase_timing_record(PT_FLUSH, t0);
+    phase_timing_record(PT_COMMIT, cast_at);
+    return JOURNAL_OK;
+}
+
+static int flush_one(journal_t *j)
+{
+    const queued_vote_t *v = &vq_ring[vq_head];
+    int st;
+
+    if (vq_stats.depth == 0U) return JOURNAL_OK;
+    st = write_vote(j, v->voter, v->candidate, v->cast_at);
+    if (st != JOURNAL_OK) return st;
+    vq_pending[v->candidate]--;
+    vq_head = (vq_head + 1U) % VOTE_QUEUE_MAX;
+    vq_stats.depth--;
+    vq_stats.flushed++;
+    return JOURNAL_OK;
+}
+
+/* Record of the oldest queued vote, from the idle loop. JOURNAL_OK on an empty queue; on a
+ * failure the vote stays at the head for the next call. */
+int vote_queue_flush_one(journal_t *j)
+{
+    int st;
+
+    vq_busy++;
+    st = flush_one(j);
+    vq_busy--;
+    return st;
+}
+
+int vote_queue_flush(journal_t *j)
+{
+    int st = JOURNAL_OK;
+
+    while (vq_stats.depth != 0U && st == JOURNAL_OK) st = vote_queue_flush_one(j);
+    return st;
+}
+
+/* 1 if the voter has voted: a record in the journal, or a vote still queued */
+uint8_t vote_queue_voted(int32_t voter)
+{
+    if (voted_test(voter)) return 1;
+    for (uint32_t i = 0; i < vq_stats.depth; ++i) {
+        if (vq_ring[(vq_head + i) % VOTE_QUEUE_MAX].voter == voter) return 1;
+    }
+    return 0;
+}
+
+/* Whether vote_queue_cast() would take this vote, short of a flash write failing: the journal
+ * is open, the arguments are in range and the voter has not voted yet. For a caller that must
+ * spend something (a card ballot) before casting. */
+int vote_queue_can_cast(const journal_t *j, int32_t voter, uint8_t candidate)
+{
+    if (j->base == NULL) return JOURNAL_ERR;
+    if (voter < 0 || (uint32_t)voter >= j->n_slots || candidate >= JOURNAL_CANDIDATES) return JOURNAL_BAD_ARG;
+    if (vote_queue_voted(voter)) return JOURNAL_BAD_ARG;
+    return JOURNAL_OK;
+}
+
+static int cast(journal_t *j, int32_t voter, uint8_t candidate, uint8_t strict)
+{
+    uint32_t cast_at = phase_timing_now();
+    queued_vote_t *v;
+    int st;
+
+    if (voter < 0 || (uint32_t)voter >= j->n_slots || candidate >= JOURNAL_CANDIDATES) return JOURNAL_BAD_ARG;
+    if (vq_stats.depth != 0U && (strict || vq_stats.depth == VOTE_QUEUE_MAX)) {
+        vq_stats.forced++;
+        do st = flush_one(j); while (strict && st == JOURNAL_OK && vq_stats.depth != 0U);
+        if (st != JOURNAL_OK) return st;
+    }
+    if (strict) {
+        st = write_vote(j, voter, candidate, cast_at);
+        if (st == JOURNAL_OK) vq_stats.cast++;
+        return st;
+    }
+
+    v = &vq_ring[(vq_head + vq_stats.depth) % VOTE_QUEUE_MAX];
+    v->voter = voter;
+    v->candidate = candidate;
+    v->cast_at = cast_at;
+    vq_pending[candidate]++;    /* the voted set takes the voter with the record */
+    vq_stats.depth++;
+    if (vq_stats.depth > vq_stats.max_depth) vq_stats.max_depth = vq_stats.depth;
+    vq_stats.cast++;
+    return JOURNAL_OK;
+}
+
+/* Count a vote. Non-strict: queued, its record written by a later flush. Strict: on flash
+ * before the call returns. Either way the vote is refused (and not counted) if the journal
+ * cannot take it now: a full queue that will not drain, or a strict write that failed. */
+int vote_queue_cast(journal_t *j, int32_t voter, uint8_t candidate, uint8_t strict)
+{
+    int st;
+
+    vq_busy++;
+    st = cast(j, voter, candidate, strict);
+    vq_busy--;
+    return st;
+}
+
+/* journal_service() for the idle loop, fenced off from the PVD path like the flushes */
+void vote_queue_service(journal_t *j)
+{
+    vq_busy++;
+    journal_service(j);
+    vq_busy--;
+}
+
+/* Supply failing (PVD interrupt): program the queued votes and a seal record, as far as the
+ * journal takes them without a rotation. At most VOTE_QUEUE_MAX + 1 records and one
+ * checkpoint, nothing when the interrupt lands inside a journal operation; the backup
+ * registers (vote_backup.h) keep whatever is left. */
+int vote_queue_emergency(journal_t *j)
+{
+    int st = JOURNAL_OK;
+
+    if (vq_busy) {
+        vq_stats.power_fail_busy++;
+        return JOURNAL_ERR;
+    }
+    vq_stats.power_fails++;
+    while (vq_stats.depth != 0U && st == JOURNAL_OK) {
+        st = journal_can_append(j) ? flush_one(j) : JOURNAL_FULL;
+    }
+    if (st != JOURNAL_OK) return st;
+    return journal_seal(j);
+}
+
+uint32_t vote_queue_depth(void)
+{
+    return vq_stats.depth;
+}
+
+/* Tallies including the votes not yet on flash */
+void vote_queue_tally(const journal_t *j, uint32_t tally[JOURNAL_CANDIDATES])
+{
+    for (uint32_t i = 0; i < JOURNAL_CANDIDATES; ++i) tally[i] = j->tally[i] + vq_pending[i];
+}
+
+void vote_queue_get_stats(vote_queue_stats_t *out)
+{
+    *out = vq_stats;
+}
+
+void vote_queue_dump(void)
+{
+    printf("queue depth %lu (max %lu of %lu), cast %lu, flushed %lu, forced %lu, failures %lu\r\n",
+           (unsigned long)vq_stats.depth, (unsigned long)vq_stats.max_depth, (unsigned long)VOTE_QUEUE_MAX,
+           (unsigned long)vq_stats.cast, (unsigned long)vq_stats.flushed, (unsigned long)vq_stats.forced,
+           (unsigned long)vq_stats.failures);
+    printf("power fails %lu, while busy %lu\r\n", (unsigned long)vq_stats.power_fails,
+           (unsigned long)vq_stats.power_fail_busy);
+}
@@ -0,0 +1,58 @@
+/*
+ * voted.c
+ *
+ * Voted set, see voted.h.
+ */
+#include <string.h>
+#include "voted.h"
+
+static uint32_t voted_bits[VOTED_MAX_SLOTS / 32U];
+static uint32_t voted_slots = 0;
+static uint32_t voted_total = 0;
+
+/* Empty set for a roll of n_slots voter indices */
+int voted_reset(uint32_t n_slots)
+{
+    memset(voted_bits, 0, sizeof(voted_bits));
+    voted_total = 0;
+    voted_slots = 0;
+    if (n_slots > VOTED_MAX_SLOTS) return VOTED_TOO_LARGE;
+    voted_slots = n_slots;
+    return VOTED_OK;
+}
+
+void voted_set(int32_t voter)
+{
+    if (voter < 0 || (uint32_t)voter >= voted_slots || voted_test(voter)) return;
+    voted_bits[(uint32_t)voter >> 5] |= 1UL << ((uint32_t)voter & 31U);
+    voted_total++;
+}
+
+/* 1 if the voter has voted. Out-of-range indices, and every index while no set is loaded,
+ * read as not voted: main.c does not open the booth without a journal behind the set. */
+uint8_t voted_test(int32_t voter)
+{
+    if (voter < 0 || (uint32_t)voter >= voted_slots) return 0;
+    return (uint8_t)((voted_bits[(uint32_t)voter >> 5] >> ((uint32_t)voter & 31U)) & 1U);
+}
+
+uint32_t voted_count(void)
+{
+    return voted_total;
+}
+
+/* The bitset words covering the roll, for the journal snapshot; voted_recount() after a load */
+uint32_t *voted_bitmap(uint32_t *n_words)
+{
+    *n_words = (voted_slots + 31U) / 32U;
+    return voted_bits;
+}
+
+void voted_recount(void)
+{
+    voted_total = 0;
+    for (uint32_t i = 0; i < (voted_slots + 31U) / 32U; ++i) {
+        if (i == voted_slots / 32U) voted_bits[i] &= (1UL << (voted_slots & 31U)) - 1U;   /* bits past the roll */
+        voted_total += (uint32_t)__builtin_popcount(voted_bits[i]);
+    }
+}
@@ -0,0 +1,125 @@
+/*
+ * voter_index.c
+ *
+ * Voter roll lookup, see voter_index.h. Also compiled into Tools/votergen so the table is
+ * built with exactly the hash the firmware uses.
+ */
+#include <string.h>
+#include "voter_index.h"
+
+static uint32_t rotl32(uint32_t x, uint32_t r)
+{
+    return (x << r) | (x >> (32U - r));
+}
+
+/* Murmur3 finalizer */
+static uint32_t mix32(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85EBCA6BU;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35U;
+    h ^= h >> 16;
+    return h;
+}
+
+/* h mapped onto 0..n-1 with a multiply instead of a division */
+static uint32_t range32(uint32_t h, uint32_t n)
+{
+    return (uint32_t)(((uint64_t)h * n) >> 32);
+}
+
+void voter_index_key(uint8_t key[VOTER_KEY_LEN], const uint8_t *uid, uint8_t size)
+{
+    if (size > VOTER_UID_MAX) size = VOTER_UID_MAX;
+    memset(key, 0, VOTER_KEY_LEN);
+    key[0] = size;
+    memcpy(&key[1], uid, size);
+}
+
+/* Murmur3 (x86_32) over the fixed 12-byte key, little endian on host and target alike */
+uint32_t voter_index_hash(const uint8_t key[VOTER_KEY_LEN], uint32_t seed)
+{
+    uint32_t h = seed;
+
+    for (uint32_t i = 0; i < VOTER_KEY_LEN; i += 4) {
+        uint32_t k = (uint32_t)key[i] | ((uint32_t)key[i + 1] << 8) |
+                     ((uint32_t)key[i + 2] << 16) | ((uint32_t)key[i + 3] << 24);
+        k *= 0xCC9E2D51U;
+        k = rotl32(k, 15);
+        k *= 0x1B873593U;
+        h ^= k;
+        h = rotl32(h, 13);
+        h = h * 5U + 0xE6546B64U;
+    }
+    return mix32(h ^ VOTER_KEY_LEN);
+}
+
+uint32_t voter_index_bucket(const voter_index_t *vi, const uint8_t key[VOTER_KEY_LEN])
+{
+    return range32(voter_index_hash(key, vi->seed), vi->n_buckets);
+}
+
+/* Slot of a key whose bucket has displacement disp */
+uint32_t voter_index_slot(const voter_index_t *vi, const uint8_t key[VOTER_KEY_LEN], uint16_t disp)
+{
+    uint32_t h = voter_index_hash(key, vi->seed + 1U);
+    return range32(mix32(h ^ ((uint32_t)disp * 0x9E3779B9U)), vi->n_slots);
+}
+
+/* 1..65535, 0 marks an empty slot */
+uint16_t voter_index_fingerprint(const voter_index_t *vi, const uint8_t key[VOTER_KEY_LEN])
+{
+    return (uint16_t)(range32(voter_index_hash(key, vi->seed + 2U), 0xFFFFU) + 1U);
+}
+
+/* Voter index of a UID, VOTER_NONE if it is not on the roll. Same hashing for every UID; the
+ * stored key is compared only when the fingerprint matches. */
+int32_t voter_index_lookup(const voter_index_t *vi, const uint8_t *uid, uint8_t size)
+{
+    uint8_t key[VOTER_KEY_LEN];
+    uint32_t slot;
+
+    if (vi->n_slots == 0) return VOTER_NONE;
+    voter_index_key(key, uid, size);
+    slot = voter_index_slot(vi, key, vi->disp[voter_index_bucket(vi, key)]);
+    if (vi->fp[slot] != voter_index_fingerprint(vi, key)) return VOTER_NONE;
+    if (memcmp(&vi->keys[slot * VOTER_SLOT_KEY], key, VOTER_SLOT_KEY) != 0) return VOTER_NONE;
+    return (int32_t)slot;
+}
+
+/* Prefilter probes: one hash, the others by double hashing (h1 + i * h2) */
+static void bloom_hashes(const voter_index_t *vi, const uint8_t key[VOTER_KEY_LEN], uint32_t *h1, uint32_t *h2)
+{
+    *h1 = voter_index_hash(key, vi->seed + 3U);
+    *h2 = mix32(*h1 ^ 0x9E3779B9U) | 1U;
+}
+
+/* Set the prefilter bits of a key (host tool) */
+void voter_index_bloom_add(const voter_index_t *vi, uint32_t *bloom, const uint8_t key[VOTER_KEY_LEN])
+{
+    uint32_t h1, h2;
+
+    bloom_hashes(vi, key, &h1, &h2);
+    for (uint32_t i = 0; i < vi->bloom_k; i++, h1 += h2) {
+        uint32_t bit = range32(h1, vi->bloom_bits);
+        bloom[bit >> 5] |= 1UL << (bit & 31U);
+    }
+}
+
+/* 0 if the UID is certainly not on the roll; 1 if it may be (or there is no prefilter).
+ * Stops at the first clear bit, so an unknown card usually costs one or two probes. */
+uint8_t voter_index_maybe(const voter_index_t *vi, const uint8_t *uid, uint8_t size)
+{
+    uint8_t key[VOTER_KEY_LEN];
+    uint32_t h1, h2;
+
+    if (vi->bloom == NULL || vi->bloom_bits == 0U) return 1;
+    voter_index_key(key, uid, size);
+    bloom_hashes(vi, key, &h1, &h2);
+    for (uint32_t i = 0; i < vi->bloom_k; i++, h1 += h2) {
+        uint32_t bit = range32(h1, vi->bloom_bits);
+        if ((vi->bloom[bit >> 5] & (1UL << (bit & 31U))) == 0U) return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,91 @@
+/*
+ * voter_roll.c
+ *
+ * Voter roll image checks and access, see voter_roll.h. Also compiled into Tools/votergen,
+ * which opens every image it writes before handing it out.
+ */
+#include <stddef.h>
+#include <string.h>
+#include "voter_roll.h"
+
+/* CRC-32 (IEEE, reflected 0xEDB88320), 4 bits at a time: 64 bytes of table instead of 1 KB */
+static const uint32_t crc32_nibble[16] = {
+    0x00000000U, 0x1DB71064U, 0x3B6E20C8U, 0x26D930ACU, 0x76DC4190U, 0x6B6B51F4U, 0x4DB26158U, 0x5005713CU,
+    0xEDB88320U, 0xF00F9344U, 0xD6D6A3E8U, 0xCB61B38CU, 0x9B64C2B0U, 0x86D3D2D4U, 0xA00AE278U, 0xBDBDF21CU
+};
+
+/* Chains like zlib's crc32(): crc32(crc32(0, a), b) == crc32(0, a b) */
+uint32_t voter_roll_crc32(uint32_t crc, const uint8_t *data, uint32_t len)
+{
+    crc = ~crc;
+    while (len--) {
+        crc ^= *data++;
+        crc = (crc >> 4) ^ crc32_nibble[crc & 0x0FU];
+        crc = (crc >> 4) ^ crc32_nibble[crc & 0x0FU];
+    }
+    return ~crc;
+}
+
+/* count records of size bytes at offset lie inside the image, after the header, aligned */
+static int table_fits(const voter_roll_header_t *h, uint32_t offset, uint32_t count, uint32_t size)
+{
+    if ((offset & 3U) != 0U || offset < h->header_size || offset > h->image_size) return 0;
+    return (uint64_t)count * size <= (uint64_t)(h->image_size - offset);
+}
+
+/* Checks the image at image (region_size bytes of flash) and, if it is sound, points roll at it.
+ * On any error roll is left empty: every lookup returns VOTER_NONE. */
+int voter_roll_open(voter_roll_t *roll, const void *image, uint32_t region_size)
+{
+    const voter_roll_header_t *h = (const voter_roll_header_t *)image;
+    const uint8_t *p = (const uint8_t *)image;
+    const uint32_t crc_at = (uint32_t)offsetof(voter_roll_header_t, crc);
+    static const uint8_t zero[4] = { 0 };
+    uint32_t crc;
+
+    memset(roll, 0, sizeof(*roll));
+    if (region_size < sizeof(*h)) return VOTER_ROLL_BAD_LAYOUT;
+    if (h->magic == 0xFFFFFFFFU) return VOTER_ROLL_BLANK;
+    if (h->magic != VOTER_ROLL_MAGIC) return VOTER_ROLL_BAD_MAGIC;
+    if (h->version != VOTER_ROLL_VERSION || h->header_size != sizeof(*h) ||
+        h->meta_size != sizeof(voter_meta_t)) return VOTER_ROLL_BAD_VERSION;
+
+    if (h->image_size > region_size || h->image_size < h->header_size) return VOTER_ROLL_BAD_LAYOUT;
+    if (h->n_voters > h->n_slots || (h->n_slots == 0U) != (h->n_buckets == 0U)) return VOTER_ROLL_BAD_LAYOUT;
+    if (!table_fits(h, h->disp_offset, h->n_buckets, sizeof(uint16_t)) ||
+        !table_fits(h, h->fp_offset, h->n_slots, sizeof(uint16_t)) ||
+        !table_fits(h, h->key_offset, h->n_slots, VOTER_SLOT_KEY) ||
+        !table_fits(h, h->meta_offset, h->n_slots, h->meta_size)) return VOTER_ROLL_BAD_LAYOUT;
+    if (h->bloom_bits != 0U && ((h->bloom_bits & 31U) != 0U || h->bloom_k == 0U || h->bloom_k > 32U ||
+                                !table_fits(h, h->bloom_offset, h->bloom_bits / 32U, sizeof(uint32_t))))
+        return VOTER_ROLL_BAD_LAYOUT;
+
+    /* One pass over the image, the stored CRC counted as zero */
+    crc = voter_roll_crc32(0U, p, crc_at);
+    crc = voter_roll_crc32(crc, zero, sizeof(zero));
+    crc = voter_roll_crc32(crc, p + crc_at + 4U, h->image_size - crc_at - 4U);
+    if (crc != h->crc) return VOTER_ROLL_BAD_CRC;
+
+    roll->hdr = h;
+    roll->index.seed = h->seed;
+    roll->index.n_slots = h->n_slots;
+    roll->index.n_buckets = h->n_buckets;
+    roll->index.n_voters = h->n_voters;
+    roll->index.disp = (const uint16_t *)(p + h->disp_offset);
+    roll->index.fp = (const uint16_t *)(p + h->fp_offset);
+    roll->index.keys = p + h->key_offset;
+    roll->meta = (const voter_meta_t *)(p + h->meta_offset);
+    if (h->bloom_bits != 0U) {
+        roll->index.bloom_bits = h->bloom_bits;
+        roll->index.bloom_k = h->bloom_k;
+        roll->index.bloom = (const uint32_t *)(p + h->bloom_offset);
+    }
+    return VOTER_ROLL_OK;
+}
+
+/* Metadata of a voter index from voter_index_lookup(), NULL for VOTER_NONE */
+const voter_meta_t *voter_roll_meta(const voter_roll_t *roll, int32_t voter)
+{
+    if (roll->meta == NULL || voter < 0 || (uint32_t)voter >= roll->index.n_slots) return NULL;
+    return &roll->meta[voter];
+}
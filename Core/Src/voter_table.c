@@ -0,0 +1,38 @@
+/*
+ * voter_table.c
+ *
+ * Generated by Tools/votergen from roll.csv, do not edit.
+ * 2 voters, 3 slots, 1 buckets, 45 bytes.
+ */
+#include "voter_index.h"
+
+static const uint16_t voter_disp[1] = {
+    0x0001U,
+};
+
+static const uint16_t voter_fp[3] = {
+    0x453DU, 0x0A5DU, 0x0000U,
+};
+
+static const uint8_t voter_keys[33] = {
+    0x04U, 0x73U, 0x91U, 0xB1U, 0x28U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U,
+    0x04U, 0x96U, 0x7CU, 0x41U, 0x1EU, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U,
+    0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U, 0x00U,
+};
+
+static const uint32_t voter_bloom[1] = {
+    0x7333119DU,
+};
+
+const voter_index_t voter_table = {
+    .seed = 0x5EEDB007U,
+    .n_slots = 3U,
+    .n_buckets = 1U,
+    .n_voters = 2U,
+    .disp = voter_disp,
+    .fp = voter_fp,
+    .keys = voter_keys,
+    .bloom_bits = 32U,
+    .bloom_k = 11U,
+    .bloom = voter_bloom,
+};
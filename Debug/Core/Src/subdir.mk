@@ -5,31 +5,55 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
+../Core/Src/journal.c \
 ../Core/Src/main.c \
+../Core/Src/phase_timing.c \
 ../Core/Src/rc522.c \
 ../Core/Src/stm32f4xx_hal_msp.c \
 ../Core/Src/stm32f4xx_it.c \
 ../Core/Src/syscalls.c \
 ../Core/Src/sysmem.c \
-../Core/Src/system_stm32f4xx.c 
+../Core/Src/system_stm32f4xx.c \
+../Core/Src/vote_backup.c \
+../Core/Src/vote_queue.c \
+../Core/Src/voted.c \
+../Core/Src/voter_index.c \
+../Core/Src/voter_roll.c \
+../Core/Src/voter_table.c 
 
 OBJS += \
+./Core/Src/journal.o \
 ./Core/Src/main.o \
+./Core/Src/phase_timing.o \
 ./Core/Src/rc522.o \
 ./Core/Src/stm32f4xx_hal_msp.o \
 ./Core/Src/stm32f4xx_it.o \
 ./Core/Src/syscalls.o \
 ./Core/Src/sysmem.o \
-./Core/Src/system_stm32f4xx.o 
+./Core/Src/system_stm32f4xx.o \
+./Core/Src/vote_backup.o \
+./Core/Src/vote_queue.o \
+./Core/Src/voted.o \
+./Core/Src/voter_index.o \
+./Core/Src/voter_roll.o \
+./Core/Src/voter_table.o 
 
 C_DEPS += \
+./Core/Src/journal.d \
 ./Core/Src/main.d \
+./Core/Src/phase_timing.d \
 ./Core/Src/rc522.d \
 ./Core/Src/stm32f4xx_hal_msp.d \
 ./Core/Src/stm32f4xx_it.d \
 ./Core/Src/syscalls.d \
 ./Core/Src/sysmem.d \
-./Core/Src/system_stm32f4xx.d 
+./Core/Src/system_stm32f4xx.d \
+./Core/Src/vote_backup.d \
+./Core/Src/vote_queue.d \
+./Core/Src/voted.d \
+./Core/Src/voter_index.d \
+./Core/Src/voter_roll.d \
+./Core/Src/voter_table.d 
 
 
 # Each subdirectory must supply rules for building sources it contributes
@@ -39,7 +63,7 @@ Core/Src/%.o Core/Src/%.su Core/Src/%.cyclo: ../Core/Src/%.c Core/Src/subdir.mk
 clean: clean-Core-2f-Src
 
 clean-Core-2f-Src:
-	-$(RM) ./Core/Src/main.cyclo ./Core/Src/main.d ./Core/Src/main.o ./Core/Src/main.su ./Core/Src/rc522.cyclo ./Core/Src/rc522.d ./Core/Src/rc522.o ./Core/Src/rc522.su ./Core/Src/stm32f4xx_hal_msp.cyclo ./Core/Src/stm32f4xx_hal_msp.d ./Core/Src/stm32f4xx_hal_msp.o ./Core/Src/stm32f4xx_hal_msp.su ./Core/Src/stm32f4xx_it.cyclo ./Core/Src/stm32f4xx_it.d ./Core/Src/stm32f4xx_it.o ./Core/Src/stm32f4xx_it.su ./Core/Src/syscalls.cyclo ./Core/Src/syscalls.d ./Core/Src/syscalls.o ./Core/Src/syscalls.su ./Core/Src/sysmem.cyclo ./Core/Src/sysmem.d ./Core/Src/sysmem.o ./Core/Src/sysmem.su ./Core/Src/system_stm32f4xx.cyclo ./Core/Src/system_stm32f4xx.d ./Core/Src/system_stm32f4xx.o ./Core/Src/system_stm32f4xx.su
+	-$(RM) ./Core/Src/journal.cyclo ./Core/Src/journal.d ./Core/Src/journal.o ./Core/Src/journal.su ./Core/Src/main.cyclo ./Core/Src/main.d ./Core/Src/main.o ./Core/Src/main.su ./Core/Src/phase_timing.cyclo ./Core/Src/phase_timing.d ./Core/Src/phase_timing.o ./Core/Src/phase_timing.su ./Core/Src/rc522.cyclo ./Core/Src/rc522.d ./Core/Src/rc522.o ./Core/Src/rc522.su ./Core/Src/stm32f4xx_hal_msp.cyclo ./Core/Src/stm32f4xx_hal_msp.d ./Core/Src/stm32f4xx_hal_msp.o ./Core/Src/stm32f4xx_hal_msp.su ./Core/Src/stm32f4xx_it.cyclo ./Core/Src/stm32f4xx_it.d ./Core/Src/stm32f4xx_it.o ./Core/Src/stm32f4xx_it.su ./Core/Src/syscalls.cyclo ./Core/Src/syscalls.d ./Core/Src/syscalls.o ./Core/Src/syscalls.su ./Core/Src/sysmem.cyclo ./Core/Src/sysmem.d ./Core/Src/sysmem.o ./Core/Src/sysmem.su ./Core/Src/system_stm32f4xx.cyclo ./Core/Src/system_stm32f4xx.d ./Core/Src/system_stm32f4xx.o ./Core/Src/system_stm32f4xx.su ./Core/Src/vote_backup.cyclo ./Core/Src/vote_backup.d ./Core/Src/vote_backup.o ./Core/Src/vote_backup.su ./Core/Src/vote_queue.cyclo ./Core/Src/vote_queue.d ./Core/Src/vote_queue.o ./Core/Src/vote_queue.su ./Core/Src/voted.cyclo ./Core/Src/voted.d ./Core/Src/voted.o ./Core/Src/voted.su ./Core/Src/voter_index.cyclo ./Core/Src/voter_index.d ./Core/Src/voter_index.o ./Core/Src/voter_index.su ./Core/Src/voter_roll.cyclo ./Core/Src/voter_roll.d ./Core/Src/voter_roll.o ./Core/Src/voter_roll.su ./Core/Src/voter_table.cyclo ./Core/Src/voter_table.d ./Core/Src/voter_table.o ./Core/Src/voter_table.su
 
 .PHONY: clean-Core-2f-Src
 
@@ -0,0 +1,799 @@
+/*
+ * Vote journal benchmark on the flash model: flash cost per vote with and without the idle
+ * service, rotations and erases, boot replay time, then power cuts at every kind of flash
+ * operation. After each cut the journal is reopened the way the firmware boots and must hold
+ * every vote that journal_vote() confirmed, plus at most the one that was being written.
+ * Between the two, boot recovery time over a 100 000-record day, votes after a rejected word
+ * program, and the write-behind queue: the wait it saves the button handler and the votes a
+ * power cut can take from it, with and without the backup-register mirror. Last, the power-fail path: how long the PVD interrupt
+ * takes to program a full queue and the seal record, and that nothing is lost when it runs.
+ *
+ * Usage: flash_bench [flash.bin] [trials]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "flash_sim.h"
+#include "journal.h"
+#include "voted.h"
+#include "voter_roll.h"
+#include "vote_queue.h"
+#include "vote_backup.h"
+#include "phase_timing.h"
+
+// JOURNAL in STM32F401CCUX_FLASH.ld: sectors 2 and 3
+#define JOURNAL_FIRST	2U
+#define ROLL_KEY		0x5EED0001U
+#define N_SLOTS			37000U
+
+static journal_t journal;
+static const uint8_t *base;
+static uint32_t sectorSize;
+
+// Reference model: what has been confirmed so far
+static uint8_t refVoted[N_SLOTS];
+static uint32_t refTally[JOURNAL_CANDIDATES];
+static uint32_t refCount;
+
+// The vote being written when the power went, -1 for none (static: survives the longjmp)
+static int32_t inflightVoter = -1;
+static uint8_t inflightCand;
+static jmp_buf cutEnv;
+
+static uint32_t rngState = 0x2545F491U;
+
+static uint32_t rnd(void)
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState;
+}
+
+static double host_us(const struct timespec *t0)
+{
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) * 1e6 + (t1.tv_nsec - t0->tv_nsec) / 1e3;
+}
+
+static void ref_reset(void)
+{
+	memset(refVoted, 0, sizeof(refVoted));
+	memset(refTally, 0, sizeof(refTally));
+	refCount = 0;
+}
+
+static int open_journal(uint32_t key)
+{
+	return journal_open(&journal, base, sectorSize, JOURNAL_FIRST, key, N_SLOTS);
+}
+
+// A voter who has not voted yet
+static int32_t pick_voter(void)
+{
+	int32_t v;
+
+	do
+	{
+		v = (int32_t)(rnd() % N_SLOTS);
+	} while (refVoted[v]);
+	return v;
+}
+
+static int vote(void)
+{
+	int32_t v = pick_voter();
+	uint8_t c = (uint8_t)(rnd() % JOURNAL_CANDIDATES);
+	int st;
+
+	inflightVoter = v;
+	inflightCand = c;
+	st = journal_vote(&journal, v, c);
+	inflightVoter = -1;
+	if (st != JOURNAL_OK)
+	{
+		return st;
+	}
+	refVoted[v] = 1;
+	refTally[c]++;
+	refCount++;
+	return JOURNAL_OK;
+}
+
+// 1 when the journal holds exactly the reference, plus voter/cand if voter >= 0
+static int matches(int32_t voter, uint8_t cand)
+{
+	uint32_t count = refCount + (voter >= 0);
+
+	for (uint32_t c = 0; c < JOURNAL_CANDIDATES; c++)
+	{
+		if (journal.tally[c] != refTally[c] + (voter >= 0 && c == cand))
+		{
+			return 0;
+		}
+	}
+	if (voted_count() != count)
+	{
+		return 0;
+	}
+	for (int32_t i = 0; i < (int32_t)N_SLOTS; i++)
+	{
+		if (voted_test(i) != (refVoted[i] || i == voter))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Votes on a fresh journal, the idle service after every `serviceEvery` votes (0: never)
+static int run_votes(const char *name, uint32_t votes, uint32_t serviceEvery)
+{
+	FlashSim_Stats s0, s1;
+	uint64_t voteNs = 0, worstNs = 0;
+	uint32_t worstErases = 0;
+	int failed = 0;
+
+	flash_sim_erase_chip();
+	flash_sim_reset_stats();
+	ref_reset();
+	if (open_journal(ROLL_KEY) != JOURNAL_FORMATTED)
+	{
+		printf("%-16s open of a blank region did not format\n", name);
+		return 1;
+	}
+	for (uint32_t i = 0; i < votes; i++)
+	{
+		uint64_t e0;
+
+		flash_sim_stats(&s0);
+		e0 = journal.erases;
+		if (vote() != JOURNAL_OK)
+		{
+			failed = 1;
+			break;
+		}
+		flash_sim_stats(&s1);
+		voteNs += s1.timeNs - s0.timeNs;
+		if (s1.timeNs - s0.timeNs > worstNs)
+		{
+			worstNs = s1.timeNs - s0.timeNs;
+			worstErases = journal.erases - e0;
+		}
+		if (serviceEvery != 0U && (i + 1U) % serviceEvery == 0U)
+		{
+			journal_service(&journal);
+		}
+	}
+
+	uint32_t rotations = journal.rotations, erases = journal.erases;
+	uint64_t programs;
+	struct timespec t0;
+	double openUs;
+
+	flash_sim_stats(&s1);
+	programs = s1.programs;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (open_journal(ROLL_KEY) != JOURNAL_OK)
+	{
+		failed = 1;
+	}
+	openUs = host_us(&t0);
+	failed |= !matches(-1, 0);
+
+	printf("%-16s %6u %9.2f %9.1f %10.1f %7u %8u %7u %9u %9.1f   %s\n", name, votes,
+		   (double)programs / votes, voteNs / 1e3 / votes, worstNs / 1e3, worstErases, rotations, erases,
+		   journal.replayed, openUs, failed ? "FAILED" : "ok");
+	return failed;
+}
+
+// Boot time against the length of the day: RECOVERY_RECORDS votes (voters may repeat, the
+// journal does not refuse them) with the idle service after each, and a power cycle every
+// RECOVERY_STEP. scan_us is the alternative of one log checked record by record from the
+// first vote, which grows with the day where the journal's replay does not.
+#define RECOVERY_RECORDS	100000U
+#define RECOVERY_STEP		10000U
+
+static int recovery(void)
+{
+	static const uint8_t *scanRec[RECOVERY_RECORDS];
+	uint32_t nScan = 0, rotations = 0, checkpoints = 0;
+	double worstUs = 0;
+	int failed = 0;
+
+	flash_sim_erase_chip();
+	ref_reset();
+	if (open_journal(ROLL_KEY) != JOURNAL_FORMATTED)
+	{
+		return 1;
+	}
+	printf("\n%8s %9s %11s %8s %8s %9s %9s\n", "records", "rotations", "checkpoints", "replayed", "checked",
+		   "open_us", "scan_us");
+	for (uint32_t n = 1; n <= RECOVERY_RECORDS; n++)
+	{
+		int32_t v = (int32_t)(rnd() % N_SLOTS);
+		uint8_t c = (uint8_t)(rnd() % JOURNAL_CANDIDATES);
+
+		scanRec[nScan++] = base + (uint32_t)journal.active * sectorSize + journal.head;
+		if (journal_vote(&journal, v, c) != JOURNAL_OK)
+		{
+			failed = 1;
+			break;
+		}
+		refCount += !refVoted[v];
+		refVoted[v] = 1;
+		refTally[c]++;
+		journal_service(&journal);
+		if (n % RECOVERY_STEP != 0U)
+		{
+			continue;
+		}
+
+		struct timespec t0;
+		double openUs, scanUs;
+		volatile uint32_t sink = 0;
+
+		rotations += journal.rotations;
+		checkpoints += journal.checkpoints;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		if (open_journal(ROLL_KEY) != JOURNAL_OK || !matches(-1, 0))
+		{
+			failed = 1;
+		}
+		openUs = host_us(&t0);
+		if (openUs > worstUs)
+		{
+			worstUs = openUs;
+		}
+
+		// What a plain log would cost: a CRC per record since the first vote of the day
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for (uint32_t i = 0; i < nScan; i++)
+		{
+			sink += voter_roll_crc32(0U, scanRec[i], 12U);
+		}
+		scanUs = host_us(&t0);
+		(void)sink;
+
+		printf("%8u %9u %11u %8u %8u %9.1f %9.1f\n", n, rotations, checkpoints, journal.replayed, journal.checked,
+			   openUs, scanUs);
+	}
+	printf("recovery: worst %.1f us over %u records, %s\n", worstUs, RECOVERY_RECORDS, failed ? "FAILED" : "ok");
+	return failed;
+}
+
+// Write-behind queue: `idle` superloop passes (one flush or service each) after every cast,
+// 0 for a queue that is always full. cast_us is what the button handler waits for.
+static int queue_run(const char *name, uint8_t strict, uint32_t votes, uint32_t idle)
+{
+	FlashSim_Stats s0, s1;
+	uint64_t castNs = 0, worstNs = 0;
+	uint32_t tally[JOURNAL_CANDIDATES];
+	vote_queue_stats_t qs;
+	phase_stats_t flush, commit;
+	uint32_t perUs = FLASH_SIM_CORE_HZ / 1000000U;
+	int failed = 0;
+
+	flash_sim_erase_chip();
+	ref_reset();
+	vote_queue_reset();
+	if (open_journal(ROLL_KEY) != JOURNAL_FORMATTED)
+	{
+		return 1;
+	}
+	phase_timing_reset();
+	for (uint32_t i = 0; i < votes; i++)
+	{
+		int32_t v = pick_voter();
+		uint8_t c = (uint8_t)(rnd() % JOURNAL_CANDIDATES);
+
+		flash_sim_stats(&s0);
+		if (vote_queue_cast(&journal, v, c, strict) != JOURNAL_OK)
+		{
+			failed = 1;
+			break;
+		}
+		flash_sim_stats(&s1);
+		castNs += s1.timeNs - s0.timeNs;
+		if (s1.timeNs - s0.timeNs > worstNs)
+		{
+			worstNs = s1.timeNs - s0.timeNs;
+		}
+		refVoted[v] = 1;
+		refTally[c]++;
+		refCount++;
+		for (uint32_t k = 0; k < idle; k++)
+		{
+			if (vote_queue_depth() != 0U)
+			{
+				vote_queue_flush_one(&journal);
+			}
+			else
+			{
+				vote_queue_service(&journal);
+			}
+		}
+	}
+
+	// Counted at once, whether on flash yet or not; the voted set only holds what is on flash
+	vote_queue_tally(&journal, tally);
+	failed |= (tally[0] != refTally[0] || tally[1] != refTally[1] || tally[2] != refTally[2] ||
+			   voted_count() + vote_queue_depth() != refCount);
+	vote_queue_get_stats(&qs);
+	phase_timing_get(PT_FLUSH, &flush);
+	phase_timing_get(PT_COMMIT, &commit);
+	failed |= (vote_queue_flush(&journal) != JOURNAL_OK);
+	failed |= (open_journal(ROLL_KEY) != JOURNAL_OK || !matches(-1, 0));
+
+	printf("%-16s %6u %9.1f %10.1f %6u %7u %9lu %9lu %10lu   %s\n", name, votes, castNs / 1e3 / votes,
+		   worstNs / 1e3, qs.max_depth, qs.forced, (unsigned long)(flush.avg / perUs),
+		   (unsigned long)(flush.max / perUs), (unsigned long)(commit.max / perUs), failed ? "FAILED" : "ok");
+	return failed;
+}
+
+// RTC backup registers: survive the cut like the flash file
+static uint32_t backupRegs[VOTE_BACKUP_REGS];
+
+// Power cuts with the queue: the journal must hold the votes in cast order, missing at most
+// the ones still queued (none for strict casts, none once the backup mirror is reconciled)
+static int queue_cuts(uint8_t strict, uint8_t backup, uint32_t trials, uint32_t *worstLost)
+{
+	uint32_t bound = (strict || backup) ? 0U : VOTE_QUEUE_MAX;
+	uint32_t missing = 0;
+
+	static int32_t castVoter[1500];
+	static uint8_t castCand[1500];
+	static volatile uint32_t accepted;
+	volatile int failed = 0;	// written between setjmp and the cut's longjmp
+	volatile uint32_t t;
+
+	for (t = 0; t < trials; t++)
+	{
+		uint32_t target = 20U + rnd() % 1480U;		// past the first rotation in about half the trials
+		uint32_t tally[JOURNAL_CANDIDATES] = { 0 };
+		uint32_t k;
+
+		flash_sim_erase_chip();
+		ref_reset();
+		vote_queue_reset();
+		if (open_journal(ROLL_KEY) != JOURNAL_FORMATTED)
+		{
+			return 1;
+		}
+		memset(backupRegs, 0, sizeof(backupRegs));
+		if (backup)
+		{
+			vote_backup_open(backupRegs, &journal, &missing);
+		}
+		accepted = 0;
+		flash_sim_cut_after((int64_t)(rnd() % (target * 3U)), &cutEnv);
+		if (setjmp(cutEnv) == 0)
+		{
+			while (accepted < target)
+			{
+				int32_t v = pick_voter();
+				uint8_t c = (uint8_t)(rnd() % JOURNAL_CANDIDATES);
+
+				if (vote_queue_cast(&journal, v, c, strict) != JOURNAL_OK)
+				{
+					failed = 1;
+					break;
+				}
+				if (backup)
+				{
+					vote_backup_record(v, c);
+				}
+				castVoter[accepted] = v;
+				castCand[accepted] = c;
+				refVoted[v] = 1;
+				accepted++;
+				for (uint32_t idle = rnd() % 3U; idle > 0; idle--)
+				{
+					vote_queue_flush_one(&journal);
+				}
+			}
+			flash_sim_cut_after(-1, NULL);
+		}
+
+		// Boot: RAM is gone
+		vote_queue_reset();
+		if (open_journal(ROLL_KEY) != JOURNAL_OK)
+		{
+			printf("queue trial %u: journal lost after the cut\n", t);
+			return 1;
+		}
+		if (backup)
+		{
+			vote_backup_open(backupRegs, &journal, &missing);
+			failed |= (missing != 0U);
+		}
+		k = voted_count();
+		for (uint32_t i = 0; i < k && i < accepted; i++)
+		{
+			tally[castCand[i]]++;
+			failed |= !voted_test(castVoter[i]);
+		}
+		if (k > accepted || accepted - k > bound ||
+			memcmp(tally, journal.tally, sizeof(tally)) != 0)
+		{
+			printf("queue trial %u: %u of %u cast votes on flash, not the oldest ones\n", t, k, accepted);
+			failed = 1;
+		}
+		else if (accepted - k > *worstLost)
+		{
+			*worstLost = accepted - k;
+		}
+	}
+	return failed;
+}
+
+// A rotation while votes are queued: the journal is filled to its last record slot, a full
+// queue plus one more vote forces the oldest out, which rotates, and the power goes before
+// the rest are flushed. The new sector's snapshot must hold only votes with a record, so
+// after the boot every voter marked as voted has a counted vote.
+static int queue_rotation(void)
+{
+	int32_t queued[VOTE_QUEUE_MAX + 1U];
+	uint32_t rotations, counted = 0;
+	int failed = 0;
+
+	flash_sim_erase_chip();
+	ref_reset();
+	vote_queue_reset();
+	if (open_journal(ROLL_KEY) != JOURNAL_FORMATTED)
+	{
+		return 1;
+	}
+	while (journal_can_append(&journal))
+	{
+		failed |= (vote() != JOURNAL_OK);
+	}
+	rotations = journal.rotations;
+	for (uint32_t i = 0; i <= VOTE_QUEUE_MAX; i++)
+	{
+		queued[i] = pick_voter();
+		refVoted[queued[i]] = 1;
+		failed |= (vote_queue_cast(&journal, queued[i], 0U, 0U) != JOURNAL_OK);
+	}
+	failed |= (journal.rotations != rotations + 1U);
+
+	// Boot: RAM is gone, the queue with it
+	vote_queue_reset();
+	failed |= (open_journal(ROLL_KEY) != JOURNAL_OK);
+	for (uint32_t c = 0; c < JOURNAL_CANDIDATES; c++)
+	{
+		counted += journal.tally[c];
+	}
+	failed |= (voted_count() != counted || counted != refCount + 1U || !voted_test(queued[0]));
+	for (uint32_t i = 1; i <= VOTE_QUEUE_MAX; i++)
+	{
+		failed |= voted_test(queued[i]);
+	}
+	printf("queued        rotation then cut: %u voters marked, %u votes counted   %s\n", voted_count(), counted,
+		   failed ? "FAILED" : "ok");
+	return failed;
+}
+
+// Backup mirror after a cut with a full queue. The voted set already holds the lost voters,
+// as a snapshot taken with them queued would have, and the last vote's record was cut short
+// after its ring entry (vote_backup.c: count in register 2, tallies from 3). The mirror is
+// reconciled by vote ordinal, not by the voted set, so every vote comes back.
+static int backup_reconcile(void)
+{
+	int32_t queued[VOTE_QUEUE_MAX];
+	uint32_t missing = 0, recovered, counted = 0;
+	uint8_t c = 0;
+	int failed = 0;
+
+	flash_sim_erase_chip();
+	ref_reset();
+	vote_queue_reset();
+	memset(backupRegs, 0, sizeof(backupRegs));
+	if (open_journal(ROLL_KEY) != JOURNAL_FORMATTED)
+	{
+		return 1;
+	}
+	vote_backup_open(backupRegs, &journal, &missing);
+	for (uint32_t i = 0; i < 10U + VOTE_QUEUE_MAX; i++)
+	{
+		int32_t v = pick_voter();
+
+		c = (uint8_t)(rnd() % JOURNAL_CANDIDATES);
+		refVoted[v] = 1;
+		failed |= (vote_queue_cast(&journal, v, c, 0U) != JOURNAL_OK);
+		vote_backup_record(v, c);
+		if (i < 10U)
+		{
+			failed |= (vote_queue_flush(&journal) != JOURNAL_OK);
+		}
+		else
+		{
+			queued[i - 10U] = v;
+		}
+	}
+	backupRegs[2]--;
+	backupRegs[3U + c]--;
+
+	// Boot: RAM is gone, the queue with it
+	vote_queue_reset();
+	failed |= (open_journal(ROLL_KEY) != JOURNAL_OK);
+	for (uint32_t i = 0; i < VOTE_QUEUE_MAX; i++)
+	{
+		voted_set(queued[i]);
+	}
+	recovered = vote_backup_open(backupRegs, &journal, &missing);
+	for (uint32_t i = 0; i < JOURNAL_CANDIDATES; i++)
+	{
+		counted += journal.tally[i];
+	}
+	failed |= (recovered != VOTE_QUEUE_MAX || missing != 0U || counted != 10U + VOTE_QUEUE_MAX);
+	printf("queued+backup voters marked, votes lost: %u recovered, %u missing, %u counted   %s\n", recovered,
+		   missing, counted, failed ? "FAILED" : "ok");
+	return failed;
+}
+
+// A word program rejected at every position of a stretch of records and a checkpoint: the
+// vote being written is refused, later votes must still be there after a reboot. A slot or
+// checkpoint left erased mid-sector would end the replay and drop them.
+static int program_errors(void)
+{
+	uint32_t refused = 0;
+	int failed = 0;
+
+	for (uint32_t at = 0; at < 60U; at++)
+	{
+		flash_sim_erase_chip();
+		ref_reset();
+		if (open_journal(ROLL_KEY) != JOURNAL_FORMATTED)
+		{
+			return 1;
+		}
+		for (uint32_t i = 0; i < 25U; i++)
+		{
+			failed |= (vote() != JOURNAL_OK);
+		}
+		flash_sim_fail_after((int64_t)at);
+		for (uint32_t i = 0; i < 20U; i++)
+		{
+			refused += (vote() != JOURNAL_OK);
+		}
+		flash_sim_fail_after(-1);
+		if (open_journal(ROLL_KEY) != JOURNAL_OK || !matches(-1, 0))
+		{
+			printf("program error at word %u: votes after it lost\n", at);
+			failed = 1;
+		}
+	}
+	printf("program errors: 60 positions, %u votes refused, later votes kept   %s\n", refused,
+		   failed ? "FAILED" : "ok");
+	return failed;
+}
+
+// Worst power-fail flush: a full queue, each record closing a group, and the seal record.
+// Records are 4 word programs, checkpoints 8; no snapshot and no erase, the journal never
+// rotates on this path.
+#define EMERGENCY_RECORDS	(VOTE_QUEUE_MAX + 1U)
+#define EMERGENCY_PROGRAMS	(4U * EMERGENCY_RECORDS + \
+							 8U * ((EMERGENCY_RECORDS + JOURNAL_CHECKPOINT_EVERY - 1U) / JOURNAL_CHECKPOINT_EVERY))
+
+// PVD warning with a full queue after a random stretch of voting, the journal anywhere in its
+// sector: what HAL_PWR_PVDCallback() does, then a boot. Where the sector has no room left the
+// backup mirror must supply the votes the journal did not take.
+static int emergency(uint32_t trials)
+{
+	uint32_t worstPrograms = 0, noRoom = 0, missing = 0;
+	uint64_t worstNs = 0;
+	phase_stats_t ps;
+	int failed = 0;
+
+	phase_timing_reset();
+	for (uint32_t t = 0; t < trials; t++)
+	{
+		uint32_t target = 20U + rnd() % 1500U;
+		FlashSim_Stats s0, s1;
+		uint32_t t0;
+		int st;
+
+		flash_sim_erase_chip();
+		ref_reset();
+		vote_queue_reset();
+		memset(backupRegs, 0, sizeof(backupRegs));
+		if (open_journal(ROLL_KEY) != JOURNAL_FORMATTED)
+		{
+			return 1;
+		}
+		vote_backup_open(backupRegs, &journal, &missing);
+		for (uint32_t i = 0; i < target + VOTE_QUEUE_MAX; i++)
+		{
+			int32_t v = pick_voter();
+			uint8_t c = (uint8_t)(rnd() % JOURNAL_CANDIDATES);
+
+			failed |= (vote_queue_cast(&journal, v, c, 0U) != JOURNAL_OK);
+			vote_backup_record(v, c);
+			refVoted[v] = 1;
+			refTally[c]++;
+			refCount++;
+			// Flushes only while voting, so the sector end is reached; the last casts stay queued
+			for (uint32_t idle = (i < target) ? rnd() % 3U : 0U; idle > 0; idle--)
+			{
+				vote_queue_flush_one(&journal);
+			}
+		}
+
+		flash_sim_stats(&s0);
+		t0 = phase_timing_now();
+		st = vote_queue_emergency(&journal);
+		phase_timing_record(PT_EMERGENCY, t0);
+		flash_sim_stats(&s1);
+		if (s1.programs - s0.programs > worstPrograms)
+		{
+			worstPrograms = (uint32_t)(s1.programs - s0.programs);
+		}
+		if (s1.timeNs - s0.timeNs > worstNs)
+		{
+			worstNs = s1.timeNs - s0.timeNs;
+		}
+		failed |= (s1.erases != s0.erases);
+		if (st == JOURNAL_FULL)
+		{
+			noRoom++;
+		}
+		else if (st != JOURNAL_OK)
+		{
+			failed = 1;
+		}
+
+		// Boot: sealed only when the emergency flush completed, every vote back after the mirror
+		vote_queue_reset();
+		if (open_journal(ROLL_KEY) != JOURNAL_OK || journal.sealed != (st == JOURNAL_OK))
+		{
+			printf("emergency trial %u: journal %s after the PVD flush\n", t,
+				   (journal.base == NULL) ? "lost" : "seal wrong");
+			failed = 1;
+			continue;
+		}
+		vote_backup_open(backupRegs, &journal, &missing);
+		if (missing != 0U || !matches(-1, 0))
+		{
+			printf("emergency trial %u: votes lost after the PVD flush\n", t);
+			failed = 1;
+		}
+	}
+
+	phase_timing_get(PT_EMERGENCY, &ps);
+	failed |= (worstPrograms > EMERGENCY_PROGRAMS);
+	printf("\nemergency flush: %u trials, worst %u programs (bound %u), %.1f us, %lu cycles max, "
+		   "no room %u   %s\n", trials, worstPrograms, EMERGENCY_PROGRAMS, worstNs / 1e3,
+		   (unsigned long)ps.max, noRoom, failed ? "FAILED" : "ok");
+	return failed;
+}
+
+// Cut the power at a random flash operation somewhere in a stretch of voting and idle service
+static int cut_trial(uint32_t trial, uint32_t *inflightKept, uint32_t *inflightLost)
+{
+	static volatile int failed;
+	static volatile uint32_t done;
+	uint32_t target = 20U + rnd() % 280U;
+
+	failed = 0;
+	done = 0;
+	flash_sim_cut_after((int64_t)(rnd() % (target * 5U)), &cutEnv);
+	if (setjmp(cutEnv) == 0)
+	{
+		for (; done < target; done++)
+		{
+			if (vote() != JOURNAL_OK)
+			{
+				failed = 1;
+				break;
+			}
+			if (rnd() % 64U == 0U)
+			{
+				journal_service(&journal);
+			}
+		}
+		flash_sim_cut_after(-1, NULL);
+	}
+
+	// Boot
+	if (open_journal(ROLL_KEY) != JOURNAL_OK)
+	{
+		printf("trial %u: journal lost after the cut\n", trial);
+		return 1;
+	}
+	if (matches(-1, 0))
+	{
+		if (inflightVoter >= 0)
+		{
+			(*inflightLost)++;
+		}
+	}
+	else if (inflightVoter >= 0 && matches(inflightVoter, inflightCand))
+	{
+		// Record complete, only the confirmation was lost
+		refVoted[inflightVoter] = 1;
+		refTally[inflightCand]++;
+		refCount++;
+		(*inflightKept)++;
+	}
+	else
+	{
+		printf("trial %u: state after the cut differs (%u votes confirmed)\n", trial, refCount);
+		failed = 1;
+	}
+	inflightVoter = -1;
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = (argc > 1) ? argv[1] : "build/flash.bin";
+	uint32_t trials = (argc > 2) ? (uint32_t)atoi(argv[2]) : 1000U;
+	uint32_t kept = 0, lost = 0, t;
+	int failed = 0;
+
+	if (flash_sim_open(path) != 0)
+	{
+		return 1;
+	}
+	base = flash_sim_sector(JOURNAL_FIRST, &sectorSize);
+
+	printf("journal: 2 x %u KB sectors, %u voter slots, %u-byte records\n\n", sectorSize / 1024U, N_SLOTS,
+		   JOURNAL_RECORD_SIZE);
+	printf("%-16s %6s %9s %9s %10s %7s %8s %7s %9s %9s\n", "scenario", "votes", "prog/vote", "us/vote",
+		   "worst_us", "w_erase", "rotation", "erases", "replayed", "open_us");
+	failed |= run_votes("idle-service", 5000U, 1U);
+	failed |= run_votes("service/16", 5000U, 16U);
+	failed |= run_votes("no-service", 5000U, 0U);
+
+	failed |= recovery();
+	failed |= program_errors();
+
+	printf("\n%-16s %6s %9s %10s %6s %7s %9s %9s %10s\n", "queue", "votes", "cast_us", "worst_us", "depth",
+		   "forced", "flush_us", "flush_max", "commit_max");
+	failed |= queue_run("strict", 1U, 5000U, 3U);
+	failed |= queue_run("queued", 0U, 5000U, 3U);
+	failed |= queue_run("queued-no-idle", 0U, 5000U, 0U);
+	for (uint8_t mode = 0; mode < 3; mode++)
+	{
+		static const char *const names[] = { "queued", "strict", "queued+backup" };
+		uint32_t worst = 0;
+
+		failed |= queue_cuts(mode == 1, mode == 2, 300U, &worst);
+		printf("%-13s power cuts: 300 trials, at most %u cast votes lost (bound %u)\n", names[mode], worst,
+			   (mode == 0) ? VOTE_QUEUE_MAX : 0U);
+	}
+
+	failed |= queue_rotation();
+	failed |= backup_reconcile();
+	failed |= emergency(500U);
+
+	// Power cuts: one long-lived journal, reopened after every cut
+	flash_sim_erase_chip();
+	ref_reset();
+	if (open_journal(ROLL_KEY) != JOURNAL_FORMATTED)
+	{
+		failed = 1;
+	}
+	for (t = 0; t < trials && refCount + 2000U < N_SLOTS; t++)
+	{
+		failed |= cut_trial(t, &kept, &lost);
+	}
+	printf("\npower cuts: %u trials, %u votes confirmed, in-flight vote kept %u / dropped %u\n", t,
+		   refCount, kept, lost);
+
+	// Another roll: its journal starts empty
+	ref_reset();
+	if (open_journal(ROLL_KEY + 1U) != JOURNAL_FORMATTED || !matches(-1, 0))
+	{
+		printf("new roll key did not start an empty journal\n");
+		failed = 1;
+	}
+
+	flash_sim_close();
+	printf("%s\n", failed ? "FAILED" : "all votes recovered");
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,228 @@
+/*
+ * File-backed STM32F401CC flash model, see flash_sim.h.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "flash_sim.h"
+#include "stm32f4xx_hal.h"
+
+static const struct
+{
+	uint32_t offset;
+	uint32_t size;
+	uint64_t eraseNs;
+} sectors[FLASH_SIM_SECTORS] =
+{
+	{ 0x00000, 16U * 1024U,  FLASH_SIM_ERASE16_NS },
+	{ 0x04000, 16U * 1024U,  FLASH_SIM_ERASE16_NS },
+	{ 0x08000, 16U * 1024U,  FLASH_SIM_ERASE16_NS },
+	{ 0x0C000, 16U * 1024U,  FLASH_SIM_ERASE16_NS },
+	{ 0x10000, 64U * 1024U,  FLASH_SIM_ERASE64_NS },
+	{ 0x20000, 128U * 1024U, FLASH_SIM_ERASE128_NS },
+};
+
+uint32_t SystemCoreClock = FLASH_SIM_CORE_HZ;
+CoreDebug_Type flash_sim_coredebug;
+static DWT_Type dwt;
+
+static uint8_t *mem = NULL;
+static int fd = -1;
+static int locked = 1;
+static FlashSim_Stats stats;
+static int64_t cutAfter = -1;
+static jmp_buf *cutEnv = NULL;
+static int64_t failAfter = -1;
+
+int flash_sim_open(const char *path)
+{
+	off_t len;
+	void *p;
+
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+	{
+		perror(path);
+		return -1;
+	}
+	len = lseek(fd, 0, SEEK_END);
+	if (len != FLASH_SIM_SIZE)
+	{
+		// New chip: erased
+		static uint8_t blank[FLASH_SIM_SIZE];
+		memset(blank, 0xFF, sizeof(blank));
+		if (ftruncate(fd, 0) != 0 || pwrite(fd, blank, sizeof(blank), 0) != (ssize_t)sizeof(blank))
+		{
+			perror(path);
+			return -1;
+		}
+	}
+
+	p = mmap((void *)FLASH_SIM_BASE, FLASH_SIM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+	if (p == MAP_FAILED || p != (void *)FLASH_SIM_BASE)
+	{
+		fprintf(stderr, "flash_sim: cannot map %s at 0x%08lX\n", path, FLASH_SIM_BASE);
+		return -1;
+	}
+	mem = p;
+	locked = 1;
+	return 0;
+}
+
+void flash_sim_close(void)
+{
+	if (mem != NULL)
+	{
+		munmap(mem, FLASH_SIM_SIZE);
+		mem = NULL;
+	}
+	if (fd >= 0)
+	{
+		close(fd);
+		fd = -1;
+	}
+}
+
+uint8_t *flash_sim_sector(uint32_t sector, uint32_t *size)
+{
+	if (sector >= FLASH_SIM_SECTORS)
+	{
+		return NULL;
+	}
+	if (size != NULL)
+	{
+		*size = sectors[sector].size;
+	}
+	return mem + sectors[sector].offset;
+}
+
+void flash_sim_erase_chip(void)
+{
+	memset(mem, 0xFF, FLASH_SIM_SIZE);
+}
+
+void flash_sim_cut_after(int64_t ops, jmp_buf *env)
+{
+	cutAfter = ops;
+	cutEnv = env;
+}
+
+void flash_sim_fail_after(int64_t programs)
+{
+	failAfter = programs;
+}
+
+void flash_sim_stats(FlashSim_Stats *out)
+{
+	*out = stats;
+}
+
+void flash_sim_reset_stats(void)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+// 1 when this operation is the one the power cut lands on
+static int cut_now(void)
+{
+	if (cutAfter < 0)
+	{
+		return 0;
+	}
+	if (cutAfter > 0)
+	{
+		cutAfter--;
+		return 0;
+	}
+	cutAfter = -1;
+	return 1;
+}
+
+static void power_off(void)
+{
+	locked = 1;
+	longjmp(*cutEnv, 1);
+}
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void)
+{
+	locked = 0;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void)
+{
+	locked = 1;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data)
+{
+	uint32_t size = (TypeProgram == FLASH_TYPEPROGRAM_WORD) ? 4U : (TypeProgram == FLASH_TYPEPROGRAM_HALFWORD) ? 2U : 1U;
+	uint32_t off = Address - (uint32_t)FLASH_SIM_BASE;
+	uint8_t bytes[4];
+
+	if (locked || mem == NULL || Address < FLASH_SIM_BASE || off + size > FLASH_SIM_SIZE || (off & (size - 1U)) != 0U)
+	{
+		return HAL_ERROR;
+	}
+	if (failAfter >= 0 && failAfter-- == 0)
+	{
+		return HAL_ERROR;
+	}
+	memcpy(bytes, &Data, size);		// little endian host, like the target
+	if (cut_now())
+	{
+		// Torn: only the first half of the bytes reach the array
+		size /= 2U;
+		for (uint32_t i = 0; i < size; i++)
+		{
+			mem[off + i] &= bytes[i];
+		}
+		power_off();
+	}
+	for (uint32_t i = 0; i < size; i++)
+	{
+		mem[off + i] &= bytes[i];
+	}
+	stats.programs++;
+	stats.timeNs += FLASH_SIM_PROGRAM_NS;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *SectorError)
+{
+	if (locked || mem == NULL || pEraseInit->Sector + pEraseInit->NbSectors > FLASH_SIM_SECTORS)
+	{
+		*SectorError = pEraseInit->Sector;
+		return HAL_ERROR;
+	}
+	for (uint32_t s = pEraseInit->Sector; s < pEraseInit->Sector + pEraseInit->NbSectors; s++)
+	{
+		if (cut_now())
+		{
+			memset(mem + sectors[s].offset, 0xFF, sectors[s].size / 2U);
+			*SectorError = s;
+			power_off();
+		}
+		memset(mem + sectors[s].offset, 0xFF, sectors[s].size);
+		stats.erases++;
+		stats.timeNs += sectors[s].eraseNs;
+	}
+	*SectorError = 0xFFFFFFFFU;
+	return HAL_OK;
+}
+
+uint32_t HAL_GetTick(void)
+{
+	return (uint32_t)(stats.timeNs / 1000000ULL);
+}
+
+DWT_Type *flash_sim_dwt(void)
+{
+	dwt.CYCCNT = (uint32_t)(stats.timeNs * (FLASH_SIM_CORE_HZ / 1000000U) / 1000U);
+	return &dwt;
+}
@@ -0,0 +1,53 @@
+/*
+ * File-backed model of the STM32F401CC internal flash for running Core/Src/journal.c on a host.
+ *
+ * The 256 KB array is a file mapped at the device address (0x08000000), so the firmware's
+ * pointers and HAL addresses are used unchanged and the contents survive the process: a
+ * second run of a tool on the same file is a power cycle.
+ *
+ * NOR rules: erase sets a whole sector to 0xFF, programming can only clear bits, programming
+ * while locked fails. Time is simulated with the datasheet typicals (x32 parallelism).
+ *
+ * Power cuts: flash_sim_cut_after(n) lets n more program/erase operations through; the next
+ * one is torn (a word gets only its low half, a sector only its first half erased) and the
+ * model longjmps to the jmp_buf given, the way a reset would abandon the firmware mid-write.
+ *
+ * Program errors: flash_sim_fail_after(n) lets n more word programs through and rejects the
+ * next one with HAL_ERROR, leaving its word untouched (a PGSERR/WRPERR-style failure).
+ */
+#ifndef FLASH_SIM_H
+#define FLASH_SIM_H
+
+#include <setjmp.h>
+#include <stdint.h>
+
+#define FLASH_SIM_BASE			0x08000000UL
+#define FLASH_SIM_SIZE			(256U * 1024U)
+#define FLASH_SIM_SECTORS		6
+
+#define FLASH_SIM_CORE_HZ		84000000U	// SystemCoreClock of the board, for DWT->CYCCNT
+
+// Cost model, in nanoseconds; only flash operations take simulated time
+#define FLASH_SIM_PROGRAM_NS	16000ULL		// one word
+#define FLASH_SIM_ERASE16_NS	250000000ULL	// 16 KB sector
+#define FLASH_SIM_ERASE64_NS	550000000ULL
+#define FLASH_SIM_ERASE128_NS	1000000000ULL
+
+typedef struct
+{
+	uint64_t programs;
+	uint64_t erases;
+	uint64_t timeNs;
+} FlashSim_Stats;
+
+int flash_sim_open(const char *path);
+void flash_sim_close(void);
+uint8_t *flash_sim_sector(uint32_t sector, uint32_t *size);
+void flash_sim_erase_chip(void);
+
+void flash_sim_cut_after(int64_t ops, jmp_buf *env);	// ops < 0: never
+void flash_sim_fail_after(int64_t programs);			// programs < 0: never
+void flash_sim_stats(FlashSim_Stats *out);
+void flash_sim_reset_stats(void);
+
+#endif
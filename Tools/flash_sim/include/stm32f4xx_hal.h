@@ -0,0 +1,69 @@
+/*
+ * Host stand-in for the STM32F4 HAL, just enough for the vote journal and its queue.
+ * The FLASH calls, the tick and the DWT cycle counter are routed to the file-backed flash
+ * model in flash_sim.c.
+ */
+#ifndef FLASH_SIM_STM32F4XX_HAL_H
+#define FLASH_SIM_STM32F4XX_HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum
+{
+	HAL_OK      = 0x00U,
+	HAL_ERROR   = 0x01U,
+	HAL_BUSY    = 0x02U,
+	HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+typedef struct
+{
+	uint32_t TypeErase;
+	uint32_t Banks;
+	uint32_t Sector;
+	uint32_t NbSectors;
+	uint32_t VoltageRange;
+} FLASH_EraseInitTypeDef;
+
+#define FLASH_TYPEPROGRAM_BYTE		0x00000000U
+#define FLASH_TYPEPROGRAM_HALFWORD	0x00000001U
+#define FLASH_TYPEPROGRAM_WORD		0x00000002U
+#define FLASH_TYPEERASE_SECTORS		0x00000000U
+#define FLASH_VOLTAGE_RANGE_3		0x00000002U
+
+#define FLASH_SECTOR_0		0U
+#define FLASH_SECTOR_1		1U
+#define FLASH_SECTOR_2		2U
+#define FLASH_SECTOR_3		3U
+#define FLASH_SECTOR_4		4U
+#define FLASH_SECTOR_5		5U
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *SectorError);
+uint32_t HAL_GetTick(void);
+
+// Cycle counter follows simulated time at the core clock of the board
+typedef struct
+{
+	uint32_t CTRL;
+	uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct
+{
+	uint32_t DEMCR;
+} CoreDebug_Type;
+
+DWT_Type *flash_sim_dwt(void);
+extern CoreDebug_Type flash_sim_coredebug;
+#define DWT					(flash_sim_dwt())
+#define CoreDebug			(&flash_sim_coredebug)
+#define DWT_CTRL_CYCCNTENA_Msk			(1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk		(1UL << 24)
+
+extern uint32_t SystemCoreClock;
+
+#endif
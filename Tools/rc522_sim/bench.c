@@ -0,0 +1,494 @@
+/*
+ * Driver benchmark on the MFRC522 model: SPI transactions, bytes and simulated time per
+ * scan, for the polled and the IRQ pin completion paths. Every scenario also checks the
+ * UIDs it got back, so a driver change that breaks the protocol fails the run.
+ *
+ * The driver's phase_timing hooks are printed after the scenarios, then the SPI transport
+ * comparison: MFRC522_BenchScan (REQA + anticollision + select) timed with the DWT cycle
+ * counter. `make bench` runs it in this build (every transfer a blocking HAL call, the
+ * default) and in rc522_bench_dma (MFRC522_USE_DMA=1, bursts of MFRC522_DMA_MIN_LEN bytes or
+ * more over DMA), which also checks that a lost DMA completion is aborted instead of hanging.
+ *
+ * Usage: rc522_bench [iterations] [transport]   (transport: the comparison only)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rc522_sim.h"
+#include "phase_timing.h"
+
+static MFRC522_HandleTypeDef hrc;
+
+static const uint8_t uid4a[4]  = { 0x73, 0x91, 0xB1, 0x28 };
+static const uint8_t uid4b[4]  = { 0x73, 0x91, 0x35, 0x02 };	// shares 16 bits with uid4a
+static const uint8_t uid7[7]   = { 0x04, 0x5A, 0x21, 0x92, 0x3C, 0x6E, 0x80 };
+static const uint8_t uid10[10] = { 0x08, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99 };
+static const uint8_t uidNtag[7] = { 0x04, 0x21, 0x6B, 0x1A, 0x2C, 0x5F, 0x80 };
+
+// User area (pages 4-129) of the NTAG215, filled in by setup_field
+#define NTAG215_USER	504
+static uint8_t ntagUser[NTAG215_USER];
+
+typedef int (*bench_fn)(void);		// one scan, returns 0 when the result was right
+
+static int scan_empty(void)
+{
+	uchar atqa[MAX_LEN];
+
+	return (MFRC522_Request(&hrc, PICC_REQIDL, atqa) == MI_OK);
+}
+
+static int scan_req_anticoll(void)
+{
+	uchar buf[MAX_LEN];
+
+	if (MFRC522_Request(&hrc, PICC_REQIDL, buf) != MI_OK)
+	{
+		return 1;
+	}
+	if (MFRC522_Anticoll(&hrc, buf) != MI_OK)
+	{
+		return 1;
+	}
+	return memcmp(buf, uid4a, 4) != 0;
+}
+
+static int scan_select(const uint8_t *uid, uchar len)
+{
+	uchar buf[MAX_LEN];
+	MFRC522_Uid got;
+
+	if (MFRC522_Request(&hrc, PICC_REQIDL, buf) != MI_OK)
+	{
+		return 1;
+	}
+	if (MFRC522_SelectUid(&hrc, &got) != MI_OK)
+	{
+		return 1;
+	}
+	return (got.size != len) || (memcmp(got.uidByte, uid, len) != 0);
+}
+
+static int scan_select7(void)
+{
+	return scan_select(uid7, 7);
+}
+
+static int scan_select10(void)
+{
+	return scan_select(uid10, 10);
+}
+
+static int scan_inventory(void)
+{
+	MFRC522_Uid cards[RC522_SIM_MAX_CARDS];
+	uchar count;
+	uint32_t cycles;
+
+	if (MFRC522_Inventory(&hrc, cards, RC522_SIM_MAX_CARDS, &count, &cycles) != MI_OK)
+	{
+		return 1;
+	}
+	return count != 3;
+}
+
+static int scan_auth_read(void)
+{
+	uchar buf[MAX_LEN];
+	uchar key[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+	MFRC522_Uid got;
+
+	if ((MFRC522_Request(&hrc, PICC_REQIDL, buf) != MI_OK) || (MFRC522_SelectUid(&hrc, &got) != MI_OK))
+	{
+		return 1;
+	}
+	if (MFRC522_Auth(&hrc, PICC_AUTHENT1A, 0, key, got.uidByte) != MI_OK)
+	{
+		return 1;
+	}
+	if (MFRC522_Read(&hrc, 0, buf) != MI_OK)
+	{
+		return 1;
+	}
+	return memcmp(buf, uid4a, 4) != 0;
+}
+
+// Sector 1 of card 'a' holds 48 bytes of pattern, see setup_field
+static int check_sector1(const uchar *data)
+{
+	int i;
+
+	for (i=0; i<48; i++)
+	{
+		if (data[i] != (uchar)(0xA0 + i))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// The per-block way: Auth + Read for each of the three data blocks
+static int scan_auth_read3(void)
+{
+	uchar data[48];
+	uchar key[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+	MFRC522_Uid got;
+	uchar b;
+
+	if ((MFRC522_Request(&hrc, PICC_REQIDL, data) != MI_OK) || (MFRC522_SelectUid(&hrc, &got) != MI_OK))
+	{
+		return 1;
+	}
+	for (b=0; b<3; b++)
+	{
+		if ((MFRC522_Auth(&hrc, PICC_AUTHENT1A, 4 + b, key, got.uidByte) != MI_OK) ||
+			(MFRC522_Read(&hrc, 4 + b, &data[b * 16]) != MI_OK))
+		{
+			return 1;
+		}
+	}
+	return check_sector1(data);
+}
+
+static int scan_read_sector(void)
+{
+	uchar data[48];
+	uchar key[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+	MFRC522_Uid got;
+
+	if ((MFRC522_Request(&hrc, PICC_REQIDL, data) != MI_OK) || (MFRC522_SelectUid(&hrc, &got) != MI_OK))
+	{
+		return 1;
+	}
+	if (MFRC522_ReadSector(&hrc, PICC_AUTHENT1A, 1, key, got.uidByte, data) != MI_OK)
+	{
+		return 1;
+	}
+	return check_sector1(data);
+}
+
+// Ballot mode as main.c runs it: card arrives and is halted by the presence tracker, then it
+// is woken, its credit in value block 8 is checked and one ballot spent
+static int scan_ballot(void)
+{
+	uchar key[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+	MFRC522_Uid got;
+	int32_t credit, after;
+	int guard;
+
+	MFRC522_PresenceStart(&hrc);
+	for (guard=0; MFRC522_PresencePoll(&hrc, &got) != MFRC522_EVT_ARRIVED; guard++)
+	{
+		if (guard > 100000)
+		{
+			return 1;
+		}
+		if (hrc.irqMode)
+		{
+			__WFI();			// nothing else moves simulated time while the REQA is in flight
+		}
+	}
+	{
+		// Fresh credit for every iteration
+		uint8_t *b = RC522_SimGetCard(0)->blocks[8];
+		int i;
+		for (i=0; i<4; i++)
+		{
+			b[i] = (i == 0) ? 1 : 0;
+			b[i+4] = ~b[i];
+			b[i+8] = b[i];
+		}
+		b[12] = 8; b[13] = ~8; b[14] = 8; b[15] = ~8;
+	}
+
+	if ((MFRC522_PresenceWake(&hrc) != MI_OK) ||
+		(MFRC522_AuthCached(&hrc, PICC_AUTHENT1A, 8, key, got.uidByte) != MI_OK) ||
+		(MFRC522_ValueRead(&hrc, 8, &credit) != MI_OK) || (credit != 1) ||
+		(MFRC522_Decrement(&hrc, 8, 1) != MI_OK) || (MFRC522_Transfer(&hrc, 8) != MI_OK) ||
+		(MFRC522_ValueRead(&hrc, 8, &after) != MI_OK))
+	{
+		return 1;
+	}
+	MFRC522_Halt(&hrc);
+	return after != 0;
+}
+
+static int select_card(MFRC522_Uid *got)
+{
+	uchar atqa[MAX_LEN];
+
+	if ((MFRC522_Request(&hrc, PICC_REQIDL, atqa) != MI_OK) || (MFRC522_SelectUid(&hrc, got) != MI_OK))
+	{
+		return 1;
+	}
+	got->atqa[0] = atqa[0];		// MFRC522_CardType dispatches on ATQA + SAK
+	got->atqa[1] = atqa[1];
+	return 0;
+}
+
+// NTAG215 user area the old way: READ returns 4 pages, so 32 exchanges
+static int scan_ntag_read(void)
+{
+	static uchar data[NTAG215_USER + 16];
+	MFRC522_Uid got;
+	uchar page;
+
+	if (select_card(&got))
+	{
+		return 1;
+	}
+	for (page=4; page<=129; page+=4)
+	{
+		if (MFRC522_Read(&hrc, page, &data[(page - 4) * 4]) != MI_OK)
+		{
+			return 1;
+		}
+	}
+	return memcmp(data, ntagUser, NTAG215_USER) != 0;
+}
+
+// Identify through GET_VERSION, then one FAST_READ drained while it arrives
+static int scan_ntag_fast_read(void)
+{
+	static uchar data[MFRC522_USER_AREA_MAX];
+	MFRC522_Uid got;
+	uchar type;
+	uint len;
+
+	if (select_card(&got) || (MFRC522_IdentifyCard(&hrc, &got, &type) != MI_OK) || (type != MFRC522_CARD_NTAG215))
+	{
+		return 1;
+	}
+	if (MFRC522_ReadUserArea(&hrc, type, data, sizeof(data), &len) != MI_OK)
+	{
+		return 1;
+	}
+	return (len != NTAG215_USER) || (memcmp(data, ntagUser, NTAG215_USER) != 0);
+}
+
+// Original Ultralight: GET_VERSION goes unanswered, the card is selected again and read with READ
+static int scan_ul_read(void)
+{
+	uchar data[64];
+	MFRC522_Uid got;
+	uchar type;
+	uint len;
+
+	if (select_card(&got) || (MFRC522_IdentifyCard(&hrc, &got, &type) != MI_OK) || (type != MFRC522_CARD_ULTRALIGHT))
+	{
+		return 1;
+	}
+	return (MFRC522_ReadUserArea(&hrc, type, data, sizeof(data), &len) != MI_OK) || (len != 48);
+}
+
+static void setup_field(const char *cards)
+{
+	RC522_SimCard *c;
+	int i;
+
+	RC522_SimReset();
+	for (; *cards; cards++)
+	{
+		switch (*cards)
+		{
+			case 'a':
+				c = RC522_SimGetCard(RC522_SimAddCard(uid4a, 4, RC522_SIM_MIFARE_1K));
+				for (i=0; i<48; i++)
+				{
+					c->blocks[4 + i / 16][i % 16] = (uint8_t)(0xA0 + i);
+				}
+				break;
+			case 'b': RC522_SimAddCard(uid4b, 4, RC522_SIM_MIFARE_1K); break;
+			case '7': RC522_SimAddCard(uid7, 7, RC522_SIM_ULTRALIGHT); break;
+			case 'x': RC522_SimAddCard(uid10, 10, RC522_SIM_MIFARE_1K); break;
+			case 'n':
+				c = RC522_SimGetCard(RC522_SimAddCard(uidNtag, 7, RC522_SIM_NTAG215));
+				for (i=0; i<NTAG215_USER; i++)
+				{
+					ntagUser[i] = (uint8_t)(i * 7 + 3);
+				}
+				memcpy(&c->blocks[1][0], ntagUser, NTAG215_USER);	// page 4 onwards
+				break;
+			default: break;
+		}
+	}
+
+	hrc.hspi = HSPI_INSTANCE;
+	hrc.csPort = MFRC522_CS_PORT;
+	hrc.csPin = MFRC522_CS_PIN;
+	hrc.rstPort = MFRC522_RST_PORT;
+	hrc.rstPin = MFRC522_RST_PIN;
+	MFRC522_Init(&hrc);
+}
+
+static int run(const char *name, const char *cards, uchar irq, bench_fn fn, int iters)
+{
+	uint64_t txn = 0, bytes = 0, calls = 0, frames = 0, ns = 0;
+	const RC522_SimStats *st;
+	int i, bad = 0;
+
+	setup_field(cards);
+	if (irq)
+	{
+		RC522_SimAttachIrq(&hrc);
+		MFRC522_SetIrqMode(&hrc, 1);
+	}
+
+	for (i=0; i<iters; i++)
+	{
+		RC522_SimFieldReset();			// cards leave and come back between scans
+		RC522_SimStatsReset();
+		bad += fn();
+		st = RC522_SimStatsGet();
+		txn += st->transactions;
+		bytes += st->bytes;
+		calls += st->halCalls;
+		frames += st->frames;
+		ns += st->timeNs;
+	}
+
+	printf("%-16s %-4s iters=%d spi_txn=%.1f spi_bytes=%.1f hal_calls=%.1f rf_frames=%.1f sim_us=%.1f%s\n",
+		   name, irq ? "irq" : "poll", iters,
+		   (double)txn / iters, (double)bytes / iters, (double)calls / iters,
+		   (double)frames / iters, (double)ns / iters / 1000.0,
+		   bad ? "  FAILED" : "");
+	return bad != 0;
+}
+
+// REQA + anticollision + select over this build's SPI transport
+static int transport(const char *name, const char *cards, uchar irq, int iters)
+{
+	uint64_t txn = 0, bytes = 0, calls = 0, dma = 0, ns = 0, cycles = 0;
+	const RC522_SimStats *st;
+	uint32_t c;
+	int i, bad = 0;
+
+	setup_field(cards);
+	if (irq)
+	{
+		RC522_SimAttachIrq(&hrc);
+		MFRC522_SetIrqMode(&hrc, 1);
+	}
+
+	for (i=0; i<iters; i++)
+	{
+		RC522_SimFieldReset();
+		RC522_SimStatsReset();
+		c = MFRC522_BenchScan(&hrc);
+		bad += (c == 0);
+		cycles += c;
+		st = RC522_SimStatsGet();
+		txn += st->transactions;
+		bytes += st->bytes;
+		calls += st->halCalls;
+		dma += st->dmaTransfers;
+		ns += st->timeNs;
+	}
+
+	printf("%-6s %-14s %-4s spi_txn=%.1f spi_bytes=%.1f hal_calls=%.1f dma=%.1f sim_us=%.1f cycles=%.0f%s\n",
+		   MFRC522_USE_DMA ? "dma" : "polled", name, irq ? "irq" : "poll",
+		   (double)txn / iters, (double)bytes / iters, (double)calls / iters, (double)dma / iters,
+		   (double)ns / iters / 1000.0, (double)cycles / iters, bad ? "  FAILED" : "");
+	return bad != 0;
+}
+
+#if MFRC522_USE_DMA
+// The completion interrupt of the select frame's DMA write is lost: the driver gives up on it
+// after MFRC522_DMA_TIMEOUT_MS, that scan may fail, and the next one works again
+static int dma_lost(void)
+{
+	uint64_t t0, waited;
+	uint32_t aborts;
+	int bad;
+
+	setup_field("a");
+	RC522_SimStatsReset();
+	RC522_SimDropDma(1);
+	t0 = RC522_SimTimeNs();
+	MFRC522_BenchScan(&hrc);
+	waited = RC522_SimTimeNs() - t0;
+	aborts = RC522_SimStatsGet()->dmaAborts;
+	bad = (aborts != 1) || (waited > (MFRC522_DMA_TIMEOUT_MS + 10) * 1000000ULL);
+
+	RC522_SimFieldReset();
+	bad |= (MFRC522_BenchScan(&hrc) == 0);
+
+	printf("dma    lost-completion     aborts=%u sim_us=%.1f next_scan=%s%s\n", (unsigned)aborts,
+		   (double)waited / 1000.0, bad ? "bad" : "ok", bad ? "  FAILED" : "");
+	return bad;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+	static const struct
+	{
+		const char *name;
+		const char *cards;
+		bench_fn fn;
+	} scenarios[] =
+	{
+		{ "empty-field",     "",    scan_empty },
+		{ "req+anticoll",    "a",   scan_req_anticoll },
+		{ "req+select-7b",   "7",   scan_select7 },
+		{ "req+select-10b",  "x",   scan_select10 },
+		{ "inventory-3",     "ab7", scan_inventory },
+		{ "auth+read",       "a",   scan_auth_read },
+		{ "auth+read-x3",    "a",   scan_auth_read3 },
+		{ "read-sector",     "a",   scan_read_sector },
+		{ "ballot",          "a",   scan_ballot },
+		{ "ntag215-read",    "n",   scan_ntag_read },
+		{ "ntag215-fastread","n",   scan_ntag_fast_read },
+		{ "ul-read",         "7",   scan_ul_read },
+	};
+	static const struct
+	{
+		const char *name;
+		const char *cards;
+	} scans[] =
+	{
+		{ "select-4b",  "a" },
+		{ "select-7b",  "7" },
+		{ "select-10b", "x" },
+	};
+	int iters = (argc > 1) ? atoi(argv[1]) : 1000;
+	int transportOnly = (argc > 2) && (strcmp(argv[2], "transport") == 0);
+	int failed = 0;
+	unsigned i;
+	uchar irq;
+
+	if (iters <= 0)
+	{
+		iters = 1;
+	}
+
+	for (i=0; !transportOnly && i<sizeof(scenarios)/sizeof(scenarios[0]); i++)
+	{
+		for (irq=0; irq<2; irq++)
+		{
+			failed |= run(scenarios[i].name, scenarios[i].cards, irq, scenarios[i].fn, iters);
+		}
+	}
+
+	if (!transportOnly)
+	{
+		// Driver phase hooks over the whole run, in simulated core cycles
+		printf("\n");
+		phase_timing_dump();
+		printf("\n");
+	}
+
+	for (i=0; i<sizeof(scans)/sizeof(scans[0]); i++)
+	{
+		for (irq=0; irq<2; irq++)
+		{
+			failed |= transport(scans[i].name, scans[i].cards, irq, iters);
+		}
+	}
+#if MFRC522_USE_DMA
+	failed |= dma_lost();
+#endif
+
+	return failed;
+}
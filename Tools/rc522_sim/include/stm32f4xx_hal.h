@@ -0,0 +1,85 @@
+/*
+ * Host stand-in for the STM32F4 HAL, just enough for Core/Src/rc522.c.
+ * SPI, GPIO, the tick and the DWT cycle counter are routed to the MFRC522 model in rc522_sim.c.
+ */
+#ifndef RC522_SIM_STM32F4XX_HAL_H
+#define RC522_SIM_STM32F4XX_HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum
+{
+	HAL_OK      = 0x00U,
+	HAL_ERROR   = 0x01U,
+	HAL_BUSY    = 0x02U,
+	HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+typedef enum
+{
+	GPIO_PIN_RESET = 0,
+	GPIO_PIN_SET
+} GPIO_PinState;
+
+typedef struct
+{
+	uint32_t ODR;
+} GPIO_TypeDef;
+
+typedef struct
+{
+	uint32_t Instance;
+} SPI_HandleTypeDef;
+
+extern GPIO_TypeDef rc522_sim_gpioa;
+extern GPIO_TypeDef rc522_sim_gpiob;
+#define GPIOA	(&rc522_sim_gpioa)
+#define GPIOB	(&rc522_sim_gpiob)
+
+#define GPIO_PIN_0		((uint16_t)0x0001)
+#define GPIO_PIN_1		((uint16_t)0x0002)
+#define GPIO_PIN_2		((uint16_t)0x0004)
+#define GPIO_PIN_3		((uint16_t)0x0008)
+#define GPIO_PIN_4		((uint16_t)0x0010)
+#define GPIO_PIN_5		((uint16_t)0x0020)
+#define GPIO_PIN_6		((uint16_t)0x0040)
+#define GPIO_PIN_7		((uint16_t)0x0080)
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size);
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi);
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi);
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi);
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi);
+uint32_t HAL_GetTick(void);
+
+// Sleeping jumps simulated time to the next event of the model
+void rc522_sim_wfi(void);
+#define __WFI()		rc522_sim_wfi()
+
+// Cycle counter follows simulated time at the core clock of the board
+typedef struct
+{
+	uint32_t CTRL;
+	uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct
+{
+	uint32_t DEMCR;
+} CoreDebug_Type;
+
+DWT_Type *rc522_sim_dwt(void);
+extern CoreDebug_Type rc522_sim_coredebug;
+#define DWT					(rc522_sim_dwt())
+#define CoreDebug			(&rc522_sim_coredebug)
+#define DWT_CTRL_CYCCNTENA_Msk			(1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk		(1UL << 24)
+
+extern uint32_t SystemCoreClock;
+
+#endif
@@ -0,0 +1,1172 @@
+/*
+ * MFRC522 register-level model, see rc522_sim.h.
+ * Also provides the HAL functions used by Core/Src/rc522.c (include/stm32f4xx_hal.h).
+ */
+#include <string.h>
+#include "rc522_sim.h"
+
+GPIO_TypeDef rc522_sim_gpioa;
+GPIO_TypeDef rc522_sim_gpiob;
+CoreDebug_Type rc522_sim_coredebug;
+uint32_t SystemCoreClock = RC522_SIM_CORE_HZ;
+SPI_HandleTypeDef hspi1;
+
+// ISO 14443-3 card states
+#define CARD_IDLE		0
+#define CARD_READY		1
+#define CARD_ACTIVE		2
+#define CARD_HALT		3
+
+// RF timing at 106 kbit/s: one bit is 128/fc, the answer starts 1172/fc after the request
+#define RF_BIT_NS		9440
+#define RF_BYTE_NS		(9 * RF_BIT_NS)		// 8 data bits + parity
+#define RF_FDT_NS		86400
+#define RF_AUTH_NS		1200000		// three-pass authentication, all passes together
+#define FC_HZ			13560000ULL
+
+// Card answers carry a fixed ACK/NAK nibble
+#define MF_ACK			0x0A
+#define MF_NAK			0x04
+
+// Result of the running command, applied to the registers once simulated time reaches atNs
+typedef struct
+{
+	uint8_t active;
+	uint64_t atNs;
+	uint8_t commIrq;
+	uint8_t error;
+	uint8_t coll;
+	uint8_t status2;
+	uint8_t data[RC522_SIM_RF_MAX];
+	uint16_t len;
+	uint16_t delivered;				// bytes already moved into the FIFO
+	uint64_t rxStartNs;				// first received byte starts here
+	uint8_t lastBits;
+} SimPending;
+
+static struct
+{
+	uint8_t regs[64];
+	uint8_t fifo[MFRC522_FIFO_SIZE];
+	uint8_t fifoLen;
+
+	// SPI framing while CS is low
+	uint8_t csLow;
+	uint8_t spiFirst;
+	uint8_t spiWrite;
+	uint8_t spiAddr;
+	uint8_t readValid;
+	uint8_t readAddr;
+
+	SimPending pend;
+	uint64_t nowNs;
+	DWT_Type dwt;
+
+	RC522_SimCard cards[RC522_SIM_MAX_CARDS];
+	int cardCount;
+
+	MFRC522_HandleTypeDef *irqHandle;
+	uint8_t irqLine;
+
+	uint32_t dmaDrop;			// DMA completions still to lose
+	uint8_t dmaHung;			// a transfer is waiting for a completion that never comes
+
+	RC522_SimStats stats;
+} sim;
+
+static void sim_update(void);
+
+static void sim_advance(uint64_t ns)
+{
+	sim.nowNs += ns;
+	sim.stats.timeNs += ns;
+	sim_update();
+}
+
+static uint16_t sim_crc_a(const uint8_t *data, int len)
+{
+	uint16_t crc = 0x6363;
+	int i, b;
+
+	for (i=0; i<len; i++)
+	{
+		crc ^= data[i];
+		for (b=0; b<8; b++)
+		{
+			crc = (crc & 1) ? ((crc >> 1) ^ 0x8408) : (crc >> 1);
+		}
+	}
+	return crc;
+}
+
+static int sim_crc_ok(const uint8_t *frame, int len)
+{
+	uint16_t crc;
+
+	if (len < 3)
+	{
+		return 0;
+	}
+	crc = sim_crc_a(frame, len - 2);
+	return (frame[len-2] == (crc & 0xFF)) && (frame[len-1] == (crc >> 8));
+}
+
+static uint8_t get_bit(const uint8_t *buf, int i)
+{
+	return (buf[i/8] >> (i%8)) & 1;
+}
+
+static void put_bit(uint8_t *buf, int i, uint8_t v)
+{
+	if (v)
+	{
+		buf[i/8] |= 1 << (i%8);
+	}
+	else
+	{
+		buf[i/8] &= ~(1 << (i%8));
+	}
+}
+
+static uint64_t rf_frame_ns(int bits)
+{
+	// SOF + data + one parity bit per byte + EOF
+	return (uint64_t)(bits + bits/8 + 2) * RF_BIT_NS;
+}
+
+static uint64_t timer_ns(void)
+{
+	uint64_t presc = ((uint64_t)(sim.regs[TModeReg] & 0x0F) << 8) | sim.regs[TPrescalerReg];
+	uint64_t reload = ((uint64_t)sim.regs[TReloadRegH] << 8) | sim.regs[TReloadRegL];
+
+	return (2*presc + 1) * (reload + 1) * 1000000000ULL / FC_HZ;
+}
+
+static void sim_irq_check(void)
+{
+	uint8_t line;
+
+	line = ((sim.regs[CommIrqReg] & sim.regs[CommIEnReg] & 0x7F) != 0) ||
+		   ((sim.regs[DivIrqReg] & sim.regs[DivlEnReg] & 0x14) != 0);
+	if (line && !sim.irqLine && sim.irqHandle)
+	{
+		MFRC522_IrqNotify(sim.irqHandle);		// EXTI falling edge
+	}
+	sim.irqLine = line;
+}
+
+// HiAlert: FIFO filled to within WaterLevel bytes of the top; HiAlertIRq follows it
+static void sim_fifo_alert(void)
+{
+	if ((MFRC522_FIFO_SIZE - sim.fifoLen) <= (sim.regs[WaterLevelReg] & 0x3F))
+	{
+		sim.regs[Status1Reg] |= 0x02;
+		sim.regs[CommIrqReg] |= 0x08;
+		sim_irq_check();
+	}
+	else
+	{
+		sim.regs[Status1Reg] &= ~0x02;
+	}
+}
+
+static void sim_update(void)
+{
+	uint64_t due;
+
+	if (!sim.pend.active)
+	{
+		return;
+	}
+
+	// Received bytes enter the FIFO as they come off the air; a full FIFO loses them (BufferOvfl)
+	due = sim.pend.len;
+	if (sim.nowNs < sim.pend.atNs)
+	{
+		due = (sim.nowNs > sim.pend.rxStartNs) ? (sim.nowNs - sim.pend.rxStartNs) / RF_BYTE_NS : 0;
+		if (due > sim.pend.len)
+		{
+			due = sim.pend.len;
+		}
+	}
+	while (sim.pend.delivered < due)
+	{
+		if (sim.fifoLen < MFRC522_FIFO_SIZE)
+		{
+			sim.fifo[sim.fifoLen++] = sim.pend.data[sim.pend.delivered];
+		}
+		else
+		{
+			sim.pend.error |= 0x10;
+			sim.pend.commIrq |= 0x02;
+		}
+		sim.pend.delivered++;
+	}
+	sim_fifo_alert();
+
+	if (sim.nowNs < sim.pend.atNs)
+	{
+		return;
+	}
+
+	sim.pend.active = 0;
+	sim.regs[ControlReg] = (sim.regs[ControlReg] & ~0x07) | (sim.pend.lastBits & 0x07);
+	sim.regs[ErrorReg] = sim.pend.error;
+	sim.regs[CollReg] = (sim.regs[CollReg] & 0x80) | sim.pend.coll;
+	sim.regs[Status2Reg] |= sim.pend.status2;
+	sim.regs[CommIrqReg] |= sim.pend.commIrq;
+	sim_irq_check();
+}
+
+static void sim_chip_reset(void)
+{
+	memset(sim.regs, 0, sizeof(sim.regs));
+	sim.regs[CommandReg] = 0x20;
+	sim.regs[CommIEnReg] = 0x80;
+	sim.regs[CommIrqReg] = 0x14;
+	sim.regs[Status1Reg] = 0x21;
+	sim.regs[WaterLevelReg] = 0x08;
+	sim.regs[ControlReg] = 0x10;
+	sim.regs[CollReg] = 0xA0;
+	sim.regs[ModeReg] = 0x3F;
+	sim.regs[TxControlReg] = 0x80;
+	sim.regs[TxSelReg] = 0x10;
+	sim.regs[RxSelReg] = 0x84;
+	sim.regs[RxThresholdReg] = 0x84;
+	sim.regs[DemodReg] = 0x4D;
+	sim.regs[SerialSpeedReg] = 0xEB;
+	sim.regs[CRCResultRegH] = 0xFF;
+	sim.regs[CRCResultRegL] = 0xFF;
+	sim.regs[ModWidthReg] = 0x26;
+	sim.regs[RFCfgReg] = 0x48;
+	sim.regs[GsNReg] = 0x88;
+	sim.regs[CWGsPReg] = 0x20;
+	sim.regs[ModGsPReg] = 0x20;
+	sim.regs[VersionReg] = 0x92;
+	sim.fifoLen = 0;
+	sim.pend.active = 0;
+	sim.irqLine = 0;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Cards                                                                     */
+
+// CLn || BCC of a card for cascade level lvl
+static void card_cl(const RC522_SimCard *c, uint8_t lvl, uint8_t *cl)
+{
+	uint8_t levels = (c->uidLen == 4) ? 1 : (c->uidLen == 7) ? 2 : 3;
+
+	if (lvl + 1 < levels)
+	{
+		cl[0] = PICC_CT;
+		memcpy(&cl[1], &c->uid[lvl*3], 3);
+	}
+	else
+	{
+		memcpy(cl, &c->uid[lvl*3], 4);
+	}
+	cl[4] = cl[0] ^ cl[1] ^ cl[2] ^ cl[3];
+}
+
+static void card_fallback(RC522_SimCard *c)
+{
+	c->state = c->halted ? CARD_HALT : CARD_IDLE;
+	c->level = 0;
+	c->authSector = 0xFF;
+	c->writeBlock = 0xFF;
+	c->valueCmd = 0;
+	c->transferValid = 0;
+}
+
+// Value block layout check: value, ~value, value, adr, ~adr, adr, ~adr
+static int card_value_get(const uint8_t *b, int32_t *value)
+{
+	int i;
+
+	for (i=0; i<4; i++)
+	{
+		if (((uint8_t)(b[i] ^ b[i+4]) != 0xFF) || (b[i] != b[i+8]))
+		{
+			return 0;
+		}
+	}
+	if (((uint8_t)(b[12] ^ b[13]) != 0xFF) || (b[12] != b[14]) || (b[13] != b[15]))
+	{
+		return 0;
+	}
+	*value = (int32_t)((uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24));
+	return 1;
+}
+
+static void card_value_put(uint8_t *b, int32_t value, uint8_t addr)
+{
+	int i;
+
+	for (i=0; i<4; i++)
+	{
+		b[i] = ((uint32_t)value >> (8*i)) & 0xFF;
+		b[i+4] = ~b[i];
+		b[i+8] = b[i];
+	}
+	b[12] = addr;
+	b[13] = ~addr;
+	b[14] = addr;
+	b[15] = ~addr;
+}
+
+static int card_answer_crc(uint8_t *resp, const uint8_t *data, int len)
+{
+	uint16_t crc = sim_crc_a(data, len);
+
+	memcpy(resp, data, len);
+	resp[len] = crc & 0xFF;
+	resp[len+1] = crc >> 8;
+	return (len + 2) * 8;
+}
+
+static int card_answer_nibble(uint8_t *resp, uint8_t nibble)
+{
+	resp[0] = nibble;
+	return 4;
+}
+
+static uint8_t *card_mem(RC522_SimCard *c, uint8_t block)
+{
+	return c->blocks[block % RC522_SIM_BLOCKS];
+}
+
+// One frame for one card. Returns the number of answer bits put in resp, 0 for silence.
+static int card_frame(RC522_SimCard *c, const uint8_t *tx, int txBits, uint8_t *resp)
+{
+	uint8_t cmd = tx[0];
+	int txBytes = txBits / 8;
+	uint8_t cl[5];
+	uint8_t lvl, nvb, levels, sector;
+	int known, i, n;
+
+	if (txBits == 7)
+	{
+		cmd &= 0x7F;
+		if ((cmd == PICC_REQIDL) && (c->state == CARD_IDLE))
+		{
+			c->state = CARD_READY;
+			c->halted = 0;
+			c->level = 0;
+			memcpy(resp, c->atqa, 2);
+			return 16;
+		}
+		if ((cmd == PICC_REQALL) && ((c->state == CARD_IDLE) || (c->state == CARD_HALT)))
+		{
+			c->halted = (c->state == CARD_HALT);
+			c->state = CARD_READY;
+			c->level = 0;
+			memcpy(resp, c->atqa, 2);
+			return 16;
+		}
+		if ((c->state == CARD_READY) || (c->state == CARD_ACTIVE))
+		{
+			card_fallback(c);
+		}
+		return 0;
+	}
+
+	if ((c->state == CARD_IDLE) || (c->state == CARD_HALT))
+	{
+		return 0;
+	}
+
+	if ((cmd == PICC_ANTICOLL) || (cmd == PICC_ANTICOLL_CL2) || (cmd == PICC_ANTICOLL_CL3))
+	{
+		lvl = (cmd - PICC_ANTICOLL) / 2;
+		if ((c->state != CARD_READY) || (lvl != c->level) || (txBits < 16))
+		{
+			card_fallback(c);
+			return 0;
+		}
+		card_cl(c, lvl, cl);
+		nvb = tx[1];
+
+		if ((nvb == 0x70) && (txBits == 72))
+		{
+			if (!sim_crc_ok(tx, 9))
+			{
+				return 0;
+			}
+			if (memcmp(&tx[2], cl, 5) != 0)
+			{
+				card_fallback(c);
+				return 0;
+			}
+			levels = (c->uidLen == 4) ? 1 : (c->uidLen == 7) ? 2 : 3;
+			if (lvl + 1 < levels)
+			{
+				uint8_t cascade = 0x04;	// cascade bit, UID not complete
+				c->level++;
+				return card_answer_crc(resp, &cascade, 1);
+			}
+			c->state = CARD_ACTIVE;
+			return card_answer_crc(resp, &c->sak, 1);
+		}
+
+		// ANTICOLLISION: answer with the rest of CLn || BCC if the known bits match
+		known = ((nvb >> 4) - 2) * 8 + (nvb & 0x0F);
+		if ((known < 0) || (known >= 40) || (txBits != 16 + known))
+		{
+			return 0;
+		}
+		for (i=0; i<known; i++)
+		{
+			if (get_bit(&tx[2], i) != get_bit(cl, i))
+			{
+				return 0;
+			}
+		}
+		memset(resp, 0, 5);
+		for (i=known; i<40; i++)
+		{
+			put_bit(resp, i - known, get_bit(cl, i));
+		}
+		return 40 - known;
+	}
+
+	if (c->state != CARD_ACTIVE)
+	{
+		card_fallback(c);
+		return 0;
+	}
+
+	if (c->writeBlock != 0xFF)
+	{
+		// WRITE part two: 16 data bytes + CRC_A
+		if ((txBytes != 18) || !sim_crc_ok(tx, 18))
+		{
+			c->writeBlock = 0xFF;
+			return card_answer_nibble(resp, MF_NAK);
+		}
+		memcpy(card_mem(c, c->writeBlock), tx, 16);
+		c->writeBlock = 0xFF;
+		return card_answer_nibble(resp, MF_ACK);
+	}
+
+	if (c->valueCmd)
+	{
+		// Value operation part two: 4 operand bytes + CRC_A, silence on success
+		int32_t value, operand;
+		uint8_t *src = card_mem(c, c->valueBlock);
+
+		if ((txBytes != 6) || !sim_crc_ok(tx, 6))
+		{
+			card_fallback(c);
+			return card_answer_nibble(resp, MF_NAK);
+		}
+		card_value_get(src, &value);
+		operand = (int32_t)((uint32_t)tx[0] | ((uint32_t)tx[1] << 8) | ((uint32_t)tx[2] << 16) | ((uint32_t)tx[3] << 24));
+		if (c->valueCmd == PICC_DECREMENT)
+		{
+			value -= operand;
+		}
+		else if (c->valueCmd == PICC_INCREMENT)
+		{
+			value += operand;
+		}
+		c->transferValue = value;
+		c->transferAddr = src[12];
+		c->transferValid = 1;
+		c->valueCmd = 0;
+		return 0;
+	}
+
+	if ((txBytes < 3) || !sim_crc_ok(tx, txBytes))
+	{
+		return 0;						// transmission error, the card stays silent
+	}
+
+	sector = tx[1] / 4;
+	switch (cmd)
+	{
+		case PICC_HALT:
+			c->state = CARD_HALT;
+			c->halted = 1;
+			c->authSector = 0xFF;
+			return 0;
+
+		case PICC_READ:
+			if ((c->sak & 0x08) && (c->authSector != sector))
+			{
+				card_fallback(c);
+				return card_answer_nibble(resp, MF_NAK);
+			}
+			if (c->sak & 0x08)
+			{
+				return card_answer_crc(resp, card_mem(c, tx[1]), 16);
+			}
+			// Ultralight: four 4-byte pages starting at the requested one
+			{
+				uint8_t pages[16];
+				uint8_t *mem = &c->blocks[0][0];
+				for (n=0; n<16; n++)
+				{
+					pages[n] = mem[(tx[1]*4 + n) % (RC522_SIM_BLOCKS*16)];
+				}
+				return card_answer_crc(resp, pages, 16);
+			}
+
+		case PICC_WRITE:
+			if ((c->sak & 0x08) && (c->authSector != sector))
+			{
+				card_fallback(c);
+				return card_answer_nibble(resp, MF_NAK);
+			}
+			c->writeBlock = tx[1];
+			return card_answer_nibble(resp, MF_ACK);
+
+		case PICC_DECREMENT:
+		case PICC_INCREMENT:
+		case PICC_RESTORE:
+		{
+			int32_t value;
+
+			if (!(c->sak & 0x08) || (c->authSector != sector) || !card_value_get(card_mem(c, tx[1]), &value))
+			{
+				card_fallback(c);
+				return card_answer_nibble(resp, MF_NAK);
+			}
+			c->valueCmd = cmd;
+			c->valueBlock = tx[1];
+			return card_answer_nibble(resp, MF_ACK);
+		}
+
+		case PICC_GET_VERSION:
+			if (c->type != RC522_SIM_NTAG215)
+			{
+				card_fallback(c);
+				return 0;
+			}
+			{
+				static const uint8_t version[8] = { 0x00, 0x04, 0x04, 0x02, 0x01, 0x00, 0x11, 0x03 };
+				return card_answer_crc(resp, version, 8);
+			}
+
+		case PICC_FAST_READ:
+			if ((c->type != RC522_SIM_NTAG215) || (txBytes != 5))
+			{
+				card_fallback(c);
+				return 0;
+			}
+			if ((tx[1] > tx[2]) || (tx[2] >= RC522_SIM_NTAG215_PAGES))
+			{
+				card_fallback(c);
+				return card_answer_nibble(resp, 0x00);		// NAK: invalid argument
+			}
+			return card_answer_crc(resp, &c->blocks[0][0] + tx[1] * 4, (tx[2] - tx[1] + 1) * 4);
+
+		case PICC_TRANSFER:
+			if (!(c->sak & 0x08) || (c->authSector != sector) || !c->transferValid)
+			{
+				card_fallback(c);
+				return card_answer_nibble(resp, MF_NAK);
+			}
+			card_value_put(card_mem(c, tx[1]), c->transferValue, c->transferAddr);
+			c->transferValid = 0;
+			return card_answer_nibble(resp, MF_ACK);
+
+		default:
+			card_fallback(c);
+			return 0;
+	}
+}
+
+/*
+ * Send one frame to every card in the field and merge the answers the way the
+ * receiver sees them: bits the cards disagree on collide, everything after the
+ * first collision reads as 0 (ValuesAfterColl=0).
+ * collPos receives the 1-based position of the first collision, 0 if there was none.
+ */
+static int sim_rf_exchange(const uint8_t *tx, int txBits, uint8_t *resp, int *collPos)
+{
+	static uint8_t ans[RC522_SIM_MAX_CARDS][RC522_SIM_RF_MAX];
+	int bits[RC522_SIM_MAX_CARDS];
+	int n = 0;
+	int maxBits = 0;
+	int i, k, b;
+
+	*collPos = 0;
+	sim.stats.frames++;
+	if ((sim.regs[TxControlReg] & 0x03) == 0)
+	{
+		return 0;						// antenna off
+	}
+
+	for (i=0; i<sim.cardCount; i++)
+	{
+		if (!sim.cards[i].present)
+		{
+			continue;
+		}
+		memset(ans[n], 0, sizeof(ans[n]));
+		bits[n] = card_frame(&sim.cards[i], tx, txBits, ans[n]);
+		if (bits[n] > 0)
+		{
+			if (bits[n] > maxBits)
+			{
+				maxBits = bits[n];
+			}
+			n++;
+		}
+	}
+
+	memset(resp, 0, (maxBits + 7) / 8);
+	for (b=0; b<maxBits; b++)
+	{
+		uint8_t v = get_bit(ans[0], b);
+		uint8_t same = (b < bits[0]);
+		for (k=1; k<n; k++)
+		{
+			if ((b >= bits[k]) || (get_bit(ans[k], b) != v))
+			{
+				same = 0;
+			}
+		}
+		if (!same)
+		{
+			*collPos = b + 1;
+			break;
+		}
+		put_bit(resp, b, v);
+	}
+
+	return maxBits;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Chip commands                                                             */
+
+static void cmd_transceive(void)
+{
+	uint8_t tx[MFRC522_FIFO_SIZE];
+	uint8_t resp[RC522_SIM_RF_MAX];
+	int txBits, respBits, collPos, lastBits, rxAlign, total, i;
+	uint64_t txEnd;
+
+	lastBits = sim.regs[BitFramingReg] & 0x07;
+	rxAlign = (sim.regs[BitFramingReg] >> 4) & 0x07;
+	memcpy(tx, sim.fifo, sim.fifoLen);
+	txBits = lastBits ? (sim.fifoLen - 1) * 8 + lastBits : sim.fifoLen * 8;
+	sim.fifoLen = 0;
+	sim.regs[ErrorReg] = 0;
+
+	txEnd = sim.nowNs + rf_frame_ns(txBits);
+	respBits = (txBits > 0) ? sim_rf_exchange(tx, txBits, resp, &collPos) : 0;
+
+	memset(&sim.pend, 0, sizeof(sim.pend));
+	sim.pend.active = 1;
+	if (respBits == 0)
+	{
+		// Nobody answered: the timer (TAuto) ends the wait
+		if (!(sim.regs[TModeReg] & 0x80))
+		{
+			sim.pend.active = 0;
+			return;
+		}
+		sim.pend.atNs = txEnd + timer_ns();
+		sim.pend.commIrq = 0x40 | 0x01;			// TxIRq, TimerIRq
+		sim.pend.coll = 0x20;
+		return;
+	}
+
+	// Received bits start at bit RxAlign of the first FIFO byte
+	total = rxAlign + respBits;
+	memset(sim.pend.data, 0, sizeof(sim.pend.data));
+	for (i=0; i<respBits; i++)
+	{
+		put_bit(sim.pend.data, rxAlign + i, get_bit(resp, i));
+	}
+	sim.pend.len = (total + 7) / 8;
+	sim.pend.lastBits = total % 8;
+	sim.pend.rxStartNs = txEnd + RF_FDT_NS + RF_BIT_NS;		// after the SOF
+	sim.pend.atNs = txEnd + RF_FDT_NS + rf_frame_ns(respBits);
+	sim.pend.commIrq = 0x40 | 0x20;				// TxIRq, RxIRq
+	if (collPos)
+	{
+		// CollPos counts within CLn for anticollision frames, 32 reads as 0
+		if ((tx[0] == PICC_ANTICOLL) || (tx[0] == PICC_ANTICOLL_CL2) || (tx[0] == PICC_ANTICOLL_CL3))
+		{
+			collPos += ((tx[1] >> 4) - 2) * 8 + (tx[1] & 0x0F);
+		}
+		sim.pend.error = 0x08;					// CollErr
+		sim.pend.commIrq |= 0x02;				// ErrIRq
+		sim.pend.coll = (collPos > 32) ? 0x20 : (collPos & 0x1F);
+	}
+	else
+	{
+		sim.pend.coll = 0x20;					// CollPosNotValid
+	}
+}
+
+static void cmd_authent(void)
+{
+	RC522_SimCard *c = NULL;
+	uint8_t *trailer;
+	const uint8_t *key;
+	const uint8_t *uid4;
+	int i;
+
+	sim.regs[ErrorReg] = 0;
+	sim.regs[Status2Reg] &= ~0x08;
+	memset(&sim.pend, 0, sizeof(sim.pend));
+	sim.pend.active = 1;
+
+	for (i=0; i<sim.cardCount; i++)
+	{
+		if (sim.cards[i].present && (sim.cards[i].state == CARD_ACTIVE))
+		{
+			c = &sim.cards[i];
+		}
+	}
+
+	if ((sim.fifoLen >= 12) && c && (c->sak & 0x08))
+	{
+		trailer = card_mem(c, (sim.fifo[1] / 4) * 4 + 3);
+		key = (sim.fifo[0] == PICC_AUTHENT1B) ? &trailer[10] : &trailer[0];
+		uid4 = (c->uidLen == 4) ? c->uid : &c->uid[c->uidLen - 4];
+		if ((memcmp(&sim.fifo[2], key, 6) == 0) && (memcmp(&sim.fifo[8], uid4, 4) == 0))
+		{
+			c->authSector = sim.fifo[1] / 4;
+			sim.fifoLen = 0;
+			sim.stats.frames += 3;
+			sim.pend.atNs = sim.nowNs + RF_AUTH_NS;
+			sim.pend.commIrq = 0x10;			// IdleIRq
+			sim.pend.status2 = 0x08;			// MFCrypto1On
+			return;
+		}
+		card_fallback(c);
+	}
+
+	sim.fifoLen = 0;
+	sim.pend.atNs = sim.nowNs + RF_AUTH_NS / 3 + timer_ns();
+	sim.pend.commIrq = 0x01;					// TimerIRq, the card went silent
+}
+
+static void cmd_calccrc(void)
+{
+	uint16_t crc = sim_crc_a(sim.fifo, sim.fifoLen);
+
+	sim.regs[CRCResultRegL] = crc & 0xFF;
+	sim.regs[CRCResultRegH] = crc >> 8;
+	sim.fifoLen = 0;
+	sim.regs[DivIrqReg] |= 0x04;				// CRCIRq
+	sim_irq_check();
+}
+
+static uint8_t reg_read(uint8_t addr)
+{
+	uint8_t v;
+
+	switch (addr)
+	{
+		case FIFODataReg:
+			if (sim.fifoLen == 0)
+			{
+				return 0;
+			}
+			v = sim.fifo[0];
+			memmove(sim.fifo, &sim.fifo[1], --sim.fifoLen);
+			sim_fifo_alert();
+			return v;
+		case FIFOLevelReg:
+			return sim.fifoLen;
+		default:
+			return sim.regs[addr];
+	}
+}
+
+static void reg_write(uint8_t addr, uint8_t val)
+{
+	switch (addr)
+	{
+		case CommandReg:
+			sim.regs[CommandReg] = (sim.regs[CommandReg] & 0xF0) | (val & 0x0F);
+			switch (val & 0x0F)
+			{
+				case PCD_RESETPHASE:
+					sim_chip_reset();
+					break;
+				case PCD_IDLE:
+					sim.pend.active = 0;
+					break;
+				case PCD_CALCCRC:
+					cmd_calccrc();
+					break;
+				case PCD_AUTHENT:
+					cmd_authent();
+					break;
+				default:
+					break;				// Transceive waits for StartSend
+			}
+			break;
+		case CommIrqReg:
+		case DivIrqReg:
+			if (val & 0x80)
+			{
+				sim.regs[addr] |= val & 0x7F;
+			}
+			else
+			{
+				sim.regs[addr] &= ~val;
+			}
+			break;
+		case FIFODataReg:
+			if (sim.fifoLen < MFRC522_FIFO_SIZE)
+			{
+				sim.fifo[sim.fifoLen++] = val;
+			}
+			else
+			{
+				sim.regs[ErrorReg] |= 0x10;		// BufferOvfl
+			}
+			sim_fifo_alert();
+			break;
+		case FIFOLevelReg:
+			if (val & 0x80)
+			{
+				sim.fifoLen = 0;
+				sim.regs[ErrorReg] &= ~0x10;
+				sim_fifo_alert();
+			}
+			break;
+		case BitFramingReg:
+			sim.regs[addr] = val;
+			if ((val & 0x80) && ((sim.regs[CommandReg] & 0x0F) == PCD_TRANSCEIVE))
+			{
+				cmd_transceive();
+			}
+			break;
+		case Status2Reg:
+			sim.regs[addr] = (sim.regs[addr] & 0x07) | (val & 0xF8);
+			break;
+		case VersionReg:
+			break;
+		default:
+			sim.regs[addr] = val;
+			break;
+	}
+	sim_irq_check();
+}
+
+// One byte on the bus while CS is low, see 8.1.2 of the datasheet
+static uint8_t spi_byte(uint8_t tx)
+{
+	uint8_t rx = 0;
+
+	sim_advance(RC522_SIM_SPI_BYTE_NS);
+	sim.stats.bytes++;
+	if (!sim.csLow)
+	{
+		return 0xFF;
+	}
+
+	if (sim.readValid)
+	{
+		rx = reg_read(sim.readAddr);
+		sim.readValid = 0;
+	}
+
+	if (sim.spiFirst)
+	{
+		sim.spiFirst = 0;
+		sim.spiWrite = !(tx & 0x80);
+		sim.spiAddr = (tx >> 1) & 0x3F;
+		if (!sim.spiWrite)
+		{
+			sim.readValid = 1;
+			sim.readAddr = sim.spiAddr;
+		}
+	}
+	else if (sim.spiWrite)
+	{
+		reg_write(sim.spiAddr, tx);
+	}
+	else if (tx & 0x80)
+	{
+		sim.readValid = 1;				// next address of a burst or multi-register read
+		sim.readAddr = (tx >> 1) & 0x3F;
+	}
+
+	return rx;
+}
+
+static void spi_buffer(uint8_t *txData, uint8_t *rxData, uint16_t size)
+{
+	uint16_t i;
+	uint8_t rx;
+
+	for (i=0; i<size; i++)
+	{
+		rx = spi_byte(txData[i]);
+		if (rxData)
+		{
+			rxData[i] = rx;
+		}
+	}
+}
+
+/* ------------------------------------------------------------------------ */
+/* HAL                                                                       */
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+	sim_advance(RC522_SIM_GPIO_NS);
+	if (PinState == GPIO_PIN_SET)
+	{
+		GPIOx->ODR |= GPIO_Pin;
+	}
+	else
+	{
+		GPIOx->ODR &= ~GPIO_Pin;
+	}
+
+	if ((GPIOx == GPIOA) && (GPIO_Pin == GPIO_PIN_4))
+	{
+		if ((PinState == GPIO_PIN_RESET) && !sim.csLow)
+		{
+			sim.stats.transactions++;
+			sim.spiFirst = 1;
+			sim.readValid = 0;
+		}
+		sim.csLow = (PinState == GPIO_PIN_RESET);
+	}
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+	(void)hspi;
+	(void)Timeout;
+	sim.stats.halCalls++;
+	sim_advance(RC522_SIM_HAL_CALL_NS);
+	spi_buffer(pData, NULL, Size);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size, uint32_t Timeout)
+{
+	(void)hspi;
+	(void)Timeout;
+	sim.stats.halCalls++;
+	sim_advance(RC522_SIM_HAL_CALL_NS);
+	spi_buffer(pTxData, pRxData, Size);
+	return HAL_OK;
+}
+
+#if MFRC522_USE_DMA
+// DMA transfers run to completion at once and call the HAL completion callback, as the ISR
+// would, unless RC522_SimDropDma asked for the interrupt to be lost
+static uint8_t sim_dma_lost(void)
+{
+	if (sim.dmaDrop == 0)
+	{
+		return 0;
+	}
+	sim.dmaDrop--;
+	sim.dmaHung = 1;
+	return 1;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size)
+{
+	sim.stats.halCalls++;
+	sim.stats.dmaTransfers++;
+	sim_advance(RC522_SIM_DMA_SETUP_NS);
+	spi_buffer(pData, NULL, Size);
+	if (!sim_dma_lost())
+	{
+		HAL_SPI_TxCpltCallback(hspi);
+	}
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size)
+{
+	sim.stats.halCalls++;
+	sim.stats.dmaTransfers++;
+	sim_advance(RC522_SIM_DMA_SETUP_NS);
+	spi_buffer(pTxData, pRxData, Size);
+	if (!sim_dma_lost())
+	{
+		HAL_SPI_TxRxCpltCallback(hspi);
+	}
+	return HAL_OK;
+}
+#endif
+
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi)
+{
+	(void)hspi;
+	sim.stats.halCalls++;
+	sim.stats.dmaAborts++;
+	sim_advance(RC522_SIM_HAL_CALL_NS);
+	sim.dmaHung = 0;
+	return HAL_OK;
+}
+
+void RC522_SimDropDma(uint32_t n)
+{
+	sim.dmaDrop = n;
+}
+
+uint32_t HAL_GetTick(void)
+{
+	// A driver spinning on a lost DMA completion only moves time forward through this call
+	if (sim.dmaHung)
+	{
+		sim_advance(RC522_SIM_TICK_POLL_NS);
+	}
+	return (uint32_t)(sim.nowNs / 1000000ULL);
+}
+
+// Sleep until the pending command completes or the next SysTick, whichever comes first
+void rc522_sim_wfi(void)
+{
+	uint64_t next = (sim.nowNs / 1000000ULL + 1) * 1000000ULL;
+
+	uint32_t level = MFRC522_FIFO_SIZE - (sim.regs[WaterLevelReg] & 0x3F);
+	uint64_t at;
+
+	if (sim.pend.active && (sim.pend.atNs < next))
+	{
+		next = (sim.pend.atNs > sim.nowNs) ? sim.pend.atNs : sim.nowNs;
+	}
+	// With HiAlertIEn the IRQ line also fires when the byte that reaches the water level arrives
+	if (sim.pend.active && (sim.regs[CommIEnReg] & 0x08) && (sim.fifoLen < level))
+	{
+		at = sim.pend.rxStartNs + (uint64_t)(sim.pend.delivered + level - sim.fifoLen) * RF_BYTE_NS;
+		if ((at > sim.nowNs) && (at < next))
+		{
+			next = at;
+		}
+	}
+	sim_advance(next - sim.nowNs);
+}
+
+DWT_Type *rc522_sim_dwt(void)
+{
+	sim.dwt.CYCCNT = (uint32_t)(sim.nowNs * (RC522_SIM_CORE_HZ / 1000000U) / 1000U);
+	return &sim.dwt;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Model control                                                             */
+
+void RC522_SimReset(void)
+{
+	memset(&sim, 0, sizeof(sim));
+	sim_chip_reset();
+	rc522_sim_gpioa.ODR = 0;
+	rc522_sim_gpiob.ODR = 0;
+}
+
+int RC522_SimAddCard(const uint8_t *uid, uint8_t uidLen, uint8_t type)
+{
+	RC522_SimCard *c;
+	int b;
+
+	if ((sim.cardCount >= RC522_SIM_MAX_CARDS) || ((uidLen != 4) && (uidLen != 7) && (uidLen != 10)))
+	{
+		return -1;
+	}
+
+	c = &sim.cards[sim.cardCount];
+	memset(c, 0, sizeof(*c));
+	memcpy(c->uid, uid, uidLen);
+	c->uidLen = uidLen;
+	c->atqa[0] = (uidLen == 4) ? 0x04 : (uidLen == 7) ? 0x44 : 0x84;
+	c->atqa[1] = 0x00;
+	c->sak = (type == RC522_SIM_MIFARE_1K) ? 0x08 : 0x00;
+	c->type = type;
+	c->present = 1;
+	card_fallback(c);
+	c->halted = 0;
+	c->state = CARD_IDLE;
+
+	if (type == RC522_SIM_MIFARE_1K)
+	{
+		// Block 0: UID + BCC; every sector trailer: default keys and transport access bits
+		memcpy(c->blocks[0], uid, 4);
+		c->blocks[0][4] = uid[0] ^ uid[1] ^ uid[2] ^ uid[3];
+		for (b=3; b<RC522_SIM_BLOCKS; b+=4)
+		{
+			memset(c->blocks[b], 0xFF, 6);
+			c->blocks[b][6] = 0xFF;
+			c->blocks[b][7] = 0x07;
+			c->blocks[b][8] = 0x80;
+			c->blocks[b][9] = 0x69;
+			memset(&c->blocks[b][10], 0xFF, 6);
+		}
+	}
+	else
+	{
+		memcpy(c->blocks[0], uid, (uidLen < 16) ? uidLen : 16);
+		if (type == RC522_SIM_NTAG215)
+		{
+			// Page 3: NDEF capability container, 496 bytes data area
+			c->blocks[0][12] = 0xE1;
+			c->blocks[0][13] = 0x10;
+			c->blocks[0][14] = 0x3E;
+			c->blocks[0][15] = 0x00;
+		}
+	}
+
+	return sim.cardCount++;
+}
+
+RC522_SimCard *RC522_SimGetCard(int idx)
+{
+	return ((idx >= 0) && (idx < sim.cardCount)) ? &sim.cards[idx] : NULL;
+}
+
+void RC522_SimSetPresent(int idx, uint8_t present)
+{
+	RC522_SimCard *c = RC522_SimGetCard(idx);
+
+	if (c)
+	{
+		c->present = present;
+		c->halted = 0;
+		card_fallback(c);				// power is lost outside the field
+	}
+}
+
+void RC522_SimFieldReset(void)
+{
+	int i;
+
+	for (i=0; i<sim.cardCount; i++)
+	{
+		sim.cards[i].halted = 0;
+		card_fallback(&sim.cards[i]);
+	}
+}
+
+void RC522_SimAttachIrq(MFRC522_HandleTypeDef *hrc)
+{
+	sim.irqHandle = hrc;
+}
+
+void RC522_SimStatsReset(void)
+{
+	memset(&sim.stats, 0, sizeof(sim.stats));
+}
+
+const RC522_SimStats *RC522_SimStatsGet(void)
+{
+	return &sim.stats;
+}
+
+uint64_t RC522_SimTimeNs(void)
+{
+	return sim.nowNs;
+}
+
+uint8_t RC522_SimPeekReg(uint8_t addr)
+{
+	return sim.regs[addr & 0x3F];
+}
@@ -0,0 +1,98 @@
+/*
+ * MFRC522 register-level model for running Core/Src/rc522.c on a host.
+ *
+ * The model sits behind the HAL SPI/GPIO calls (include/stm32f4xx_hal.h) and covers the
+ * register file, the 64 byte FIFO and its water level (HiAlert), the timer,
+ * CommIrqReg/DivIrqReg, the CRC coprocessor and a population of ISO 14443-A cards:
+ * MIFARE Classic blocks and value operations, Ultralight READ, NTAG215 GET_VERSION and
+ * FAST_READ. Received bytes enter the FIFO at the RF byte rate, so answers longer than the
+ * FIFO overflow unless drained in time.
+ * Crypto1 is not modelled: after a successful MFAuthent the frames stay in plain text.
+ *
+ * Time is simulated. SPI bytes, HAL call overhead and RF frames advance it, HAL_GetTick
+ * and the DWT cycle counter are derived from it.
+ */
+#ifndef RC522_SIM_H
+#define RC522_SIM_H
+
+#include <stdint.h>
+#include "rc522.h"
+
+#define RC522_SIM_MAX_CARDS		8
+#define RC522_SIM_BLOCKS		64		// MIFARE Classic 1K
+
+// Card types for the ATQA/SAK defaults of RC522_SimAddCard
+#define RC522_SIM_MIFARE_1K		0
+#define RC522_SIM_ULTRALIGHT	1		// original Ultralight: READ only, no GET_VERSION
+#define RC522_SIM_NTAG215		2
+
+#define RC522_SIM_NTAG215_PAGES	135
+#define RC522_SIM_RF_MAX		1024	// longest answer frame, bytes
+
+// Cost model, in nanoseconds. SPI1 runs at 72MHz/8 on the board.
+#define RC522_SIM_SPI_BYTE_NS	889
+#define RC522_SIM_HAL_CALL_NS	1500	// HAL_SPI_TransmitReceive entry/exit
+#define RC522_SIM_DMA_SETUP_NS	2500	// stream setup plus completion interrupt
+#define RC522_SIM_GPIO_NS		60
+#define RC522_SIM_TICK_POLL_NS	50		// one pass of a loop polling HAL_GetTick
+#define RC522_SIM_CORE_HZ		72000000U
+
+typedef struct
+{
+	uint8_t uid[MFRC522_UID_MAX];
+	uint8_t uidLen;
+	uint8_t atqa[2];
+	uint8_t sak;						// SAK of the last cascade level
+	uint8_t blocks[RC522_SIM_BLOCKS][16];	// Ultralight/NTAG: 4-byte pages, laid out flat
+	uint8_t type;
+	uint8_t present;
+
+	// ISO 14443-3 state, driven by the model
+	uint8_t state;
+	uint8_t halted;						// READY*/ACTIVE*: falls back to HALT instead of IDLE
+	uint8_t level;						// cascade level being resolved
+	uint8_t authSector;					// 0xFF when not authenticated
+	uint8_t writeBlock;					// WRITE part two expected for this block, 0xFF otherwise
+	uint8_t valueCmd;					// DECREMENT/INCREMENT/RESTORE waiting for its operand, 0 otherwise
+	uint8_t valueBlock;					// source block of valueCmd
+	uint8_t transferValid;				// transfer buffer holds a result for TRANSFER
+	int32_t transferValue;
+	uint8_t transferAddr;				// address byte carried over from the source block
+} RC522_SimCard;
+
+typedef struct
+{
+	uint32_t transactions;		// CS assertions
+	uint32_t bytes;				// bytes clocked over SPI
+	uint32_t halCalls;			// blocking and DMA HAL SPI calls
+	uint32_t dmaTransfers;		// of which DMA (MFRC522_USE_DMA builds)
+	uint32_t dmaAborts;			// DMA transfers aborted by the driver
+	uint32_t frames;			// RF frames sent to the cards
+	uint64_t timeNs;			// simulated time spent
+} RC522_SimStats;
+
+// Power-on: chip registers to reset values, no cards, time and counters at zero
+void RC522_SimReset(void);
+
+// Add a card to the field, returns its index or -1. type selects default ATQA/SAK.
+int RC522_SimAddCard(const uint8_t *uid, uint8_t uidLen, uint8_t type);
+RC522_SimCard *RC522_SimGetCard(int idx);
+void RC522_SimSetPresent(int idx, uint8_t present);
+
+// Every card leaves the field and comes back: all states back to IDLE
+void RC522_SimFieldReset(void);
+
+// Notify this reader through MFRC522_IrqNotify whenever the IRQ pin is asserted
+void RC522_SimAttachIrq(MFRC522_HandleTypeDef *hrc);
+
+// The next n DMA transfers never raise their completion interrupt (MFRC522_USE_DMA builds)
+void RC522_SimDropDma(uint32_t n);
+
+void RC522_SimStatsReset(void);
+const RC522_SimStats *RC522_SimStatsGet(void);
+uint64_t RC522_SimTimeNs(void);
+
+// Direct register access for checks, bypasses SPI and the counters
+uint8_t RC522_SimPeekReg(uint8_t addr);
+
+#endif
@@ -0,0 +1,178 @@
+// Roll size sweep: perfect-hash build time, flash image size and boot check time, and lookup
+// cost against the linear scan main.c used before the index (memcmp over every authorized UID).
+// Then the prefilter report: memory and image capacity against false-positive rate, measured
+// pass and false-accept rates for unknown cards, and their cost on the firmware path.
+//   votergen_bench [max_voters]
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include "votergen.hpp"
+
+typedef std::chrono::steady_clock clk;
+
+static double ns_since(clk::time_point t0)
+{
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(clk::now() - t0).count();
+}
+
+// 4-byte NUIDs and 7-byte UIDs mixed like a real card batch; no duplicates
+static std::vector<Voter> random_roll(size_t n, std::mt19937 &rng)
+{
+    std::vector<Voter> roll;
+    std::vector<std::string> seen;
+    while (roll.size() < n) {
+        Voter v;
+        v.size = (rng() % 10 < 7) ? 4 : 7;
+        for (unsigned i = 0; i < v.size; i++) v.uid[i] = (uint8_t)rng();
+        roll.push_back(v);
+    }
+    // Drop the (rare) duplicates so the build does not refuse the roll
+    std::sort(roll.begin(), roll.end(), [](const Voter &a, const Voter &b) {
+        return a.size != b.size ? a.size < b.size : memcmp(a.uid, b.uid, a.size) < 0;
+    });
+    roll.erase(std::unique(roll.begin(), roll.end(), [](const Voter &a, const Voter &b) {
+        return a.size == b.size && memcmp(a.uid, b.uid, a.size) == 0;
+    }), roll.end());
+    std::shuffle(roll.begin(), roll.end(), rng);
+    return roll;
+}
+
+static int linear_lookup(const std::vector<Voter> &roll, const Voter &v)
+{
+    for (size_t i = 0; i < roll.size(); i++) {
+        if (roll[i].size == v.size && memcmp(roll[i].uid, v.uid, v.size) == 0) return (int)i;
+    }
+    return -1;
+}
+
+static std::string key_of(const Voter &v)
+{
+    return std::string((const char *)v.uid, v.size) + (char)v.size;
+}
+
+static int prefilter_report(size_t max_voters, std::mt19937 &rng)
+{
+    static const size_t sizes[] = { 1000, 5000, 8000, 50000 };
+    static const double rates[] = { 0.0, 0.10, 0.05, 0.01, 0.001 };
+    const double region = 128.0 * 1024.0;
+    std::vector<Voter> strangers = random_roll(1000000, rng);
+    int failures = 0;
+    volatile int32_t sink = 0;
+
+    printf("\n%8s %7s %9s %3s %7s %9s %8s %9s %10s\n", "voters", "fp_set", "bloom_kb", "k", "B/voter",
+           "fits_128k", "pass_%", "acc_ppm", "unknown_ns");
+    for (size_t n : sizes) {
+        if (n > max_voters) break;
+        std::vector<Voter> roll = random_roll(n, rng);
+        std::set<std::string> on_roll;
+        for (const Voter &v : roll) on_roll.insert(key_of(v));
+        std::vector<Voter> unknown;
+        for (const Voter &v : strangers)
+            if (!on_roll.count(key_of(v))) unknown.push_back(v);
+
+        for (double p : rates) {
+            BuildParams params;
+            params.bloom_fp = p;
+            Index ix = build_index(roll, params);
+            voter_index_t vi = ix.view();
+
+            for (const Voter &v : roll)
+                if (!voter_index_maybe(&vi, v.uid, v.size)) failures++;
+
+            size_t pass = 0, accept = 0;
+            for (const Voter &v : unknown) {
+                if (!voter_index_maybe(&vi, v.uid, v.size)) continue;
+                pass++;
+                if (voter_index_lookup(&vi, v.uid, v.size) != VOTER_NONE) accept++;
+            }
+            failures += (int)accept;
+
+            // authorized_voter() in main.c: prefilter, then the lookup for what gets through
+            clk::time_point t0 = clk::now();
+            for (const Voter &v : unknown)
+                sink += voter_index_maybe(&vi, v.uid, v.size) ? voter_index_lookup(&vi, v.uid, v.size) : VOTER_NONE;
+            double unknown_ns = ns_since(t0) / unknown.size();
+
+            double per_voter = (double)(ix.bytes() + ix.n_slots * sizeof(voter_meta_t)) / n;
+            printf("%8zu %7.3f %9.1f %3u %7.2f %9.0f %8.2f %9.2f %10.1f\n", n, p, ix.bloom.size() * 4 / 1024.0,
+                   ix.bloom_k, per_voter, region / per_voter, 100.0 * pass / unknown.size(),
+                   1e6 * accept / unknown.size(), unknown_ns);
+        }
+    }
+    (void)sink;
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t sizes[] = { 1000, 5000, 10000, 25000, 50000, 100000 };
+    size_t max_voters = (argc > 1) ? (size_t)std::atol(argv[1]) : 100000;
+    std::mt19937 rng(0xB0075);
+    int failures = 0;
+    volatile int32_t sink = 0;
+
+    printf("%8s %9s %9s %9s %7s %8s %8s %8s %10s %9s\n", "voters", "build_ms", "image_ms", "open_ms",
+           "B/voter", "image_kb", "hit_ns", "miss_ns", "linear_ns", "false_acc");
+    for (size_t n : sizes) {
+        if (n > max_voters) break;
+        std::vector<Voter> roll = random_roll(n, rng);
+        std::vector<Voter> strangers = random_roll(100000, rng);
+
+        clk::time_point t0 = clk::now();
+        Index ix = build_index(roll);
+        double build_ms = ns_since(t0) / 1e6;
+
+        // Image (includes the tool's own check of every voter) and the firmware's boot check
+        t0 = clk::now();
+        std::vector<uint8_t> img = build_image(ix, roll, 1, UINT32_MAX);
+        double image_ms = ns_since(t0) / 1e6;
+        voter_roll_t vr;
+        t0 = clk::now();
+        if (voter_roll_open(&vr, img.data(), (uint32_t)img.size()) != VOTER_ROLL_OK) failures++;
+        double open_ms = ns_since(t0) / 1e6;
+        voter_index_t vi = vr.index;
+
+        // Every voter must come back with its own slot
+        for (size_t i = 0; i < roll.size(); i++) {
+            if (voter_index_lookup(&vi, roll[i].uid, roll[i].size) != (int32_t)ix.slot_of[i]) failures++;
+        }
+
+        const int rounds = 10;
+        t0 = clk::now();
+        for (int r = 0; r < rounds; r++)
+            for (const Voter &v : roll) sink += voter_index_lookup(&vi, v.uid, v.size);
+        double hit_ns = ns_since(t0) / ((double)rounds * roll.size());
+
+        // The key compare must turn every unknown card away
+        size_t false_acc = 0;
+        for (const Voter &v : strangers) {
+            int32_t s = voter_index_lookup(&vi, v.uid, v.size);
+            // A stranger that is really on the roll is not a false accept
+            if (s != VOTER_NONE && linear_lookup(roll, v) < 0) false_acc++;
+        }
+        failures += (int)false_acc;
+        t0 = clk::now();
+        for (const Voter &v : strangers) sink += voter_index_lookup(&vi, v.uid, v.size);
+        double miss_ns = ns_since(t0) / strangers.size();
+
+        // The scan is O(n): time a sample of hits spread over the roll
+        const size_t samples = 1000;
+        t0 = clk::now();
+        for (size_t i = 0; i < samples; i++) sink += linear_lookup(roll, roll[(i * 7919) % roll.size()]);
+        double linear_ns = ns_since(t0) / samples;
+
+        printf("%8zu %9.1f %9.1f %9.2f %7.2f %8.1f %8.1f %8.1f %10.0f %9zu\n", roll.size(), build_ms, image_ms,
+               open_ms, (double)img.size() / roll.size(), img.size() / 1024.0, hit_ns, miss_ns, linear_ns,
+               false_acc);
+    }
+    failures += prefilter_report(max_voters, rng);
+    (void)sink;
+    printf("%s\n", failures ? "FAILED" : "all voters found");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,138 @@
+// CHD perfect-hash build (compress, hash, displace) over the hash in Core/Src/voter_index.c
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include "votergen.hpp"
+
+static const uint32_t SEED_BASE = 0x5EEDB007U;
+static const unsigned SEED_TRIES = 64;
+static const uint32_t DISP_MAX = 0xFFFFU;
+
+voter_index_t Index::view() const
+{
+    voter_index_t vi;
+    vi.seed = seed;
+    vi.n_slots = n_slots;
+    vi.n_buckets = n_buckets;
+    vi.n_voters = (uint32_t)slot_of.size();
+    vi.disp = disp.data();
+    vi.fp = fp.data();
+    vi.keys = keys.data();
+    vi.bloom_bits = bloom_bits;
+    vi.bloom_k = bloom_k;
+    vi.bloom = bloom.empty() ? nullptr : bloom.data();
+    return vi;
+}
+
+static std::string uid_hex(const Voter &v)
+{
+    std::string s;
+    char b[4];
+    for (unsigned i = 0; i < v.size; i++) {
+        snprintf(b, sizeof(b), i ? " %02X" : "%02X", v.uid[i]);
+        s += b;
+    }
+    return s;
+}
+
+// One attempt with the given seed; false if some bucket found no free displacement
+static bool try_seed(Index &ix, const std::vector<std::array<uint8_t, VOTER_KEY_LEN>> &keys)
+{
+    voter_index_t vi = ix.view();
+    std::vector<std::vector<uint32_t>> buckets(ix.n_buckets);
+    std::vector<uint32_t> order(ix.n_buckets);
+    std::vector<uint8_t> taken(ix.n_slots, 0);
+    std::vector<uint32_t> slots;
+
+    for (uint32_t i = 0; i < keys.size(); i++) buckets[voter_index_bucket(&vi, keys[i].data())].push_back(i);
+    for (uint32_t b = 0; b < ix.n_buckets; b++) order[b] = b;
+    // Fullest buckets first, while most slots are still free
+    std::stable_sort(order.begin(), order.end(),
+                     [&](uint32_t a, uint32_t b) { return buckets[a].size() > buckets[b].size(); });
+
+    std::fill(ix.disp.begin(), ix.disp.end(), 0);
+    std::fill(ix.fp.begin(), ix.fp.end(), VOTER_FP_EMPTY);
+    std::fill(ix.keys.begin(), ix.keys.end(), 0);
+    for (uint32_t b : order) {
+        const std::vector<uint32_t> &members = buckets[b];
+        if (members.empty()) break;
+
+        bool placed = false;
+        for (uint32_t d = 0; d <= DISP_MAX && !placed; d++) {
+            slots.clear();
+            for (uint32_t k : members) {
+                uint32_t s = voter_index_slot(&vi, keys[k].data(), (uint16_t)d);
+                if (taken[s] || std::find(slots.begin(), slots.end(), s) != slots.end()) break;
+                slots.push_back(s);
+            }
+            if (slots.size() != members.size()) continue;
+            for (size_t j = 0; j < members.size(); j++) {
+                taken[slots[j]] = 1;
+                ix.fp[slots[j]] = voter_index_fingerprint(&vi, keys[members[j]].data());
+                memcpy(&ix.keys[(size_t)slots[j] * VOTER_SLOT_KEY], keys[members[j]].data(), VOTER_SLOT_KEY);
+                ix.slot_of[members[j]] = slots[j];
+            }
+            ix.disp[b] = (uint16_t)d;
+            placed = true;
+        }
+        if (!placed) return false;
+    }
+    return true;
+}
+
+// Standard sizing: m = -n ln(fp) / ln(2)^2 bits, k = (m / n) ln(2) probes
+void bloom_size(size_t n, double fp, uint32_t *bits, uint32_t *k)
+{
+    const double ln2 = std::log(2.0);
+    double m = std::ceil(-(double)std::max<size_t>(n, 1) * std::log(fp) / (ln2 * ln2));
+
+    *bits = std::max<uint32_t>(32, ((uint32_t)m + 31U) & ~31U);
+    *k = (uint32_t)std::lround((double)*bits / std::max<size_t>(n, 1) * ln2);
+    *k = std::min<uint32_t>(std::max<uint32_t>(*k, 1), 32);
+}
+
+// The prefilter hashes depend on the seed, so it is filled once the seed is settled
+static void add_bloom(Index &ix, const std::vector<std::array<uint8_t, VOTER_KEY_LEN>> &keys, double fp)
+{
+    bloom_size(keys.size(), fp, &ix.bloom_bits, &ix.bloom_k);
+    ix.bloom.assign(ix.bloom_bits / 32, 0);
+    voter_index_t vi = ix.view();
+    for (const auto &key : keys) voter_index_bloom_add(&vi, ix.bloom.data(), key.data());
+}
+
+Index build_index(const std::vector<Voter> &roll, const BuildParams &params)
+{
+    if (params.load <= 0.0 || params.load > 1.0 || params.per_bucket == 0 || params.bloom_fp < 0.0 ||
+        params.bloom_fp >= 1.0)
+        throw std::runtime_error("bad build parameters");
+    if (roll.size() > 0x7FFFFFFFU) throw std::runtime_error("roll too large");
+
+    std::vector<std::array<uint8_t, VOTER_KEY_LEN>> keys(roll.size());
+    std::unordered_set<std::string> seen;
+    for (size_t i = 0; i < roll.size(); i++) {
+        voter_index_key(keys[i].data(), roll[i].uid, roll[i].size);
+        if (!seen.insert(std::string((const char *)keys[i].data(), VOTER_KEY_LEN)).second)
+            throw std::runtime_error("duplicate UID " + uid_hex(roll[i]));
+    }
+
+    Index ix;
+    ix.n_slots = std::max<uint32_t>(1, (uint32_t)std::ceil(roll.size() / params.load));
+    ix.n_buckets = std::max<uint32_t>(1, (uint32_t)((roll.size() + params.per_bucket - 1) / params.per_bucket));
+    ix.disp.assign(ix.n_buckets, 0);
+    ix.fp.assign(ix.n_slots, VOTER_FP_EMPTY);
+    ix.keys.assign((size_t)ix.n_slots * VOTER_SLOT_KEY, 0);
+    ix.slot_of.assign(roll.size(), 0);
+
+    for (unsigned t = 0; t < SEED_TRIES; t++) {
+        ix.seed = SEED_BASE + t * 4U;   // seed, seed+1 and seed+2 are all in use
+        if (!try_seed(ix, keys)) continue;
+        if (params.bloom_fp > 0.0) add_bloom(ix, keys, params.bloom_fp);
+        return ix;
+    }
+    throw std::runtime_error("no displacement fits; lower the load factor");
+}
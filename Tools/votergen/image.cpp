@@ -0,0 +1,68 @@
+// Voter roll flash image, layout in Core/Inc/voter_roll.h
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include "votergen.hpp"
+
+static uint32_t align4(size_t n)
+{
+    return (uint32_t)((n + 3U) & ~(size_t)3U);
+}
+
+std::vector<uint8_t> build_image(const Index &ix, const std::vector<Voter> &roll, uint32_t roll_id,
+                                 uint32_t max_size)
+{
+    voter_roll_header_t h;
+    memset(&h, 0, sizeof(h));
+    h.magic = VOTER_ROLL_MAGIC;
+    h.version = VOTER_ROLL_VERSION;
+    h.header_size = sizeof(h);
+    h.roll_id = roll_id;
+    h.seed = ix.seed;
+    h.n_slots = ix.n_slots;
+    h.n_buckets = ix.n_buckets;
+    h.n_voters = (uint32_t)roll.size();
+    h.meta_size = sizeof(voter_meta_t);
+    h.disp_offset = align4(sizeof(h));
+    h.fp_offset = align4(h.disp_offset + ix.disp.size() * sizeof(uint16_t));
+    h.key_offset = align4(h.fp_offset + ix.fp.size() * sizeof(uint16_t));
+    h.meta_offset = align4(h.key_offset + ix.keys.size());
+    h.bloom_offset = align4(h.meta_offset + (size_t)ix.n_slots * sizeof(voter_meta_t));
+    h.bloom_bits = ix.bloom_bits;
+    h.bloom_k = ix.bloom_k;
+    size_t size = h.bloom_offset + ix.bloom.size() * sizeof(uint32_t);
+    if (size > max_size)
+        throw std::runtime_error("image is " + std::to_string(size) + " bytes, the region holds " +
+                                 std::to_string(max_size) + ": about " +
+                                 std::to_string((uint64_t)max_size * roll.size() / size) + " of these " +
+                                 std::to_string(roll.size()) + " voters");
+    h.image_size = (uint32_t)size;
+
+    // Both sides are little endian, so the tables go in as they are in memory
+    std::vector<uint8_t> img(size, 0);
+    memcpy(&img[h.disp_offset], ix.disp.data(), ix.disp.size() * sizeof(uint16_t));
+    memcpy(&img[h.fp_offset], ix.fp.data(), ix.fp.size() * sizeof(uint16_t));
+    memcpy(&img[h.key_offset], ix.keys.data(), ix.keys.size());
+    voter_meta_t *meta = (voter_meta_t *)&img[h.meta_offset];
+    for (size_t i = 0; i < roll.size(); i++) meta[ix.slot_of[i]].precinct = roll[i].precinct;
+    if (!ix.bloom.empty()) memcpy(&img[h.bloom_offset], ix.bloom.data(), ix.bloom.size() * sizeof(uint32_t));
+
+    memcpy(img.data(), &h, sizeof(h));
+    h.crc = voter_roll_crc32(0, img.data(), (uint32_t)size);  // crc field is still 0 here
+    memcpy(img.data(), &h, sizeof(h));
+
+    // Read it back the way the firmware will
+    voter_roll_t vr;
+    int st = voter_roll_open(&vr, img.data(), max_size);
+    if (st != VOTER_ROLL_OK) throw std::runtime_error("image fails its own check (" + std::to_string(st) + ")");
+    for (size_t i = 0; i < roll.size(); i++) {
+        if (!voter_index_maybe(&vr.index, roll[i].uid, roll[i].size))
+            throw std::runtime_error("prefilter rejects roll entry " + std::to_string(i));
+        int32_t s = voter_index_lookup(&vr.index, roll[i].uid, roll[i].size);
+        const voter_meta_t *m = voter_roll_meta(&vr, s);
+        if (s != (int32_t)ix.slot_of[i] || m == nullptr || m->precinct != roll[i].precinct)
+            throw std::runtime_error("image lookup mismatch at roll entry " + std::to_string(i));
+    }
+    return img;
+}
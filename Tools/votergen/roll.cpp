@@ -0,0 +1,278 @@
+// Voter roll parsing (CSV and JSON), see votergen.hpp
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include "votergen.hpp"
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    c = (char)std::tolower((unsigned char)c);
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// UID in hex; false if the field is not one (a header, say)
+static bool parse_uid(const std::string &field, Voter &v)
+{
+    int nibbles = 0;
+    int hi = 0;
+
+    v = Voter();
+    for (char c : field) {
+        if (c == ':' || c == '-' || c == ' ' || c == '"') continue;
+        int x = hex_value(c);
+        if (x < 0 || nibbles >= VOTER_UID_MAX * 2) return false;
+        if (nibbles & 1) v.uid[nibbles / 2] = (uint8_t)((hi << 4) | x);
+        else hi = x;
+        nibbles++;
+    }
+    if (nibbles & 1) return false;
+    v.size = (uint8_t)(nibbles / 2);
+    return true;
+}
+
+static std::runtime_error line_error(unsigned lineno, const std::string &what)
+{
+    return std::runtime_error("line " + std::to_string(lineno) + ": " + what);
+}
+
+static void check_uid_size(const Voter &v, unsigned lineno)
+{
+    if (v.size != 4 && v.size != 7 && v.size != 10) throw line_error(lineno, "UID must be 4, 7 or 10 bytes");
+}
+
+static uint8_t parse_precinct(const std::string &s, unsigned lineno)
+{
+    char *end = nullptr;
+    long x = std::strtol(s.c_str(), &end, 10);
+    if (s.empty() || *end != '\0' || x < 0 || x > 255) throw line_error(lineno, "precinct must be 0..255");
+    return (uint8_t)x;
+}
+
+static std::string trim(const std::string &s)
+{
+    size_t b = s.find_first_not_of(" \t\r\"");
+    if (b == std::string::npos) return "";
+    return s.substr(b, s.find_last_not_of(" \t\r\"") - b + 1);
+}
+
+static std::string lower(std::string s)
+{
+    for (char &c : s) c = (char)std::tolower((unsigned char)c);
+    return s;
+}
+
+static std::vector<std::string> split_fields(const std::string &line)
+{
+    std::vector<std::string> fields;
+    size_t start = 0;
+    for (;;) {
+        size_t end = line.find_first_of(",;\t", start);
+        fields.push_back(trim(line.substr(start, end - start)));
+        if (end == std::string::npos) break;
+        start = end + 1;
+    }
+    return fields;
+}
+
+// CSV: the UID in the first field, or in the "uid" column when there is a header; an optional
+// "precinct" column is only recognised through the header.
+static std::vector<Voter> parse_csv(const std::string &text)
+{
+    std::vector<Voter> roll;
+    std::istringstream in(text);
+    std::string line;
+    unsigned lineno = 0;
+    bool header_seen = false;
+    size_t uid_col = 0;
+    size_t precinct_col = std::string::npos;
+
+    while (std::getline(in, line)) {
+        lineno++;
+        line = line.substr(0, line.find('#'));
+        std::vector<std::string> fields = split_fields(line);
+        if (fields.size() == 1 && fields[0].empty()) continue;
+
+        Voter v;
+        if (uid_col >= fields.size() || !parse_uid(fields[uid_col], v)) {
+            if (!header_seen && roll.empty()) {
+                header_seen = true;
+                for (size_t i = 0; i < fields.size(); i++) {
+                    if (lower(fields[i]) == "uid") uid_col = i;
+                    if (lower(fields[i]) == "precinct") precinct_col = i;
+                }
+                continue;
+            }
+            std::string field = (uid_col < fields.size()) ? fields[uid_col] : "";
+            throw line_error(lineno, "bad UID '" + field + "'");
+        }
+        check_uid_size(v, lineno);
+        if (precinct_col < fields.size() && !fields[precinct_col].empty())
+            v.precinct = parse_precinct(fields[precinct_col], lineno);
+        roll.push_back(v);
+    }
+    return roll;
+}
+
+// Just enough JSON for a roll: [ "uid", ... ], [ {"uid": "...", "precinct": n}, ... ] or the
+// same array under a "voters" key. Unknown keys are skipped.
+class JsonRoll {
+public:
+    explicit JsonRoll(const std::string &text) : s(text) {}
+
+    std::vector<Voter> parse()
+    {
+        skip_ws();
+        if (peek() == '{') {
+            bool found = false;
+            object([&](const std::string &key) {
+                if (key == "voters") { voters(); found = true; }
+                else skip_value();
+            });
+            if (!found) throw error("no \"voters\" array");
+        } else {
+            voters();
+        }
+        skip_ws();
+        if (pos != s.size()) throw error("trailing characters");
+        return roll;
+    }
+
+private:
+    const std::string &s;
+    size_t pos = 0;
+    unsigned lineno = 1;
+    std::vector<Voter> roll;
+
+    std::runtime_error error(const std::string &what) const { return line_error(lineno, what); }
+    char peek() const { return pos < s.size() ? s[pos] : '\0'; }
+
+    void skip_ws()
+    {
+        while (pos < s.size() && std::isspace((unsigned char)s[pos])) {
+            if (s[pos] == '\n') lineno++;
+            pos++;
+        }
+    }
+
+    void expect(char c)
+    {
+        skip_ws();
+        if (peek() != c) throw error(std::string("expected '") + c + "'");
+        pos++;
+    }
+
+    std::string string()
+    {
+        std::string out;
+        expect('"');
+        while (pos < s.size() && s[pos] != '"') {
+            if (s[pos] == '\\' && pos + 1 < s.size()) pos++;
+            out += s[pos++];
+        }
+        expect('"');
+        return out;
+    }
+
+    std::string scalar()
+    {
+        skip_ws();
+        size_t b = pos;
+        while (pos < s.size() && (std::isalnum((unsigned char)s[pos]) || s[pos] == '-' || s[pos] == '+' || s[pos] == '.'))
+            pos++;
+        if (b == pos) throw error("expected a value");
+        return s.substr(b, pos - b);
+    }
+
+    template <typename F> void object(F &&member)
+    {
+        expect('{');
+        skip_ws();
+        if (peek() == '}') { pos++; return; }
+        for (;;) {
+            std::string key = string();
+            expect(':');
+            member(key);
+            skip_ws();
+            if (peek() == ',') { pos++; continue; }
+            expect('}');
+            return;
+        }
+    }
+
+    template <typename F> void array(F &&element)
+    {
+        expect('[');
+        skip_ws();
+        if (peek() == ']') { pos++; return; }
+        for (;;) {
+            element();
+            skip_ws();
+            if (peek() == ',') { pos++; continue; }
+            expect(']');
+            return;
+        }
+    }
+
+    void skip_value()
+    {
+        skip_ws();
+        if (peek() == '"') string();
+        else if (peek() == '{') object([&](const std::string &) { skip_value(); });
+        else if (peek() == '[') array([&] { skip_value(); });
+        else scalar();
+    }
+
+    Voter uid_value()
+    {
+        skip_ws();
+        unsigned at = lineno;
+        std::string text = string();
+        Voter v;
+        if (!parse_uid(text, v)) throw line_error(at, "bad UID '" + text + "'");
+        check_uid_size(v, at);
+        return v;
+    }
+
+    void voters()
+    {
+        array([&] {
+            skip_ws();
+            if (peek() == '"') {
+                roll.push_back(uid_value());
+                return;
+            }
+            Voter v;
+            bool has_uid = false;
+            uint8_t precinct = 0;
+            object([&](const std::string &key) {
+                skip_ws();
+                if (key == "uid") { v = uid_value(); has_uid = true; }
+                else if (key == "precinct") precinct = parse_precinct(scalar(), lineno);
+                else skip_value();
+            });
+            if (!has_uid) throw error("voter without \"uid\"");
+            v.precinct = precinct;
+            roll.push_back(v);
+        });
+    }
+};
+
+std::vector<Voter> parse_roll(const std::string &text)
+{
+    size_t b = text.find_first_not_of(" \t\r\n");
+    if (b != std::string::npos && (text[b] == '[' || text[b] == '{')) return JsonRoll(text).parse();
+    return parse_csv(text);
+}
+
+std::vector<Voter> read_roll(const std::string &path)
+{
+    std::ifstream f(path, std::ios::binary);
+    if (!f) throw std::runtime_error("cannot open " + path);
+    std::ostringstream ss;
+    ss << f.rdbuf();
+    return parse_roll(ss.str());
+}
@@ -0,0 +1,127 @@
+// votergen: compile a voter roll into Core/Src/voter_table.c or a VOTER_ROLL flash image
+//   votergen [-l load] [-b per_bucket] [-p bloom_fp] roll.csv [-o voter_table.c]
+//   votergen [-l load] [-b per_bucket] [-p bloom_fp] [-r roll_id] [-s region_bytes] roll.csv -o roll.bin
+// -p sets the prefilter false-positive rate (default 0.01, 0 for no prefilter).
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include "votergen.hpp"
+
+// VOTER_ROLL in STM32F401CCUX_FLASH.ld: sector 5
+static const uint32_t REGION_SIZE = 128U * 1024U;
+
+static bool ends_with(const std::string &s, const std::string &suffix)
+{
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+template <typename T> static void write_array(std::ostream &out, const char *name, const std::vector<T> &v)
+{
+    const int digits = (int)sizeof(T) * 2;
+    const size_t per_line = (sizeof(T) == 1) ? VOTER_SLOT_KEY : (sizeof(T) == 2) ? 12 : 8;     // keys: a slot per line
+    char b[16];
+
+    out << "static const uint" << sizeof(T) * 8 << "_t " << name << "[" << v.size() << "] = {";
+    for (size_t i = 0; i < v.size(); i++) {
+        out << ((i % per_line) ? " " : "\n    ");
+        snprintf(b, sizeof(b), "0x%0*lXU,", digits, (unsigned long)v[i]);
+        out << b;
+    }
+    out << "\n};\n\n";
+}
+
+void write_c_table(std::ostream &out, const Index &ix, const std::string &source)
+{
+    char seed[16];
+    snprintf(seed, sizeof(seed), "0x%08XU", ix.seed);
+
+    out << "/*\n"
+           " * voter_table.c\n"
+           " *\n"
+           " * Generated by Tools/votergen from " << source << ", do not edit.\n"
+           " * " << ix.slot_of.size() << " voters, " << ix.n_slots << " slots, " << ix.n_buckets
+        << " buckets, " << ix.bytes() << " bytes.\n"
+           " */\n"
+           "#include \"voter_index.h\"\n\n";
+    write_array(out, "voter_disp", ix.disp);
+    write_array(out, "voter_fp", ix.fp);
+    write_array(out, "voter_keys", ix.keys);
+    if (!ix.bloom.empty()) write_array(out, "voter_bloom", ix.bloom);
+    out << "const voter_index_t voter_table = {\n"
+           "    .seed = " << seed << ",\n"
+           "    .n_slots = " << ix.n_slots << "U,\n"
+           "    .n_buckets = " << ix.n_buckets << "U,\n"
+           "    .n_voters = " << ix.slot_of.size() << "U,\n"
+           "    .disp = voter_disp,\n"
+           "    .fp = voter_fp,\n"
+           "    .keys = voter_keys,\n"
+           "    .bloom_bits = " << ix.bloom_bits << "U,\n"
+           "    .bloom_k = " << ix.bloom_k << "U,\n"
+           "    .bloom = " << (ix.bloom.empty() ? "0" : "voter_bloom") << ",\n"
+           "};\n";
+}
+
+static void usage()
+{
+    std::cerr << "usage: votergen [-l load] [-b per_bucket] [-p bloom_fp] roll.csv [-o voter_table.c]\n"
+                 "       votergen [-l load] [-b per_bucket] [-p bloom_fp] [-r roll_id] [-s region_bytes] roll.csv -o roll.bin\n";
+    std::exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    BuildParams params;
+    std::string in, out;
+    uint32_t roll_id = 1;
+    uint32_t region = REGION_SIZE;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if ((a == "-o" || a == "-l" || a == "-b" || a == "-r" || a == "-s" || a == "-p") && i + 1 >= argc) usage();
+        if (a == "-o") out = argv[++i];
+        else if (a == "-r") roll_id = (uint32_t)std::strtoul(argv[++i], nullptr, 0);
+        else if (a == "-s") region = (uint32_t)std::strtoul(argv[++i], nullptr, 0);
+        else if (a == "-p") params.bloom_fp = std::atof(argv[++i]);
+        else if (a == "-l") params.load = std::atof(argv[++i]);
+        else if (a == "-b") params.per_bucket = (unsigned)std::atoi(argv[++i]);
+        else if (a[0] == '-' || !in.empty()) usage();
+        else in = a;
+    }
+    if (in.empty()) usage();
+
+    try {
+        std::vector<Voter> roll = read_roll(in);
+        Index ix = build_index(roll, params);
+        if (ix.bloom_bits)
+            std::cerr << in << ": prefilter " << ix.bloom_bits / 8 << " bytes, " << ix.bloom_k << " probes, "
+                      << params.bloom_fp * 100.0 << "% false positives\n";
+        if (ends_with(out, ".bin")) {
+            std::vector<uint8_t> img = build_image(ix, roll, roll_id, region);
+            std::ofstream f(out, std::ios::binary);
+            if (!f || !f.write((const char *)img.data(), (std::streamsize)img.size()))
+                throw std::runtime_error("cannot write " + out);
+            std::cerr << in << ": " << roll.size() << " voters, roll " << roll_id << ", " << img.size()
+                      << " of " << region << " bytes\n";
+            // Capacity at this roll's cost per voter, past the fixed header
+            double per_voter = (double)(img.size() - sizeof(voter_roll_header_t)) / roll.size();
+            if (!roll.empty())
+                std::cerr << in << ": " << (int)(10.0 * per_voter + 0.5) / 10.0 << " bytes per voter, the region holds"
+                          << " about " << (uint64_t)((region - sizeof(voter_roll_header_t)) / per_voter) << " voters\n";
+            return 0;
+        }
+        if (out.empty()) {
+            write_c_table(std::cout, ix, in);
+        } else {
+            std::ofstream f(out, std::ios::binary);
+            if (!f) throw std::runtime_error("cannot write " + out);
+            write_c_table(f, ix, in);
+        }
+        std::cerr << in << ": " << roll.size() << " voters, " << ix.bytes() << " bytes of flash\n";
+    } catch (const std::exception &e) {
+        std::cerr << "votergen: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
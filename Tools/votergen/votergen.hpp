@@ -0,0 +1,68 @@
+// Voter roll compiler: reads a roll of card UIDs and builds the perfect-hash index the
+// firmware looks cards up in (Core/Inc/voter_index.h), as C source or as a flash image
+// (Core/Inc/voter_roll.h).
+#ifndef VOTERGEN_HPP
+#define VOTERGEN_HPP
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "voter_index.h"
+#include "voter_roll.h"
+}
+
+struct Voter {
+    uint8_t size = 0;
+    uint8_t uid[VOTER_UID_MAX] = {};
+    uint8_t precinct = 0;
+};
+
+// Roll file, CSV or JSON. UIDs are hex, 4, 7 or 10 bytes, ':', '-' and spaces allowed.
+//   CSV:  one voter per line, comma/semicolon/tab separated, '#' starts a comment. The UID is
+//         the first field unless a header line names a "uid" column; a "precinct" column
+//         (0..255) is read when the header names one.
+//   JSON: [ "uid", ... ] or [ { "uid": "...", "precinct": n }, ... ], bare or as "voters".
+// Throws std::runtime_error with the line number on bad input.
+std::vector<Voter> read_roll(const std::string &path);
+std::vector<Voter> parse_roll(const std::string &text);
+
+struct Index {
+    uint32_t seed = 0;
+    uint32_t n_slots = 0;
+    uint32_t n_buckets = 0;
+    std::vector<uint16_t> disp;
+    std::vector<uint16_t> fp;
+    std::vector<uint8_t> keys;      // n_slots * VOTER_SLOT_KEY
+    std::vector<uint32_t> slot_of;  // voter index assigned to each roll entry
+    uint32_t bloom_bits = 0;
+    uint32_t bloom_k = 0;
+    std::vector<uint32_t> bloom;
+
+    voter_index_t view() const;
+    size_t bytes() const { return disp.size() * 2 + fp.size() * 2 + keys.size() + bloom.size() * 4; }
+};
+
+struct BuildParams {
+    double load = 0.97;         // voters per slot
+    unsigned per_bucket = 5;    // voters per displacement bucket, on average
+    double bloom_fp = 0.01;     // prefilter false-positive rate, 0 = no prefilter
+};
+
+// Prefilter size for n voters at false-positive rate fp: bits (multiple of 32) and probes
+void bloom_size(size_t n, double fp, uint32_t *bits, uint32_t *k);
+
+// CHD build. Throws std::runtime_error on duplicate UIDs or if no seed works.
+Index build_index(const std::vector<Voter> &roll, const BuildParams &params = BuildParams());
+
+// Core/Src/voter_table.c with the tables as const arrays (.rodata)
+void write_c_table(std::ostream &out, const Index &index, const std::string &source);
+
+// Image for the VOTER_ROLL flash region. Checked with the firmware's voter_roll_open() and a
+// lookup of every voter before it is returned; throws if that fails or it exceeds max_size.
+std::vector<uint8_t> build_image(const Index &index, const std::vector<Voter> &roll, uint32_t roll_id,
+                                 uint32_t max_size);
+
+#endif